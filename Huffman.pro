@@ -92,9 +92,9 @@ OTHER_FILES     *=  $$files(*.txt, true)
 
 CONFIG          +=  sdk_no_version_check   # removes spurious warnings on Mac OS X
 
-# MinGW compiler lags, be conservative and use C++11 on all platforms
-# rather than special case
-CONFIG          +=  c++11
+# C++20 for the coroutines in async.h; needs GCC 10 or Clang 14 or later
+# (on MinGW, the GCC 10 toolchain or newer)
+CONFIG          +=  c++20
 
 # WARN_ON has -Wall -Wextra, add/remove a few specific warnings
 QMAKE_CXXFLAGS_WARN_ON      +=  -Werror=return-type
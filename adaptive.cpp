@@ -0,0 +1,404 @@
+#include "adaptive.h"
+#include "error.h"
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include "entropy.h"
+#include "testutil.h"
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * Adaptive Huffman coding. The public interface is provided in adaptive.h
+ * header file.
+ *
+ * The update follows Vitter, "Design and Analysis of Dynamic Huffman Codes"
+ * (JACM 34(4), 1987). Nodes of equal weight form blocks, leaves first. To add
+ * one to a leaf's weight, the leaf is first swapped with the highest node of
+ * its block, and then each node on the path to the root slides past the block
+ * it would otherwise break (internal nodes of its old weight for a leaf,
+ * leaves of its new weight for an internal node) before its weight goes up.
+ */
+
+namespace {
+    /* "CS106B AA" */
+    const uint32_t kAdaptiveHeader = 0xC5106BAA;
+
+    /* Bits used to write the value of a symbol after the escape code. */
+    const int kSymbolBits = 9;
+
+    const int kEscapeSymbol = -1;
+
+    /* A leaf for every symbol and the escape leaf, and the nodes joining them. */
+    const int kNodes = 2 * (kAdaptiveSymbols + 1) - 1;
+    const int kRoot = kNodes - 1;
+}
+
+bool isAdaptiveStream(const string& data) {
+    uint32_t header;
+    if (data.size() < sizeof header) return false;
+    memcpy(&header, data.data(), sizeof header);
+    return header == kAdaptiveHeader;
+}
+
+AdaptiveHuffmanModel::AdaptiveHuffmanModel()
+    : _weight(kNodes, 0), _parent(kNodes, -1), _child(kNodes, -1),
+      _symbol(kNodes, kEscapeSymbol), _leaf(kAdaptiveSymbols, -1), _escape(kRoot) {}
+
+void AdaptiveHuffmanModel::codeFor(int symbol, vector<uint8_t>& bits) const {
+    bits.clear();
+    int node = seen(symbol) ? _leaf[symbol] : _escape;
+    for (; node != kRoot; node = _parent[node]) {
+        bits.push_back(node != _child[_parent[node]]);
+    }
+    reverse(bits.begin(), bits.end());
+}
+
+bool AdaptiveHuffmanModel::seen(int symbol) const {
+    return _leaf[symbol] >= 0;
+}
+
+int AdaptiveHuffmanModel::root() const {
+    return kRoot;
+}
+
+bool AdaptiveHuffmanModel::isLeaf(int node) const {
+    return _child[node] < 0;
+}
+
+int AdaptiveHuffmanModel::child(int node, int bit) const {
+    return _child[node] + bit;
+}
+
+int AdaptiveHuffmanModel::symbolAt(int node) const {
+    return _symbol[node];
+}
+
+/*
+ * Points whatever refers to the node now at this position back at it: its
+ * children's parent, or the leaf index of its symbol.
+ */
+void AdaptiveHuffmanModel::relink(int node) {
+    if (_child[node] >= 0) {
+        _parent[_child[node]] = node;
+        _parent[_child[node] + 1] = node;
+    } else if (_symbol[node] == kEscapeSymbol) {
+        _escape = node;
+    } else {
+        _leaf[_symbol[node]] = node;
+    }
+}
+
+/*
+ * Exchanges the subtrees at two positions. Parents belong to positions, so
+ * each subtree takes on the other's parent.
+ */
+void AdaptiveHuffmanModel::swapNodes(int a, int b) {
+    swap(_weight[a], _weight[b]);
+    swap(_child[a], _child[b]);
+    swap(_symbol[a], _symbol[b]);
+    relink(a);
+    relink(b);
+}
+
+/*
+ * Moves the node past the block it must not stay below once its weight goes
+ * up, adds one to its weight, and returns the next node whose weight must go
+ * up: the new parent for a leaf, the former parent for an internal node. The
+ * root has no parent, so -1 is returned for it.
+ */
+int AdaptiveHuffmanModel::slideAndIncrement(int node) {
+    bool leaf = isLeaf(node);
+    uint64_t weight = _weight[node];
+    int formerParent = _parent[node];
+
+    int end = node;
+    while (end < kRoot) {
+        int next = end + 1;
+        bool passes = leaf ? (!isLeaf(next) && _weight[next] == weight)
+                           : (isLeaf(next) && _weight[next] == weight + 1);
+        if (!passes) break;
+        end = next;
+    }
+    for (int pos = node; pos < end; pos++) {
+        swapNodes(pos, pos + 1);
+    }
+    _weight[end]++;
+    return leaf ? _parent[end] : formerParent;
+}
+
+void AdaptiveHuffmanModel::update(int symbol) {
+    int node;
+    int leafToIncrement = -1;
+    if (!seen(symbol)) {
+        /* The escape leaf becomes the parent of a new escape leaf and a leaf
+         * for the symbol, in the two lowest free positions.
+         */
+        node = _escape;
+        int newLeaf = node - 1, newEscape = node - 2;
+        _child[node] = newEscape;
+        _parent[newLeaf] = _parent[newEscape] = node;
+        _symbol[newLeaf] = symbol;
+        _symbol[newEscape] = kEscapeSymbol;
+        relink(newLeaf);
+        relink(newEscape);
+        leafToIncrement = newLeaf;
+    } else {
+        node = _leaf[symbol];
+        int leader = node;
+        while (leader < kRoot && isLeaf(leader + 1) && _weight[leader + 1] == _weight[node]) {
+            leader++;
+        }
+        if (leader != node) {
+            swapNodes(node, leader);
+            node = leader;
+        }
+
+        /* A sibling of the escape leaf has the same weight as its parent, so
+         * it can only pass the parent after the parent has been incremented.
+         */
+        if (_child[_parent[node]] == _escape) {
+            leafToIncrement = node;
+            node = _parent[node];
+        }
+    }
+
+    while (node >= 0) {
+        node = slideAndIncrement(node);
+    }
+    if (leafToIncrement >= 0) {
+        slideAndIncrement(leafToIncrement);
+    }
+}
+
+AdaptiveHuffmanEncoder::AdaptiveHuffmanEncoder(ostream& out) : _out(out) {
+    _out.write(reinterpret_cast<const char *>(&kAdaptiveHeader), sizeof kAdaptiveHeader);
+}
+
+void AdaptiveHuffmanEncoder::put(char ch) {
+    if (_finished) {
+        error("Cannot add to a finished adaptive stream.");
+    }
+    code(uint8_t(ch));
+}
+
+void AdaptiveHuffmanEncoder::finish() {
+    if (_finished) return;
+    code(kEndOfStream);
+    if (_bitIndex != 0) {
+        _out.put(char(_bitBuffer));
+    }
+    _out.flush();
+    _finished = true;
+}
+
+void AdaptiveHuffmanEncoder::code(int symbol) {
+    _model.codeFor(symbol, _path);
+    for (uint8_t bit: _path) {
+        putBit(bit);
+    }
+    if (!_model.seen(symbol)) {
+        for (int i = 0; i < kSymbolBits; i++) {
+            putBit((symbol >> i) & 1);
+        }
+    }
+    _model.update(symbol);
+}
+
+void AdaptiveHuffmanEncoder::putBit(int bit) {
+    _bitBuffer |= bit << _bitIndex;
+    if (++_bitIndex == 8) {
+        _out.put(char(_bitBuffer));
+        _bitBuffer = 0;
+        _bitIndex = 0;
+    }
+}
+
+AdaptiveHuffmanDecoder::AdaptiveHuffmanDecoder(istream& in) : _in(in) {
+    uint32_t header;
+    if (!_in.read(reinterpret_cast<char *>(&header), sizeof header) || header != kAdaptiveHeader) {
+        error("Not an adaptive Huffman stream.");
+    }
+}
+
+bool AdaptiveHuffmanDecoder::get(char& ch) {
+    if (_ended) return false;
+
+    int node = _model.root();
+    while (!_model.isLeaf(node)) {
+        node = _model.child(node, getBit());
+    }
+    int symbol = _model.symbolAt(node);
+    if (symbol == kEscapeSymbol) {
+        symbol = 0;
+        for (int i = 0; i < kSymbolBits; i++) {
+            symbol |= getBit() << i;
+        }
+        if (symbol >= kAdaptiveSymbols || _model.seen(symbol)) {
+            error("Invalid new symbol in adaptive stream.");
+        }
+    }
+    _model.update(symbol);
+
+    if (symbol == kEndOfStream) {
+        _ended = true;
+        return false;
+    }
+    ch = char(symbol);
+    return true;
+}
+
+int AdaptiveHuffmanDecoder::getBit() {
+    if (_bitIndex == 8) {
+        char read;
+        if (!_in.get(read)) {
+            error("Unexpected end of adaptive stream.");
+        }
+        _bitBuffer = read;
+        _bitIndex = 0;
+    }
+    return (_bitBuffer >> _bitIndex++) & 1;
+}
+
+void compressAdaptive(istream& in, ostream& out) {
+    AdaptiveHuffmanEncoder encoder(out);
+    char ch;
+    while (in.get(ch)) {
+        encoder.put(ch);
+    }
+    encoder.finish();
+}
+
+void decompressAdaptive(istream& in, ostream& out) {
+    AdaptiveHuffmanDecoder decoder(in);
+    char ch;
+    while (decoder.get(ch)) {
+        out.put(ch);
+    }
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+namespace {
+    string compressedAdaptive(const string& text) {
+        istringstream in(text);
+        ostringstream out;
+        compressAdaptive(in, out);
+        return out.str();
+    }
+
+    string decompressedAdaptive(const string& data) {
+        istringstream in(data);
+        ostringstream out;
+        decompressAdaptive(in, out);
+        return out.str();
+    }
+
+    /* Letters whose frequencies change halfway through. */
+    string shiftingText(size_t size, unsigned seed) {
+        mt19937 random(seed);
+        string text;
+        while (text.size() < size / 2) {
+            text += "eeeetta "[random() % 8];
+        }
+        while (text.size() < size) {
+            text += "xyzzzqq\n"[random() % 8];
+        }
+        return text;
+    }
+}
+
+STUDENT_TEST("Adaptive streams round-trip empty, text and binary input") {
+    string allBytes;
+    for (int ch = 255; ch >= 0; ch--) {
+        allBytes += char(ch);
+    }
+    vector<string> inputs = {
+        "", "a", "aaaa", "abracadabra", allBytes, shiftingText(20000, 1), randomBytes(20000, 2)
+    };
+    for (const string& text: inputs) {
+        string data = compressedAdaptive(text);
+        EXPECT(isAdaptiveStream(data));
+        EXPECT_EQUAL(decompressedAdaptive(data), text);
+    }
+}
+
+STUDENT_TEST("Adaptive coding comes close to the order-0 bound") {
+    const string letters = "eeeeeeeetttttaaaaooooiiinnnsshhrrdlcumwfgypbvk  \n";
+    mt19937 random(3);
+    string text;
+    while (text.size() < 50000) {
+        text += letters[random() % letters.size()];
+    }
+    double bound = estimateCompression(text, text.size()).entropyBits * text.size() / 8;
+    EXPECT(compressedAdaptive(text).size() < bound * 1.03);
+}
+
+STUDENT_TEST("Every seen symbol's code leads back to its leaf") {
+    AdaptiveHuffmanModel model;
+    string text = shiftingText(2000, 4) + "0123456789";
+    vector<uint8_t> bits;
+    for (char ch: text) {
+        model.update(uint8_t(ch));
+        for (int symbol = 0; symbol < kAdaptiveSymbols; symbol++) {
+            if (!model.seen(symbol)) continue;
+            model.codeFor(symbol, bits);
+            int node = model.root();
+            for (uint8_t bit: bits) {
+                EXPECT(!model.isLeaf(node));
+                node = model.child(node, bit);
+            }
+            EXPECT(model.isLeaf(node));
+            EXPECT_EQUAL(model.symbolAt(node), symbol);
+        }
+    }
+}
+
+STUDENT_TEST("The encoder codes bytes as they arrive and refuses bytes after finish") {
+    ostringstream out;
+    AdaptiveHuffmanEncoder encoder(out);
+    for (char ch: string("streaming")) {
+        encoder.put(ch);
+    }
+    encoder.finish();
+    encoder.finish();
+    EXPECT_ERROR(encoder.put('x'));
+    EXPECT_EQUAL(decompressedAdaptive(out.str()), "streaming");
+}
+
+STUDENT_TEST("The decoder stops at the end-of-stream marker") {
+    istringstream in(compressedAdaptive("ab") + "trailing bytes");
+    AdaptiveHuffmanDecoder decoder(in);
+    char ch;
+    EXPECT(decoder.get(ch) && ch == 'a');
+    EXPECT(decoder.get(ch) && ch == 'b');
+    EXPECT(!decoder.get(ch));
+    EXPECT(!decoder.get(ch));
+}
+
+STUDENT_TEST("Data that is not an adaptive stream is reported") {
+    EXPECT(!isAdaptiveStream(""));
+    EXPECT(!isAdaptiveStream("abc"));
+    EXPECT_ERROR(decompressedAdaptive(""));
+    EXPECT_ERROR(decompressedAdaptive("not an adaptive stream"));
+}
+
+STUDENT_TEST("Truncated adaptive streams are reported") {
+    string data = compressedAdaptive(shiftingText(3000, 5));
+    for (size_t size = 0; size < data.size(); size++) {
+        EXPECT_ERROR(decompressedAdaptive(data.substr(0, size)));
+    }
+}
+
+STUDENT_TEST("Invalid new symbols are reported") {
+    /* The first symbol is coded as nine bits after an empty escape code; 511
+     * is not a symbol. */
+    string header = compressedAdaptive("").substr(0, 4);
+    EXPECT_ERROR(decompressedAdaptive(header + "\xFF\x01"));
+
+    /* A symbol that has been seen cannot be new again: 'a' (97) in nine
+     * bits, then the escape code, now a single 0 bit, and 97 again. */
+    EXPECT_ERROR(decompressedAdaptive(header + "\x61\x84\x01"));
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * One-pass adaptive Huffman coding (Vitter's algorithm), for streams that
+ * cannot be read twice. buildHuffmanTree needs the whole text to count it
+ * before anything is coded, and the tree must then be written ahead of the
+ * message. Here the encoder and decoder start from the same empty tree and
+ * update it identically after every byte, so each byte is coded as soon as it
+ * arrives and no tree is ever written.
+ *
+ * A byte not seen before is coded as an escape code followed by its value in
+ * 9 bits. The stream ends with an end-of-stream symbol coded the same way, so
+ * its length need not be known in advance.
+ *
+ * On disk: the magic header, then the coded bits, packed low bit first.
+ */
+
+/* Symbols are the 256 byte values and an end-of-stream marker. */
+const int kAdaptiveSymbols = 257;
+const int kEndOfStream = 256;
+
+/**
+ * Returns whether the data begins with the adaptive stream magic header.
+ */
+bool isAdaptiveStream(const std::string& data);
+
+/**
+ * Type holding the tree shared by encoder and decoder. Nodes are kept in an
+ * array in order of weight, leaves before internal nodes of equal weight, and
+ * siblings side by side, which is the numbering Vitter's update maintains.
+ * Node numbers are positions in that array; the root is always the last one.
+ */
+class AdaptiveHuffmanModel {
+public:
+    AdaptiveHuffmanModel();
+
+    /* Stores the code for symbol, root first, in bits. For a symbol not yet
+     * seen, this is the code of the escape leaf.
+     */
+    void codeFor(int symbol, std::vector<uint8_t>& bits) const;
+
+    /* Returns whether symbol has been seen. */
+    bool seen(int symbol) const;
+
+    /* Adds one to the weight of symbol, reshaping the tree to match. */
+    void update(int symbol);
+
+    /* Walking the tree while decoding. symbolAt returns -1 for the escape
+     * leaf.
+     */
+    int root() const;
+    bool isLeaf(int node) const;
+    int child(int node, int bit) const;
+    int symbolAt(int node) const;
+
+private:
+    void swapNodes(int a, int b);
+    void relink(int node);
+    int slideAndIncrement(int node);
+
+    std::vector<uint64_t> _weight;
+    std::vector<int>      _parent;   // parent of the node at each position
+    std::vector<int>      _child;    // position of the left child, or -1 for a leaf
+    std::vector<int>      _symbol;   // symbol of a leaf, or -1 for the escape leaf
+    std::vector<int>      _leaf;     // position of each symbol's leaf, or -1
+    int _escape;
+};
+
+/**
+ * Codes bytes one at a time to an output stream. finish must be called after
+ * the last byte to write the end-of-stream marker and the final bits.
+ */
+class AdaptiveHuffmanEncoder {
+public:
+    explicit AdaptiveHuffmanEncoder(std::ostream& out);
+
+    void put(char ch);
+    void finish();
+
+private:
+    void code(int symbol);
+    void putBit(int bit);
+
+    std::ostream& _out;
+    AdaptiveHuffmanModel _model;
+    std::vector<uint8_t> _path;
+    uint8_t _bitBuffer = 0;
+    int     _bitIndex  = 0;
+    bool    _finished  = false;
+};
+
+/**
+ * Decodes bytes one at a time from an input stream. get returns false once the
+ * end-of-stream marker is reached, and reports an error if the stream is
+ * malformed or ends early.
+ */
+class AdaptiveHuffmanDecoder {
+public:
+    explicit AdaptiveHuffmanDecoder(std::istream& in);
+
+    bool get(char& ch);
+
+private:
+    int getBit();
+
+    std::istream& _in;
+    AdaptiveHuffmanModel _model;
+    uint8_t _bitBuffer = 0;
+    int     _bitIndex  = 8;
+    bool    _ended     = false;
+};
+
+/**
+ * Codes everything from in to out in a single pass, or decodes it back.
+ */
+void compressAdaptive(std::istream& in, std::ostream& out);
+void decompressAdaptive(std::istream& in, std::ostream& out);
@@ -0,0 +1,364 @@
+#include "ans.h"
+#include "bitstream.h"
+#include "codetable.h"
+#include "error.h"
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * tANS coding of blocks. The public interface is provided in ans.h header
+ * file.
+ *
+ * The payload holds the table log (4 bits); for each byte value a presence
+ * bit, and for those present the scaled count less one as a bucket (5 bits,
+ * see toBucket in codetable.h) and its extra bits; the final encoder state
+ * (tableLog bits); and then the bits read on each decoding step, in decoding
+ * order.
+ *
+ * States are numbered as in the decoder, from 0 to tableSize - 1; the encoder
+ * works with the same states plus tableSize. Every byte value with a scaled
+ * count n owns n of the states, spread evenly around the table. Coding a byte
+ * drops low bits from the state until it lies in [n, 2n), then moves to the
+ * state owned by the byte that has that rank. Decoding does the opposite.
+ */
+
+namespace {
+    const int kTableLogBits = 4;
+    const int kBucketBits = 5;
+
+    /* One decoding step. */
+    struct DecodeEntry {
+        uint16_t newBase;   // next state, less the bits read
+        uint8_t  symbol;
+        uint8_t  numBits;
+    };
+
+    int highBit(uint32_t value) {
+        return 31 - __builtin_clz(value);
+    }
+
+    int presentCount(const uint64_t counts[256]) {
+        int present = 0;
+        for (int ch = 0; ch < 256; ch++) {
+            if (counts[ch] != 0) present++;
+        }
+        return present;
+    }
+
+    /**
+     * Returns the table log to use for a block of size bytes with present byte
+     * values: as small as the block allows, since tables cost time to build,
+     * but with a state for every value and no larger than kAnsMaxTableLog.
+     */
+    int tableLogFor(uint64_t size, int present) {
+        uint64_t needed = max<uint64_t>(size, present);
+        int tableLog = kAnsMaxTableLog;
+        while (tableLog > kAnsMinTableLog && (uint64_t(1) << (tableLog - 1)) >= needed) {
+            tableLog--;
+        }
+        return tableLog;
+    }
+
+    /**
+     * Scales counts to sum to 2^tableLog, giving every byte that occurs at
+     * least 1. Rounding errors are corrected one step at a time, each time
+     * changing whichever count costs the fewest bits to change.
+     */
+    vector<uint32_t> normalizeCounts(const uint64_t counts[256], int tableLog) {
+        uint64_t total = 0;
+        for (int ch = 0; ch < 256; ch++) total += counts[ch];
+
+        uint32_t tableSize = uint32_t(1) << tableLog;
+        vector<uint32_t> norm(256, 0);
+        int64_t sum = 0;
+        for (int ch = 0; ch < 256; ch++) {
+            if (counts[ch] == 0) continue;
+            double scaled = double(counts[ch]) * tableSize / total;
+            norm[ch] = max<uint32_t>(1, uint32_t(llround(scaled)));
+            sum += norm[ch];
+        }
+
+        while (sum != tableSize) {
+            int best = -1;
+            double bestCost = numeric_limits<double>::max();
+            for (int ch = 0; ch < 256; ch++) {
+                if (norm[ch] == 0 || (sum > tableSize && norm[ch] == 1)) continue;
+                double cost = sum > tableSize
+                    ? counts[ch] * log2(double(norm[ch]) / (norm[ch] - 1))
+                    : -(counts[ch] * log2(double(norm[ch] + 1) / norm[ch]));
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    best = ch;
+                }
+            }
+            if (sum > tableSize) {
+                norm[best]--;
+                sum--;
+            } else {
+                norm[best]++;
+                sum++;
+            }
+        }
+        return norm;
+    }
+
+    /* Bits needed to write the table log and scaled counts. */
+    uint64_t headerBits(const vector<uint32_t>& norm) {
+        uint64_t bits = kTableLogBits;
+        int bucket, extraBits;
+        uint32_t extra;
+        for (uint32_t n: norm) {
+            bits++;
+            if (n == 0) continue;
+            toBucket(n - 1, bucket, extraBits, extra);
+            bits += kBucketBits + extraBits;
+        }
+        return bits;
+    }
+
+    /**
+     * Lays out the states, calling visit(state, symbol, rank) for each, where
+     * rank runs from n to 2n - 1 over the n states owned by symbol.
+     */
+    template <typename Visit>
+    void spreadStates(const vector<uint32_t>& norm, int tableLog, Visit visit) {
+        uint32_t tableSize = uint32_t(1) << tableLog;
+        uint32_t mask = tableSize - 1;
+        uint32_t step = (tableSize >> 1) + (tableSize >> 3) + 3;   // odd, so visits every state
+
+        vector<uint8_t> symbolAt(tableSize);
+        uint32_t pos = 0;
+        for (int ch = 0; ch < 256; ch++) {
+            for (uint32_t i = 0; i < norm[ch]; i++) {
+                symbolAt[pos] = uint8_t(ch);
+                pos = (pos + step) & mask;
+            }
+        }
+
+        vector<uint32_t> rank(norm);
+        for (uint32_t state = 0; state < tableSize; state++) {
+            uint8_t symbol = symbolAt[state];
+            visit(state, symbol, rank[symbol]++);
+        }
+    }
+}
+
+uint64_t ansPayloadBytes(const uint64_t counts[256], uint64_t counted, uint64_t size) {
+    int present = presentCount(counts);
+    if (present < 2) return numeric_limits<uint64_t>::max();
+
+    int tableLog = tableLogFor(size, present);
+    vector<uint32_t> norm = normalizeCounts(counts, tableLog);
+    double bits = 0;
+    for (int ch = 0; ch < 256; ch++) {
+        if (counts[ch] == 0) continue;
+        bits += counts[ch] * (tableLog - log2(double(norm[ch])));
+    }
+    if (counted != size) {
+        bits = bits * size / counted;
+    }
+    return (headerBits(norm) + tableLog + uint64_t(ceil(bits)) + 7) / 8;
+}
+
+void encodeAns(const char* text, size_t size, const uint64_t counts[256], string& out) {
+    int tableLog = tableLogFor(size, presentCount(counts));
+    uint32_t tableSize = uint32_t(1) << tableLog;
+    vector<uint32_t> norm = normalizeCounts(counts, tableLog);
+
+    /* next[start[s] + rank - n] is the encoder state owned by s with that rank. */
+    vector<uint32_t> start(256, 0);
+    for (int ch = 1; ch < 256; ch++) {
+        start[ch] = start[ch - 1] + norm[ch - 1];
+    }
+    vector<uint32_t> next(tableSize);
+    spreadStates(norm, tableLog, [&](uint32_t state, uint8_t symbol, uint32_t rank) {
+        next[start[symbol] + rank - norm[symbol]] = tableSize + state;
+    });
+
+    /* Code backwards, keeping each step's bits as (bits << 4 | count) so they
+     * can be written in the order the decoder reads them.
+     */
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(text);
+    vector<uint16_t> steps(size);
+    uint32_t state = tableSize;
+    for (size_t i = size; i-- > 0; ) {
+        uint8_t symbol = bytes[i];
+        uint32_t n = norm[symbol];
+        if (n == 0) {
+            error("Byte missing from tANS histogram.");
+        }
+        int numBits = tableLog - highBit(n);
+        if (state < (n << numBits)) numBits--;
+        steps[i] = uint16_t((state & ((1U << numBits) - 1)) << 4 | numBits);
+        state = next[start[symbol] + (state >> numBits) - n];
+    }
+
+    BitStreamWriter writer(out);
+    writer.put(tableLog, kTableLogBits);
+    int bucket, extraBits;
+    uint32_t extra;
+    for (uint32_t n: norm) {
+        writer.put(n != 0, 1);
+        if (n == 0) continue;
+        toBucket(n - 1, bucket, extraBits, extra);
+        writer.put(bucket, kBucketBits);
+        writer.put(extra, extraBits);
+    }
+    writer.put(state - tableSize, tableLog);
+    for (uint16_t step: steps) {
+        writer.put(step >> 4, step & 0xF);
+    }
+    writer.flush();
+}
+
+void decodeAns(const char* payload, size_t payloadSize, char* out, size_t size) {
+    BitStreamReader reader(payload, payloadSize);
+    int tableLog = reader.get(kTableLogBits);
+    if (tableLog < kAnsMinTableLog || tableLog > kAnsMaxTableLog) {
+        error("Invalid table size in tANS block.");
+    }
+    uint32_t tableSize = uint32_t(1) << tableLog;
+
+    vector<uint32_t> norm(256, 0);
+    uint64_t sum = 0;
+    for (int ch = 0; ch < 256; ch++) {
+        if (reader.get(1) == 0) continue;
+        int bucket = reader.get(kBucketBits);
+        if (bucket >= 2 * kAnsMaxTableLog) {
+            error("Invalid count in tANS block.");
+        }
+        norm[ch] = 1 + fromBucket(bucket, reader);
+        sum += norm[ch];
+    }
+    if (sum != tableSize) {
+        error("tANS counts do not fill the table.");
+    }
+
+    vector<DecodeEntry> table(tableSize);
+    spreadStates(norm, tableLog, [&](uint32_t state, uint8_t symbol, uint32_t rank) {
+        int numBits = tableLog - highBit(rank);
+        table[state].newBase = uint16_t((rank << numBits) - tableSize);
+        table[state].symbol = symbol;
+        table[state].numBits = uint8_t(numBits);
+    });
+
+    uint32_t state = reader.get(tableLog);
+    for (size_t i = 0; i < size; i++) {
+        const DecodeEntry& entry = table[state];
+        out[i] = char(entry.symbol);
+        state = entry.newBase + reader.get(entry.numBits);
+    }
+    reader.checkNotOverrun();
+    if (state != 0) {
+        error("tANS block did not end in its starting state.");
+    }
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+namespace {
+    struct Histogram {
+        uint64_t counts[256] = {};
+    };
+
+    Histogram histogramOf(const string& text) {
+        Histogram histogram;
+        for (char ch: text) {
+            histogram.counts[uint8_t(ch)]++;
+        }
+        return histogram;
+    }
+
+    string encodedAns(const string& text) {
+        string payload;
+        encodeAns(text.data(), text.size(), histogramOf(text).counts, payload);
+        return payload;
+    }
+
+    string decodedAns(const string& payload, size_t size) {
+        string text(size, '\0');
+        decodeAns(payload.data(), payload.size(), &text[0], size);
+        return text;
+    }
+
+    /* Mostly one byte value, with others mixed in once in every rarity bytes
+     * on average. */
+    string skewedBytes(size_t size, int rarity, unsigned seed) {
+        mt19937 random(seed);
+        string bytes;
+        while (bytes.size() < size) {
+            bytes += (random() % rarity == 0) ? char(random()) : ' ';
+        }
+        return bytes;
+    }
+}
+
+STUDENT_TEST("tANS round-trips skewed, even and two-valued blocks") {
+    string allBytes;
+    for (int ch = 0; ch < 256; ch++) {
+        allBytes += char(ch);
+    }
+    vector<string> inputs = {
+        "ab", "aab", string(1000, 'a') + "b", allBytes + allBytes, skewedBytes(20000, 20, 1),
+        skewedBytes(20000, 2, 2)
+    };
+    for (const string& text: inputs) {
+        EXPECT_EQUAL(decodedAns(encodedAns(text), text.size()), text);
+    }
+}
+
+STUDENT_TEST("tANS spends well under a bit on a very common byte") {
+    string text = skewedBytes(100000, 100, 3);
+    EXPECT(encodedAns(text).size() < text.size() / 8 / 2);
+}
+
+STUDENT_TEST("ansPayloadBytes predicts the payload size closely") {
+    for (int rarity: { 2, 10, 100 }) {
+        string text = skewedBytes(30000, rarity, 4);
+        uint64_t predicted = ansPayloadBytes(histogramOf(text).counts, text.size(), text.size());
+        uint64_t actual = encodedAns(text).size();
+        EXPECT(predicted <= actual + 1 && actual <= predicted + predicted / 100 + 2);
+    }
+}
+
+STUDENT_TEST("tANS declines blocks with a single byte value") {
+    EXPECT_EQUAL(ansPayloadBytes(histogramOf(string(100, 'a')).counts, 100, 100), UINT64_MAX);
+}
+
+STUDENT_TEST("Bytes missing from the tANS histogram are reported") {
+    string text = "aaab";
+    Histogram histogram = histogramOf("aaac");
+    string payload;
+    EXPECT_ERROR(encodeAns(text.data(), text.size(), histogram.counts, payload));
+}
+
+STUDENT_TEST("Truncated tANS payloads are reported") {
+    string text = skewedBytes(3000, 5, 5);
+    string payload = encodedAns(text);
+    for (size_t size = 0; size < payload.size(); size++) {
+        EXPECT_ERROR(decodedAns(payload.substr(0, size), text.size()));
+    }
+}
+
+STUDENT_TEST("Damaged tANS payloads never write past the block") {
+    string text = skewedBytes(3000, 5, 6);
+    string payload = encodedAns(text);
+    const size_t guard = 64;
+    for (size_t i = 0; i < payload.size(); i++) {
+        string damaged = payload;
+        damaged[i] ^= 0x24;
+        string out(text.size() + guard, '#');
+        try {
+            decodeAns(damaged.data(), damaged.size(), &out[0], text.size());
+        } catch (ErrorException&) {
+            /* Reporting the damage is expected. */
+        }
+        EXPECT_EQUAL(out.substr(text.size()), string(guard, '#'));
+    }
+}
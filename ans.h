@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Table-based asymmetric numeral systems (tANS, as in FSE), used by the
+ * container for its Ans block method. A Huffman code spends a whole number of
+ * bits on every byte, which wastes close to a bit per byte when one value is
+ * far more common than the rest; tANS spends fractional bits, so skewed data
+ * codes close to its entropy.
+ *
+ * The byte counts are scaled to sum to a table size of 2^tableLog, and the
+ * coder keeps a state below the table size. Decoding a byte is one table
+ * lookup, giving the byte, the number of bits to read and the base of the next
+ * state, with no branches on the data.
+ *
+ * The encoder works through the block backwards, which is what lets the decoder
+ * work forwards.
+ */
+
+const int kAnsMinTableLog = 5;
+const int kAnsMaxTableLog = 12;
+
+/**
+ * Returns the number of payload bytes encodeAns would write for a block of
+ * size bytes whose histogram, taken from counted of them, is counts. The
+ * estimate assumes every byte costs exactly its share of the table, so it
+ * comes in a fraction of a percent low when counted == size. Returns
+ * UINT64_MAX if tANS cannot code the block, which is the case when fewer than
+ * two byte values occur.
+ */
+uint64_t ansPayloadBytes(const uint64_t counts[256], uint64_t counted, uint64_t size);
+
+/**
+ * Codes size bytes of text, appending the payload to out. counts must give a
+ * nonzero count for every byte value in the text, and at least two must be
+ * nonzero; only their proportions matter.
+ */
+void encodeAns(const char* text, size_t size, const uint64_t counts[256], std::string& out);
+
+/**
+ * Decodes a payload written by encodeAns into exactly size bytes at out.
+ * Reports an error if the payload is malformed.
+ */
+void decodeAns(const char* payload, size_t payloadSize, char* out, size_t size);
@@ -0,0 +1,588 @@
+#include "archive.h"
+#include "error.h"
+#include "filelib.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+#include "testutil.h"
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * Writing and reading of the archive format described in archive.h.
+ */
+
+namespace {
+    /* "CS106B AC" */
+    const uint32_t kArchiveHeader = 0xC5106BAC;
+    const uint8_t kArchiveVersion = 1;
+
+    /* "CS106B AD", at the very end of an archive. */
+    const uint32_t kArchiveTrailer = 0xC5106BAD;
+
+    const size_t kArchiveHeaderBytes = sizeof kArchiveHeader + 1;
+    const size_t kArchiveFooterBytes = 8 + sizeof kArchiveTrailer;
+
+    void putVarint(string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(char(0x80 | (value & 0x7F)));
+            value >>= 7;
+        }
+        out.push_back(char(value));
+    }
+
+    uint64_t getVarint(const string& data, size_t& pos) {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= data.size()) {
+                error("Archive directory is damaged.");
+            }
+            uint8_t byte = data[pos++];
+            value |= uint64_t(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) return value;
+        }
+        error("Archive directory is damaged.");
+    }
+
+    /* Little-endian, in the given number of bytes. */
+    void putInteger(string& out, uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            out.push_back(char(value >> (8 * i)));
+        }
+    }
+
+    uint64_t getInteger(const char* data, int bytes) {
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; i++) {
+            value |= uint64_t(uint8_t(data[i])) << (8 * i);
+        }
+        return value;
+    }
+
+    /**
+     * One entry being compressed or extracted a block at a time: its input,
+     * its converted blocks, and how many blocks are still to do. Its share of
+     * the memory budget is given back when the last task holding it lets go.
+     */
+    struct EntryJob {
+        EntryJob(MemoryBudget& budget, uint64_t held) : budget(budget), held(held), remaining(0) {}
+
+        ~EntryJob() {
+            budget.release(held);
+        }
+
+        MemoryBudget& budget;
+        uint64_t held;
+        size_t index;               // in the list of entries
+        string input;
+        ContainerLayout layout;     // used when extracting
+        vector<string> pieces;
+        atomic<size_t> remaining;
+    };
+
+    /**
+     * Submits a task to the pool for each of count blocks of the job, which
+     * runs piece on it, and calls finish on the worker that does the last.
+     * Called from one of the pool's tasks, so idle workers steal the blocks.
+     */
+    void runPieces(WorkStealingPool& pool, const shared_ptr<EntryJob>& job, size_t count,
+                   const function<void(EntryJob&, size_t)>& piece,
+                   const function<void(EntryJob&)>& finish) {
+        job->pieces.resize(count);
+        job->remaining = count;
+        if (count == 0) {
+            finish(*job);
+            return;
+        }
+        for (size_t i = 0; i < count; i++) {
+            pool.submit([&pool, job, i, &piece, &finish]() {
+                piece(*job, i);
+                if (--job->remaining == 0) {
+                    finish(*job);
+                }
+            });
+        }
+    }
+
+    string readFile(const string& path) {
+        ifstream in(path, ios::binary);
+        if (!in) {
+            error("Unable to open " + path + ".");
+        }
+        string contents((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        if (in.bad()) {
+            error("Unable to read " + path + ".");
+        }
+        return contents;
+    }
+}
+
+bool isArchive(const string& data) {
+    uint32_t header;
+    if (data.size() < sizeof header) return false;
+    memcpy(&header, data.data(), sizeof header);
+    return header == kArchiveHeader;
+}
+
+void writeArchive(ostream& out, const vector<string>& names,
+                  const vector<string>& paths, const ContainerOptions& options) {
+    if (names.size() != paths.size()) {
+        error("Every file in an archive needs a name.");
+    }
+    unordered_map<string, size_t> seen;
+    for (size_t i = 0; i < names.size(); i++) {
+        if (!seen.insert(make_pair(names[i], i)).second) {
+            error("The name " + names[i] + " appears twice in the archive.");
+        }
+    }
+
+    string header;
+    putInteger(header, kArchiveHeader, sizeof kArchiveHeader);
+    header.push_back(char(kArchiveVersion));
+    out.write(header.data(), header.size());
+    uint64_t offset = header.size();
+
+    /* Each entry is read by one task, which then submits a task per block,
+     * as compressDirectory does, so one large file does not hold up the rest.
+     * The function objects outlive every task that refers to them.
+     */
+    checkContainerOptions(options);
+    size_t blockSize = options.blockSize;
+    MemoryBudget budget(kArchiveMemoryBudget);
+
+    /* A finished entry waits here, keeping its share of the budget, until
+     * every entry before it has been written, as the pipeline's writer does.
+     */
+    struct Finished {
+        string container;
+        uint64_t size;
+        uint64_t held;
+    };
+    mutex writeLock;
+    map<size_t, Finished> waiting;
+    vector<ArchiveEntry> entries;
+
+    function<void(EntryJob&, size_t)> encodePiece = [&](EntryJob& job, size_t i) {
+        size_t start = i * blockSize;
+        encodeBlock(job.input.data() + start, min(blockSize, job.input.size() - start), options, job.pieces[i]);
+    };
+    function<void(EntryJob&)> finishEntry = [&](EntryJob& job) {
+        Finished done;
+        vector<uint64_t> rawSizes, blockBytes;
+        done.container = containerHeader(options);
+        for (size_t i = 0; i < job.pieces.size(); i++) {
+            rawSizes.push_back(min(blockSize, job.input.size() - i * blockSize));
+            blockBytes.push_back(job.pieces[i].size());
+            done.container += job.pieces[i];
+            string().swap(job.pieces[i]);
+        }
+        done.container += containerTrailer(options, rawSizes, blockBytes);
+        done.size = job.input.size();
+        done.held = job.held;
+        job.held = 0;
+
+        lock_guard<mutex> guard(writeLock);
+        waiting[job.index] = move(done);
+        for (auto it = waiting.begin(); it != waiting.end() && it->first == entries.size(); it = waiting.erase(it)) {
+            const string& container = it->second.container;
+            ArchiveEntry entry = { names[it->first], it->second.size, offset, container.size() };
+            entries.push_back(entry);
+            out.write(container.data(), container.size());
+            offset += container.size();
+            budget.release(it->second.held);
+        }
+    };
+
+    WorkStealingPool pool(options.threads);
+    for (size_t i = 0; i < paths.size(); i++) {
+        const string& path = paths[i];
+        uint64_t expected = max<long>(fileSize(path), 0);
+        shared_ptr<EntryJob> job = make_shared<EntryJob>(budget, budget.acquire(expected));
+        job->index = i;
+        pool.submit([&, job, path]() {
+            job->input = readFile(path);
+            runPieces(pool, job, (job->input.size() + blockSize - 1) / blockSize, encodePiece, finishEntry);
+        });
+    }
+    pool.wait();
+
+    string directory;
+    putVarint(directory, entries.size());
+    for (const ArchiveEntry& entry: entries) {
+        putVarint(directory, entry.name.size());
+        directory += entry.name;
+        putVarint(directory, entry.size);
+        putVarint(directory, entry.offset);
+        putVarint(directory, entry.storedBytes);
+    }
+    putInteger(directory, offset, 8);
+    putInteger(directory, kArchiveTrailer, sizeof kArchiveTrailer);
+    out.write(directory.data(), directory.size());
+    if (!out) {
+        error("Unable to write archive.");
+    }
+}
+
+ArchiveReader::ArchiveReader(istream& in) : _in(in) {
+    _in.seekg(0, ios::end);
+    uint64_t fileSize = _in.tellg();
+    if (!_in || fileSize < kArchiveHeaderBytes + kArchiveFooterBytes) {
+        error("Not an archive, or a damaged one.");
+    }
+    char header[kArchiveHeaderBytes];
+    char footer[kArchiveFooterBytes];
+    _in.seekg(0);
+    _in.read(header, sizeof header);
+    _in.seekg(fileSize - kArchiveFooterBytes);
+    _in.read(footer, sizeof footer);
+    if (!_in || getInteger(header, sizeof kArchiveHeader) != kArchiveHeader
+            || getInteger(footer + 8, sizeof kArchiveTrailer) != kArchiveTrailer) {
+        error("Not an archive, or a damaged one.");
+    }
+    if (uint8_t(header[sizeof kArchiveHeader]) != kArchiveVersion) {
+        error("Unsupported archive version.");
+    }
+
+    uint64_t directoryStart = getInteger(footer, 8);
+    uint64_t directoryEnd = fileSize - kArchiveFooterBytes;
+    if (directoryStart < kArchiveHeaderBytes || directoryStart > directoryEnd) {
+        error("Archive directory is damaged.");
+    }
+    string directory(directoryEnd - directoryStart, '\0');
+    _in.seekg(directoryStart);
+    if (!_in.read(&directory[0], directory.size())) {
+        error("Unable to read archive directory.");
+    }
+
+    size_t pos = 0;
+    uint64_t count = getVarint(directory, pos);
+    if (count > directory.size()) {
+        error("Archive directory is damaged.");
+    }
+    _entries.reserve(count);
+    _byName.reserve(count);
+    for (uint64_t i = 0; i < count; i++) {
+        ArchiveEntry entry;
+        uint64_t nameLength = getVarint(directory, pos);
+        if (nameLength > directory.size() - pos) {
+            error("Archive directory is damaged.");
+        }
+        entry.name = directory.substr(pos, nameLength);
+        pos += nameLength;
+        entry.size = getVarint(directory, pos);
+        entry.offset = getVarint(directory, pos);
+        entry.storedBytes = getVarint(directory, pos);
+        if (entry.offset < kArchiveHeaderBytes || entry.offset > directoryStart
+                || entry.storedBytes > directoryStart - entry.offset) {
+            error("Archive entry " + entry.name + " lies outside the archive.");
+        }
+        _byName[entry.name] = _entries.size();
+        _entries.push_back(entry);
+    }
+    if (pos != directory.size()) {
+        error("Archive directory is damaged.");
+    }
+}
+
+const vector<ArchiveEntry>& ArchiveReader::entries() const {
+    return _entries;
+}
+
+const ArchiveEntry* ArchiveReader::find(const string& name) const {
+    auto found = _byName.find(name);
+    return found == _byName.end() ? nullptr : &_entries[found->second];
+}
+
+string ArchiveReader::extract(const ArchiveEntry& entry, int threads) {
+    string contents = decompressContainer(readStored(entry), threads);
+    if (contents.size() != entry.size) {
+        error("Archive entry " + entry.name + " does not match the directory.");
+    }
+    return contents;
+}
+
+void ArchiveReader::extractEach(const vector<const ArchiveEntry*>& chosen, int threads,
+                                const function<void(size_t, const string&)>& done) {
+    function<void(EntryJob&, size_t)> decodePiece = [](EntryJob& job, size_t i) {
+        decodeBlock(job.input, job.layout.blockStarts[i], job.pieces[i], job.layout.checksums);
+    };
+    function<void(EntryJob&)> finishEntry = [&](EntryJob& job) {
+        const ArchiveEntry& entry = *chosen[job.index];
+        uint64_t total = 0;
+        for (const string& piece: job.pieces) {
+            total += piece.size();
+        }
+        if (total != entry.size) {
+            error("Archive entry " + entry.name + " does not match the directory.");
+        }
+        string contents;
+        contents.reserve(total);
+        for (string& piece: job.pieces) {
+            contents += piece;
+            string().swap(piece);
+        }
+        done(job.index, contents);
+    };
+    MemoryBudget budget(kArchiveMemoryBudget);
+    WorkStealingPool pool(threads);
+    for (size_t i = 0; i < chosen.size(); i++) {
+        const ArchiveEntry& entry = *chosen[i];
+        shared_ptr<EntryJob> job = make_shared<EntryJob>(budget, budget.acquire(entry.storedBytes + entry.size));
+        job->index = i;
+        pool.submit([&, job]() {
+            job->input = readStored(*chosen[job->index]);
+            job->layout = scanContainer(job->input);
+            runPieces(pool, job, job->layout.blockStarts.size(), decodePiece, finishEntry);
+        });
+    }
+    pool.wait();
+}
+
+string ArchiveReader::readStored(const ArchiveEntry& entry) {
+    string stored(entry.storedBytes, '\0');
+    lock_guard<mutex> guard(_lock);
+    _in.clear();
+    _in.seekg(entry.offset);
+    if (!_in.read(&stored[0], stored.size())) {
+        error("Unable to read " + entry.name + " from archive.");
+    }
+    return stored;
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+#if !defined(_WIN32)
+
+namespace {
+    /* Files written to a fresh temporary directory, removed when done. */
+    struct TestFiles {
+        string directory;
+        vector<string> paths;
+
+        TestFiles() {
+            char pattern[] = "/tmp/archive-test-XXXXXX";
+            directory = mkdtemp(pattern);
+        }
+
+        ~TestFiles() {
+            for (const string& path: paths) {
+                remove(path.c_str());
+            }
+            rmdir(directory.c_str());
+        }
+
+        string add(const string& name, const string& contents) {
+            string path = directory + "/" + name;
+            ofstream(path, ios::binary) << contents;
+            paths.push_back(path);
+            return path;
+        }
+    };
+
+    /* Names and contents of the files in the test archives. */
+    const vector<string> kNames = { "notes.txt", "empty", "dir/data.bin", "repeated.txt" };
+
+    vector<string> testContents() {
+        string repeated;
+        for (int i = 0; i < 2000; i++) {
+            repeated += "line " + to_string(i % 17) + " of the log\n";
+        }
+        return { "It was the best of times, it was the worst of times.", "", randomBytes(20000, 1), repeated };
+    }
+
+    string archiveOf(TestFiles& files, const vector<string>& contents, ContainerOptions options) {
+        vector<string> paths;
+        for (size_t i = 0; i < contents.size(); i++) {
+            paths.push_back(files.add("file" + to_string(i), contents[i]));
+        }
+        ostringstream out;
+        writeArchive(out, vector<string>(kNames.begin(), kNames.begin() + contents.size()), paths, options);
+        return out.str();
+    }
+}
+
+STUDENT_TEST("Archives round-trip every entry, found by name") {
+    TestFiles files;
+    vector<string> contents = testContents();
+    ContainerOptions options;
+    options.blockSize = 4096;
+    string data = archiveOf(files, contents, options);
+    EXPECT(isArchive(data));
+
+    istringstream in(data);
+    ArchiveReader archive(in);
+    EXPECT_EQUAL(archive.entries().size(), kNames.size());
+    for (size_t i = 0; i < kNames.size(); i++) {
+        const ArchiveEntry* entry = archive.find(kNames[i]);
+        EXPECT(entry == &archive.entries()[i]);
+        EXPECT_EQUAL(entry->name, kNames[i]);
+        EXPECT_EQUAL(entry->size, uint64_t(contents[i].size()));
+        EXPECT_EQUAL(archive.extract(*entry), contents[i]);
+        EXPECT_EQUAL(archive.extract(*entry, 4), contents[i]);
+    }
+    EXPECT(archive.find("missing") == nullptr);
+}
+
+STUDENT_TEST("Archives do not depend on the number of threads") {
+    TestFiles files;
+    vector<string> contents = testContents();
+    ContainerOptions options;
+    options.blockSize = 1000;
+    string oneThread = archiveOf(files, contents, options);
+    options.threads = 4;
+    EXPECT_EQUAL(archiveOf(files, contents, options), oneThread);
+}
+
+STUDENT_TEST("Entries are written in order whichever finishes first") {
+    /* The first file takes longest, so the small ones after it finish first
+     * and have to wait for it. */
+    TestFiles files;
+    vector<string> names, paths, contents;
+    for (int i = 0; i < 40; i++) {
+        contents.push_back(i == 0 ? randomBytes(300000, 2) : "file " + to_string(i));
+        names.push_back("entry" + to_string(i));
+        paths.push_back(files.add(names.back(), contents.back()));
+    }
+    ContainerOptions options;
+    options.blockSize = 1000;
+    ostringstream oneThread;
+    writeArchive(oneThread, names, paths, options);
+    options.threads = 4;
+    ostringstream fourThreads;
+    writeArchive(fourThreads, names, paths, options);
+    EXPECT_EQUAL(fourThreads.str(), oneThread.str());
+
+    istringstream in(fourThreads.str());
+    ArchiveReader archive(in);
+    EXPECT_EQUAL(archive.entries().size(), names.size());
+    for (size_t i = 0; i < names.size(); i++) {
+        EXPECT_EQUAL(archive.entries()[i].name, names[i]);
+        EXPECT_EQUAL(archive.extract(archive.entries()[i]), contents[i]);
+    }
+}
+
+STUDENT_TEST("extractEach passes every chosen entry to done") {
+    TestFiles files;
+    vector<string> contents = testContents();
+    ContainerOptions options;
+    options.blockSize = 1000;
+    istringstream in(archiveOf(files, contents, options));
+    ArchiveReader archive(in);
+
+    vector<const ArchiveEntry*> chosen = { &archive.entries()[3], &archive.entries()[0], &archive.entries()[2] };
+    for (int threads: { 1, 4 }) {
+        mutex lock;
+        vector<string> extracted(chosen.size());
+        vector<int> calls(chosen.size(), 0);
+        archive.extractEach(chosen, threads, [&](size_t i, const string& entry) {
+            lock_guard<mutex> guard(lock);
+            extracted[i] = entry;
+            calls[i]++;
+        });
+        EXPECT(calls == vector<int>(chosen.size(), 1));
+        EXPECT_EQUAL(extracted[0], contents[3]);
+        EXPECT_EQUAL(extracted[1], contents[0]);
+        EXPECT_EQUAL(extracted[2], contents[2]);
+    }
+}
+
+STUDENT_TEST("extractEach reports errors from done") {
+    TestFiles files;
+    istringstream in(archiveOf(files, testContents(), ContainerOptions()));
+    ArchiveReader archive(in);
+    vector<const ArchiveEntry*> chosen = { &archive.entries()[0], &archive.entries()[1] };
+    EXPECT_ERROR(archive.extractEach(chosen, 2, [](size_t i, const string&) {
+        if (i == 1) error("Unable to write the entry.");
+    }));
+}
+
+STUDENT_TEST("writeArchive reports duplicate names and missing files") {
+    TestFiles files;
+    string path = files.add("one", "contents");
+    ostringstream out;
+    EXPECT_ERROR(writeArchive(out, { "a", "a" }, { path, path }, ContainerOptions()));
+    EXPECT_ERROR(writeArchive(out, { "a" }, { path, path }, ContainerOptions()));
+    EXPECT_ERROR(writeArchive(out, { "a" }, { files.directory + "/missing" }, ContainerOptions()));
+}
+
+STUDENT_TEST("Data that is not an archive is reported") {
+    EXPECT(!isArchive(""));
+    EXPECT(!isArchive("not an archive"));
+    istringstream empty("");
+    EXPECT_ERROR(ArchiveReader archive(empty));
+    istringstream text("not an archive, but long enough to hold a header and footer");
+    EXPECT_ERROR(ArchiveReader archive(text));
+}
+
+STUDENT_TEST("Truncated archives are reported") {
+    TestFiles files;
+    string data = archiveOf(files, testContents(), ContainerOptions());
+    for (size_t size = 0; size < data.size(); size += 97) {
+        istringstream in(data.substr(0, size));
+        EXPECT_ERROR(ArchiveReader archive(in));
+    }
+}
+
+STUDENT_TEST("Damaged archive directories are reported, or leave the entries intact") {
+    TestFiles files;
+    vector<string> contents = testContents();
+    string data = archiveOf(files, contents, ContainerOptions());
+    size_t directoryStart = 0;
+    for (int i = 0; i < 8; i++) {
+        directoryStart |= size_t(uint8_t(data[data.size() - 12 + i])) << (8 * i);
+    }
+    for (size_t i = directoryStart; i < data.size(); i++) {
+        string damaged = data;
+        damaged[i] ^= 0x01;
+        istringstream in(damaged);
+        try {
+            /* A damaged name is only a different name; anything else must be
+             * caught before an entry's contents are returned. */
+            ArchiveReader archive(in);
+            EXPECT_EQUAL(archive.entries().size(), contents.size());
+            for (size_t entry = 0; entry < contents.size(); entry++) {
+                try {
+                    EXPECT_EQUAL(archive.extract(archive.entries()[entry]), contents[entry]);
+                } catch (ErrorException&) {
+                    /* Reporting the damage is just as good. */
+                }
+            }
+        } catch (ErrorException&) {
+            /* Reporting the damage is expected. */
+        }
+    }
+}
+
+STUDENT_TEST("Damaged entries are reported when they are extracted") {
+    TestFiles files;
+    vector<string> contents = testContents();
+    string data = archiveOf(files, contents, ContainerOptions());
+    istringstream original(data);
+    ArchiveEntry entry = ArchiveReader(original).entries()[2];
+
+    /* The random entry is stored, so cut its container's end marker. */
+    string damaged = data;
+    damaged[entry.offset + entry.storedBytes - 1] = 0;
+    istringstream in(damaged);
+    ArchiveReader archive(in);
+    EXPECT_EQUAL(archive.extract(archive.entries()[0]), contents[0]);
+    EXPECT_ERROR(archive.extract(archive.entries()[2]));
+    EXPECT_ERROR(archive.extractEach({ &archive.entries()[0], &archive.entries()[2] }, 2,
+                                     [](size_t, const string&) {}));
+}
+
+#endif
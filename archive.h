@@ -0,0 +1,106 @@
+#pragma once
+
+#include "container.h"
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Archives: many files in one, each compressed on its own, with a central
+ * directory at the end so a single file can be extracted without reading the
+ * others.
+ *
+ * Format (integers little-endian):
+ *
+ * 4 bytes: magic number 0xC5106BAC.
+ * 1 byte:  format version.
+ * entries: each file's contents as a block container (see container.h), one
+ *          after another, so every entry carries its own trees.
+ * directory:
+ *   varint:  number of entries.
+ *   for each entry:
+ *     varint:  length of the name, then the name.
+ *     varint:  size of the original file.
+ *     varint:  offset of the entry's container from the start of the archive.
+ *     varint:  size of the entry's container.
+ * 8 bytes: offset of the directory.
+ * 4 bytes: archive trailer magic.
+ */
+
+/* Bytes of input files that may be in memory at once while writing an
+ * archive, or of entries while extracting them, across all workers. While
+ * writing, a file's share is held until its container has been written.
+ */
+const uint64_t kArchiveMemoryBudget = 256 * 1024 * 1024;
+
+/**
+ * One file in an archive.
+ */
+struct ArchiveEntry {
+    std::string name;
+    uint64_t size;
+    uint64_t offset;
+    uint64_t storedBytes;
+};
+
+/**
+ * Returns whether the data begins with the archive magic header.
+ */
+bool isArchive(const std::string& data);
+
+/**
+ * Writes an archive of the files at the given paths to out, under the names
+ * given (names[i] for paths[i]). Each file becomes a container compressed
+ * with options. options.threads workers share the blocks of every file through
+ * a work-stealing pool (see scheduler.h), so a large file is spread over all
+ * of them; the archive does not depend on the thread count. Reports an error
+ * if a file cannot be read or a name appears twice.
+ */
+void writeArchive(std::ostream& out, const std::vector<std::string>& names,
+                  const std::vector<std::string>& paths, const ContainerOptions& options);
+
+/**
+ * Type that reads the directory of an archive in a seekable stream and
+ * extracts entries from it on demand.
+ *
+ *     ifstream in("logs.hufa", ios::binary);
+ *     ArchiveReader archive(in);
+ *     string text = archive.extract(*archive.find("logs/today.txt"));
+ */
+class ArchiveReader {
+public:
+    explicit ArchiveReader(std::istream& in);
+
+    /* Every entry, in the order they were written. */
+    const std::vector<ArchiveEntry>& entries() const;
+
+    /* The entry with the given name, or nullptr if there is none. */
+    const ArchiveEntry* find(const std::string& name) const;
+
+    /* Returns the contents of an entry, decoding threads blocks at once.
+     * Several threads may extract entries from one reader at the same time.
+     */
+    std::string extract(const ArchiveEntry& entry, int threads = 1);
+
+    /* Extracts each of the chosen entries, passing done its index in chosen
+     * and its contents. threads workers share the blocks of every entry, as in
+     * writeArchive, so done may be called from several threads at once, in
+     * any order. Reports the first error from any entry, or from done.
+     */
+    void extractEach(const std::vector<const ArchiveEntry*>& chosen, int threads,
+                     const std::function<void(size_t, const std::string&)>& done);
+
+private:
+    /* Reads an entry's container from the stream. */
+    std::string readStored(const ArchiveEntry& entry);
+
+    std::istream& _in;
+    std::mutex _lock;
+    std::vector<ArchiveEntry> _entries;
+    std::unordered_map<std::string, size_t> _byName;
+};
@@ -0,0 +1,495 @@
+#include "async.h"
+#include "error.h"
+#include "fileio.h"
+#include "ioqueue.h"
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <new>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+#include "testutil.h"
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * Coroutine compression and file transfers. The public interface is provided
+ * in async.h header file.
+ */
+
+namespace {
+#if defined(_WIN32)
+    const int kBinaryFlag = O_BINARY;
+#else
+    const int kBinaryFlag = 0;
+#endif
+
+    /**
+     * Awaiting this runs task(i) on the executor for every index i below count
+     * and resumes the awaiting coroutine when the last one finishes, rethrowing
+     * the first error any of them reported.
+     */
+    class ForEachAwaiter {
+    public:
+        ForEachAwaiter(Executor& executor, size_t count, function<void(size_t)> task)
+            : _executor(executor), _count(count), _task(move(task)), _remaining(count) {}
+
+        bool await_ready() const noexcept {
+            return _count == 0;
+        }
+
+        void await_suspend(coroutine_handle<> waiting) {
+            /* The last task to finish resumes the coroutine, which may destroy
+             * this awaiter, so nothing here is touched after the last post.
+             */
+            Executor& executor = _executor;
+            size_t count = _count;
+            for (size_t i = 0; i < count; i++) {
+                executor.post([this, waiting, i]() { run(i, waiting); });
+            }
+        }
+
+        void await_resume() {
+            if (_failure) rethrow_exception(_failure);
+        }
+
+    private:
+        void run(size_t i, coroutine_handle<> waiting) {
+            try {
+                _task(i);
+            } catch (...) {
+                lock_guard<mutex> guard(_lock);
+                if (!_failure) _failure = current_exception();
+            }
+            if (--_remaining == 0) {
+                waiting.resume();
+            }
+        }
+
+        Executor& _executor;
+        size_t _count;
+        function<void(size_t)> _task;
+        atomic<size_t> _remaining;
+        mutex _lock;
+        exception_ptr _failure;
+    };
+
+    int openFile(const string& path, int flags) {
+        int fd = open(path.c_str(), flags | kBinaryFlag, 0644);
+        if (fd < 0) {
+            error("Unable to open " + path + ": " + strerror(errno));
+        }
+        return fd;
+    }
+}
+
+Executor::Executor(int threads) {
+    size_t count = workerCount(threads, SIZE_MAX);
+    for (size_t i = 0; i < count; i++) {
+        _threads.emplace_back(&Executor::work, this);
+    }
+}
+
+Executor::~Executor() {
+    {
+        lock_guard<mutex> guard(_lock);
+        _stopping = true;
+    }
+    _posted.notify_all();
+    for (thread& worker: _threads) {
+        worker.join();
+    }
+}
+
+void Executor::post(function<void()> work) {
+    {
+        lock_guard<mutex> guard(_lock);
+        _queue.push_back(move(work));
+    }
+    _posted.notify_one();
+}
+
+void Executor::work() {
+    while (true) {
+        function<void()> next;
+        {
+            unique_lock<mutex> guard(_lock);
+            _posted.wait(guard, [&]() { return !_queue.empty() || _stopping; });
+            if (_queue.empty()) return;
+            next = move(_queue.front());
+            _queue.pop_front();
+        }
+        next();
+    }
+}
+
+IoReactor::IoReactor(Executor& executor) : _executor(executor) {
+    _thread = thread(&IoReactor::work, this);
+}
+
+IoReactor::~IoReactor() {
+    {
+        lock_guard<mutex> guard(_lock);
+        _stopping = true;
+    }
+    _started.notify_all();
+    _thread.join();
+}
+
+void IoReactor::start(Transfer& transfer) {
+    transfer.issued = 0;
+    transfer.remaining = transfer.size;
+    {
+        lock_guard<mutex> guard(_lock);
+        _inbox.push_back(&transfer);
+    }
+    _started.notify_one();
+}
+
+void IoReactor::work() {
+    IoQueue queue(kFileIoDepth);
+    map<uint64_t, Chunk> chunks;   // in the queue, by tag
+    uint64_t nextTag = 0;
+    deque<Transfer*> active;       // with chunks still to issue
+
+    auto issue = [&](const Chunk& chunk, uint64_t tag) {
+        Transfer& transfer = *chunk.transfer;
+        char* buffer = transfer.buffer + chunk.offset + chunk.done;
+        size_t size = chunk.size - chunk.done;
+        if (transfer.write) {
+            queue.write(transfer.fd, buffer, size, chunk.offset + chunk.done, tag);
+        } else {
+            queue.read(transfer.fd, buffer, size, chunk.offset + chunk.done, tag);
+        }
+    };
+
+    while (true) {
+        {
+            unique_lock<mutex> guard(_lock);
+            if (queue.outstanding() == 0 && active.empty()) {
+                _started.wait(guard, [&]() { return !_inbox.empty() || _stopping; });
+                if (_inbox.empty()) return;
+            }
+            active.insert(active.end(), _inbox.begin(), _inbox.end());
+            _inbox.clear();
+        }
+
+        while (!active.empty() && queue.outstanding() < queue.depth()) {
+            Transfer* transfer = active.front();
+            Chunk chunk = { transfer, transfer->issued, size_t(min<uint64_t>(kFileIoChunk, transfer->size - transfer->issued)), 0 };
+            transfer->issued += chunk.size;
+            if (transfer->issued == transfer->size) active.pop_front();
+            uint64_t tag = nextTag++;
+            chunks[tag] = chunk;
+            issue(chunk, tag);
+        }
+        queue.submit();
+        if (queue.outstanding() == 0) continue;
+
+        /* New transfers wait for the next completion, which is never long. */
+        IoCompletion completion = queue.wait();
+        Chunk& chunk = chunks.at(completion.tag);
+        Transfer* transfer = chunk.transfer;
+        if (completion.result <= 0) {
+            if (transfer->error == 0) {
+                transfer->error = completion.result < 0 ? int(-completion.result) : EIO;
+            }
+            /* The whole chunk is finished with, including any part of it
+             * that earlier completions moved.
+             */
+            transfer->remaining -= chunk.size;
+            chunks.erase(completion.tag);
+        } else {
+            chunk.done += completion.result;
+            if (chunk.done < chunk.size) {
+                issue(chunk, completion.tag);
+                continue;
+            }
+            transfer->remaining -= chunk.size;
+            chunks.erase(completion.tag);
+        }
+        if (transfer->remaining == 0) {
+            coroutine_handle<> waiting = transfer->waiting;
+            _executor.post([waiting]() { waiting.resume(); });
+        }
+    }
+}
+
+Task<string> compressAsync(Executor& executor, string text, ContainerOptions options) {
+    co_await executor.schedule();
+    checkContainerOptions(options);
+    size_t numBlocks = (text.size() + options.blockSize - 1) / options.blockSize;
+    vector<uint64_t> rawSizes, blockBytes;
+    for (size_t pos = 0; pos < text.size(); pos += options.blockSize) {
+        rawSizes.push_back(min(options.blockSize, text.size() - pos));
+    }
+
+    vector<string> blocks(numBlocks);
+    co_await ForEachAwaiter(executor, numBlocks, [&](size_t i) {
+        encodeBlock(text.data() + i * options.blockSize, rawSizes[i], options, blocks[i]);
+    });
+
+    string out = containerHeader(options);
+    for (string& block: blocks) {
+        blockBytes.push_back(block.size());
+        out += block;
+        string().swap(block);
+    }
+    out += containerTrailer(options, rawSizes, blockBytes);
+    co_return out;
+}
+
+Task<string> decompressAsync(Executor& executor, string data) {
+    co_await executor.schedule();
+    ContainerLayout layout = scanContainer(data);
+    vector<size_t> offsets;
+    size_t total = 0;
+    for (uint64_t rawSize: layout.rawSizes) {
+        offsets.push_back(total);
+        total += rawSize;
+    }
+
+    string out;
+    try {
+        out.resize(total);
+    } catch (const bad_alloc&) {
+        error("Not enough memory to decompress the container.");
+    }
+    co_await ForEachAwaiter(executor, offsets.size(), [&](size_t i) {
+        string block;
+        decodeBlock(data, layout.blockStarts[i], block, layout.checksums);
+        memcpy(&out[offsets[i]], block.data(), block.size());
+    });
+    co_return out;
+}
+
+Task<string> readFileAsync(IoReactor& reactor, string path) {
+    int fd = openFile(path, O_RDONLY);
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        error("Unable to read " + path + ": " + strerror(errno));
+    }
+    string contents(info.st_size, '\0');
+    IoReactor::Transfer transfer = { fd, &contents[0], contents.size(), false, nullptr };
+    co_await reactor.run(transfer);
+    close(fd);
+    if (transfer.error != 0) {
+        error("Unable to read " + path + ": " + strerror(transfer.error));
+    }
+    co_return contents;
+}
+
+Task<uint64_t> writeFileAsync(IoReactor& reactor, string path, string data) {
+    int fd = openFile(path, O_WRONLY | O_CREAT | O_TRUNC);
+    IoReactor::Transfer transfer = { fd, &data[0], data.size(), true, nullptr };
+    co_await reactor.run(transfer);
+    if (close(fd) < 0 && transfer.error == 0) {
+        transfer.error = errno;
+    }
+    if (transfer.error != 0) {
+        error("Unable to write " + path + ": " + strerror(transfer.error));
+    }
+    co_return data.size();
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+#if !defined(_WIN32)
+
+namespace {
+    string sampleText(size_t size) {
+        string text;
+        for (int i = 0; text.size() < size; i++) {
+            text += "line " + to_string(i % 53) + " of the file\n";
+        }
+        return text.substr(0, size);
+    }
+
+    Task<string> compressAndBack(Executor& executor, string text, ContainerOptions options) {
+        string packed = co_await compressAsync(executor, text, options);
+        co_return co_await decompressAsync(executor, packed);
+    }
+
+    /* Compresses and decompresses every text at once. */
+    Task<vector<string>> compressAll(Executor& executor, vector<string> texts, ContainerOptions options) {
+        vector<Task<string>> jobs;
+        for (const string& text: texts) {
+            jobs.push_back(compressAndBack(executor, text, options));
+        }
+        co_return co_await whenAll(move(jobs));
+    }
+
+    Task<string> countAndCompress(Executor& executor, string text, atomic<int>& started) {
+        started++;
+        co_return co_await compressAsync(executor, text, ContainerOptions());
+    }
+
+    /* Lowers the largest file this process may write, for as long as it is
+     * in scope, with writes past it failing rather than raising a signal.
+     */
+    class FileSizeLimit {
+    public:
+        explicit FileSizeLimit(rlim_t bytes) {
+            getrlimit(RLIMIT_FSIZE, &_original);
+            _handler = signal(SIGXFSZ, SIG_IGN);
+            struct rlimit limited = _original;
+            limited.rlim_cur = bytes;
+            setrlimit(RLIMIT_FSIZE, &limited);
+        }
+
+        ~FileSizeLimit() {
+            setrlimit(RLIMIT_FSIZE, &_original);
+            signal(SIGXFSZ, _handler);
+        }
+
+    private:
+        struct rlimit _original;
+        void (*_handler)(int);
+    };
+
+    Task<string> writeAndRead(IoReactor& reactor, string path, string data) {
+        uint64_t written = co_await writeFileAsync(reactor, path, data);
+        if (written != data.size()) error("Wrote the wrong number of bytes.");
+        co_return co_await readFileAsync(reactor, path);
+    }
+}
+
+STUDENT_TEST("compressAsync matches compressContainer and round-trips") {
+    Executor executor(3);
+    ContainerOptions options;
+    options.blockSize = 4096;
+    for (const string& text: { string(""), string("a"), sampleText(50000), randomBytes(20000, 1) }) {
+        string packed = syncWait(compressAsync(executor, text, options));
+        EXPECT_EQUAL(packed, compressContainer(text, options));
+        EXPECT_EQUAL(syncWait(decompressAsync(executor, packed)), text);
+    }
+}
+
+STUDENT_TEST("Many coroutine jobs share one executor") {
+    Executor executor(2);
+    ContainerOptions options;
+    options.blockSize = 1000;
+    vector<string> texts;
+    for (int i = 0; i < 20; i++) {
+        texts.push_back(sampleText(500 * i + 1));
+    }
+    EXPECT(syncWait(compressAll(executor, texts, options)) == texts);
+}
+
+STUDENT_TEST("whenAll starts every task before waiting for any") {
+    /* The executor's only thread is held until every job has started, so had
+     * one job been awaited before the next was started, the hold would time
+     * out instead.
+     */
+    Executor executor(1);
+    const int kJobs = 8;
+    atomic<int> started(0);
+    atomic<bool> allStarted(false);
+    executor.post([&]() {
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+        while (started < kJobs && chrono::steady_clock::now() < deadline) {
+            this_thread::yield();
+        }
+        allStarted = started == kJobs;
+    });
+    vector<string> texts;
+    vector<Task<string>> jobs;
+    for (int i = 0; i < kJobs; i++) {
+        texts.push_back(sampleText(1000 * i + 1));
+        jobs.push_back(countAndCompress(executor, texts.back(), started));
+    }
+    vector<string> packed = syncWait(whenAll(move(jobs)));
+    EXPECT(allStarted);
+    for (int i = 0; i < kJobs; i++) {
+        EXPECT_EQUAL(packed[i], compressContainer(texts[i], ContainerOptions()));
+    }
+
+    ContainerOptions broken;
+    broken.blockSize = 0;
+    vector<Task<string>> failing;
+    failing.push_back(compressAsync(executor, "fine", ContainerOptions()));
+    failing.push_back(compressAsync(executor, "text", broken));
+    EXPECT_ERROR(syncWait(whenAll(move(failing))));
+}
+
+STUDENT_TEST("decompressAsync rethrows errors from the blocks") {
+    Executor executor(2);
+    EXPECT_ERROR(syncWait(decompressAsync(executor, "not a container")));
+
+    ContainerOptions options;
+    options.blockSize = 1000;
+    options.checksums = true;
+    string packed = compressContainer(randomBytes(5000, 2), options);
+    packed[scanContainer(packed).blockStarts[3] + 10] ^= 1;
+    EXPECT_ERROR(syncWait(decompressAsync(executor, packed)));
+
+    options.blockSize = 0;
+    EXPECT_ERROR(syncWait(compressAsync(executor, "text", options)));
+}
+
+STUDENT_TEST("IoReactor writes and reads back files of many chunks") {
+    Executor executor(2);
+    IoReactor reactor(executor);
+    TestPath test;
+    for (size_t size: { size_t(0), size_t(1), size_t(kFileIoChunk), size_t(3 * kFileIoChunk + 12345) }) {
+        string data = randomBytes(size, 3);
+        EXPECT_EQUAL(syncWait(writeAndRead(reactor, test.path, data)), data);
+    }
+}
+
+STUDENT_TEST("IoReactor reports files it cannot open, read or write") {
+    Executor executor(1);
+    IoReactor reactor(executor);
+    TestPath test;
+    EXPECT_ERROR(syncWait(readFileAsync(reactor, test.path + "-missing")));
+    EXPECT_ERROR(syncWait(writeFileAsync(reactor, test.path + "-missing/file", "data")));
+    EXPECT_ERROR(syncWait(readFileAsync(reactor, "/tmp")));
+    if (access("/dev/full", W_OK) == 0) {
+        EXPECT_ERROR(syncWait(writeFileAsync(reactor, "/dev/full", string(3 * kFileIoChunk, 'x'))));
+    }
+
+    /* The reactor carries on after a failure. */
+    EXPECT_EQUAL(syncWait(writeAndRead(reactor, test.path, "still working")), "still working");
+}
+
+STUDENT_TEST("IoReactor reports a write that fails partway through a chunk") {
+    /* The file size limit lets the second chunk be written in part, and
+     * then fails the rest of it. */
+    struct rlimit original;
+    getrlimit(RLIMIT_FSIZE, &original);
+    if (original.rlim_cur != RLIM_INFINITY && original.rlim_cur < 2 * kFileIoChunk) return;
+    FileSizeLimit limit(kFileIoChunk + kFileIoChunk / 2);
+
+    Executor executor(1);
+    IoReactor reactor(executor);
+    TestPath test;
+    string message;
+    try {
+        syncWait(writeFileAsync(reactor, test.path, string(3 * kFileIoChunk, 'x')));
+    } catch (ErrorException& e) {
+        message = e.getMessage();
+    }
+    EXPECT(message.find(strerror(EFBIG)) != string::npos);
+}
+
+#endif
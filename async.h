@@ -0,0 +1,329 @@
+#pragma once
+
+#include "container.h"
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Coroutine versions of compression, decompression and file reading and
+ * writing, so many jobs can be in progress on a few threads (C++20).
+ *
+ * Jobs are Tasks that do nothing until awaited; whenAll starts several at
+ * once. Compression and decompression
+ * hand their blocks to an Executor, a fixed pool of threads shared by every
+ * job, and suspend until the last block is done; file transfers go to an
+ * IoReactor thread (see ioqueue.h) and suspend until the kernel finishes. No
+ * thread ever blocks waiting for a job, so the number of jobs in flight is
+ * limited by memory rather than threads.
+ *
+ *     Task<uint64_t> job(Executor& executor, IoReactor& reactor, string path) {
+ *         string text = co_await readFileAsync(reactor, path);
+ *         string packed = co_await compressAsync(executor, std::move(text), options);
+ *         co_return co_await writeFileAsync(reactor, path + ".huf", std::move(packed));
+ *     }
+ *     ...
+ *     syncWait(job(executor, reactor, "log.txt"));
+ */
+
+/**
+ * Type that runs work on a fixed pool of threads, in the order it is posted.
+ */
+class Executor {
+public:
+    /* Zero means one thread per hardware thread. */
+    explicit Executor(int threads = 0);
+
+    /* Runs everything already posted, then stops the threads. */
+    ~Executor();
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    void post(std::function<void()> work);
+
+    /* Awaiting this moves the coroutine onto one of the pool's threads. */
+    struct ScheduleAwaiter {
+        Executor& executor;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> waiting) {
+            executor.post([waiting]() { waiting.resume(); });
+        }
+        void await_resume() const noexcept {}
+    };
+
+    ScheduleAwaiter schedule() {
+        return ScheduleAwaiter{*this};
+    }
+
+private:
+    void work();
+
+    std::mutex _lock;
+    std::condition_variable _posted;
+    std::deque<std::function<void()>> _queue;
+    bool _stopping = false;
+    std::vector<std::thread> _threads;
+};
+
+/**
+ * A coroutine producing a T, started when first awaited. Awaiting it gives
+ * the value or rethrows what the coroutine threw.
+ */
+template <typename T>
+class Task {
+public:
+    struct promise_type {
+        std::optional<T> value;
+        std::exception_ptr failure;
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        /* Hands control straight to the awaiting coroutine. */
+        struct FinalAwaiter {
+            bool await_ready() const noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> done) noexcept {
+                std::coroutine_handle<> next = done.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() const noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void return_value(T result) { value = std::move(result); }
+        void unhandled_exception() { failure = std::current_exception(); }
+    };
+
+    Task(Task&& other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if (_handle) _handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiting) {
+        _handle.promise().continuation = waiting;
+        return _handle;
+    }
+
+    T await_resume() {
+        promise_type& promise = _handle.promise();
+        if (promise.failure) std::rethrow_exception(promise.failure);
+        return std::move(*promise.value);
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+namespace asyncDetail {
+    /* A coroutine that starts at once and cleans up after itself. */
+    struct Detached {
+        struct promise_type {
+            Detached get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    template <typename T>
+    Detached runAndSignal(Task<T>& task, std::optional<T>& value, std::exception_ptr& failure,
+                          std::mutex& lock, std::condition_variable& finished, bool& done) {
+        try {
+            value = co_await task;
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        done = true;
+        finished.notify_one();
+    }
+
+    /* Counts down the tasks of a whenAll; the last to finish resumes it. */
+    struct AllFinished {
+        std::atomic<size_t> remaining;
+        std::coroutine_handle<> waiting;
+    };
+
+    template <typename T>
+    Detached runAndCount(Task<T>& task, std::optional<T>& value, std::exception_ptr& failure,
+                         AllFinished& all) {
+        try {
+            value = co_await task;
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        if (all.remaining.fetch_sub(1) == 1) all.waiting.resume();
+    }
+
+    /* Starts every task, suspending the awaiting coroutine until all finish. */
+    template <typename T>
+    struct StartAllAwaiter {
+        std::vector<Task<T>>& tasks;
+        std::vector<std::optional<T>>& values;
+        std::vector<std::exception_ptr>& failures;
+        AllFinished& all;
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> waiting) {
+            /* One extra count for this loop, so no task can resume the
+             * waiting coroutine before every task has started.
+             */
+            all.remaining = tasks.size() + 1;
+            all.waiting = waiting;
+            for (size_t i = 0; i < tasks.size(); i++) {
+                runAndCount(tasks[i], values[i], failures[i], all);
+            }
+            return all.remaining.fetch_sub(1) != 1;
+        }
+
+        void await_resume() const noexcept {}
+    };
+}
+
+/**
+ * Runs the task to completion from ordinary code, blocking this thread until
+ * it is done, and returns its value.
+ */
+template <typename T>
+T syncWait(Task<T> task) {
+    std::optional<T> value;
+    std::exception_ptr failure;
+    std::mutex lock;
+    std::condition_variable finished;
+    bool done = false;
+    asyncDetail::runAndSignal(task, value, failure, lock, finished, done);
+    std::unique_lock<std::mutex> guard(lock);
+    finished.wait(guard, [&]() { return done; });
+    if (failure) std::rethrow_exception(failure);
+    return std::move(*value);
+}
+
+/**
+ * Starts every task, then waits for them all to finish and returns their
+ * values in order. Awaiting the tasks one by one instead would leave each
+ * unstarted until the ones before it were done. If any task threw, the first
+ * such exception is rethrown once all are finished.
+ */
+template <typename T>
+Task<std::vector<T>> whenAll(std::vector<Task<T>> tasks) {
+    std::vector<std::optional<T>> values(tasks.size());
+    std::vector<std::exception_ptr> failures(tasks.size());
+    asyncDetail::AllFinished all;
+    co_await asyncDetail::StartAllAwaiter<T>{tasks, values, failures, all};
+    std::vector<T> results;
+    for (size_t i = 0; i < tasks.size(); i++) {
+        if (failures[i]) std::rethrow_exception(failures[i]);
+        results.push_back(std::move(*values[i]));
+    }
+    co_return results;
+}
+
+/**
+ * Type that runs file transfers on a thread of its own through an IoQueue,
+ * resuming each waiting coroutine on the executor when its transfer is done.
+ */
+class IoReactor {
+public:
+    explicit IoReactor(Executor& executor);
+
+    /* Finishes the transfers in progress, then stops the thread. */
+    ~IoReactor();
+
+    IoReactor(const IoReactor&) = delete;
+    IoReactor& operator=(const IoReactor&) = delete;
+
+    /**
+     * A whole-file transfer, split into chunks for the queue. Filled in by
+     * the awaiting coroutine, which owns it and waits until it is done.
+     */
+    struct Transfer {
+        int fd;
+        char* buffer;
+        uint64_t size;
+        bool write;
+        std::coroutine_handle<> waiting;
+        uint64_t issued = 0;       // bytes handed to the queue so far
+        uint64_t remaining = 0;    // bytes in chunks not yet finished, moved or failed
+        int error = 0;             // errno of the first failure
+    };
+
+    /* Awaiting this runs the transfer, resuming on the executor. */
+    struct TransferAwaiter {
+        IoReactor& reactor;
+        Transfer& transfer;
+        bool await_ready() const noexcept { return transfer.size == 0; }
+        void await_suspend(std::coroutine_handle<> waiting) {
+            transfer.waiting = waiting;
+            reactor.start(transfer);
+        }
+        void await_resume() const noexcept {}
+    };
+
+    TransferAwaiter run(Transfer& transfer) {
+        return TransferAwaiter{*this, transfer};
+    }
+
+private:
+    /* A piece of a transfer in the queue. */
+    struct Chunk {
+        Transfer* transfer;
+        uint64_t offset;
+        size_t size;
+        size_t done;
+    };
+
+    void start(Transfer& transfer);
+    void work();
+
+    Executor& _executor;
+    std::mutex _lock;
+    std::condition_variable _started;
+    std::deque<Transfer*> _inbox;
+    bool _stopping = false;
+    std::thread _thread;
+};
+
+/**
+ * Compresses text into a container, as compressContainer does, with the
+ * blocks coded on the executor; options.threads is not used. The result is
+ * the same as compressContainer's.
+ */
+Task<std::string> compressAsync(Executor& executor, std::string text, ContainerOptions options);
+
+/**
+ * Decompresses a container, as decompressContainer does, with the blocks
+ * decoded on the executor.
+ */
+Task<std::string> decompressAsync(Executor& executor, std::string data);
+
+/**
+ * Reads a whole file, or replaces a file with data and returns the number of
+ * bytes written, without holding a thread while the kernel works.
+ */
+Task<std::string> readFileAsync(IoReactor& reactor, std::string path);
+Task<uint64_t> writeFileAsync(IoReactor& reactor, std::string path, std::string data);
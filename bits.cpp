@@ -117,6 +117,77 @@ namespace {
 
     /* "CS106B A7" */
     const uint32_t kFileHeader = 0xC5106BA7;
+
+    /* "CS106B A8", for messages coded with a static codebook. */
+    const uint32_t kCodebookHeader = 0xC5106BA8;
+
+    /**
+     * Writes the modulus byte followed by the given bits.
+     */
+    void writeBits(Queue<Bit>& first, Queue<Bit>& second, ostream& out) {
+        /* Number of bits in the last byte to read. */
+        uint8_t modulus = (first.size() + second.size()) % 8;
+        if (modulus == 0) modulus = 8;
+        out.put(modulus);
+
+        /* Bits themselves. */
+        BitWriter writer(out);
+        while (!first.isEmpty()) writer.put(first.dequeue());
+        while (!second.isEmpty()) writer.put(second.dequeue());
+    }
+
+    /**
+     * Reads the modulus byte and returns how many bits follow it in the stream.
+     */
+    uint64_t readBitCount(istream& in) {
+        /* Read in the modulus. */
+        char signedModulus;
+        if (!in.get(signedModulus)) {
+            error("Error reading modulus.");
+        }
+        uint8_t modulus = signedModulus;
+
+        /* See how many bits we need to read. To do this, jump to the end of the file
+         * and back to where we are to count the bytes, then transform that to a number
+         * of bits.
+         *
+         * Thanks to Julie Zelenski for coming up with this technique!
+         */
+        auto currPos = in.tellg();
+        if (!in.seekg(0, istream::end)) {
+            error("Error seeking to end of file.");
+        }
+        auto endPos  = in.tellg();
+        if (!in.seekg(currPos, istream::beg)) {
+            error("Error seeking back to middle of file.");
+        }
+
+        /* Number of bits to read = (#bytes - 1) * 8 + modulus. */
+        return (endPos - currPos - 1) * 8 + modulus;
+    }
+
+    /**
+     * Reads the rest of a static codebook message, whose magic header has
+     * already been consumed.
+     */
+    EncodedData readCodebookData(istream& in) {
+        EncodedData data;
+
+        char id;
+        if (!in.get(id)) {
+            error("Error reading codebook id.");
+        }
+        data.codebookId = uint8_t(id);
+        if (data.codebookId == 0) {
+            error("Codebook id is not valid.");
+        }
+
+        BitReader reader(in);
+        for (uint64_t bitsToRead = readBitCount(in); bitsToRead > 0; bitsToRead--) {
+            data.messageBits.enqueue(reader.get());
+        }
+        return data;
+    }
 }
 
 /**
@@ -130,8 +201,27 @@ namespace {
  *
  * We don't need to store how many bits are in the tree, since it's always given
  * by 2*c - 1, as this is the number of nodes in a full binary tree with c leaves.
+ *
+ * Messages coded with a static codebook have their own magic header and store
+ * no tree at all:
+ *
+ * 1 byte:  codebook id.
+ * 1 byte:  number of valid bits in the last byte.
+ * n bits:  message bits.
  */
 void writeData(EncodedData& data, ostream& out) {
+    if (data.codebookId != 0) {
+        if (data.codebookId > 255) {
+            error("Codebook id does not fit in the header.");
+        }
+        out.write(reinterpret_cast<const char *>(&kCodebookHeader), sizeof kCodebookHeader);
+        out.put(uint8_t(data.codebookId));
+
+        Queue<Bit> noTree;
+        writeBits(noTree, data.messageBits, out);
+        return;
+    }
+
     /* Validate invariants. */
     checkIntegrityOf(data);
 
@@ -145,15 +235,8 @@ void writeData(EncodedData& data, ostream& out) {
     /* Tree leaves. */
     while (!data.treeLeaves.isEmpty()) out.put(data.treeLeaves.dequeue());
 
-    /* Number of bits in the last byte to read. */
-    uint8_t modulus = (data.treeShape.size() + data.messageBits.size()) % 8;
-    if (modulus == 0) modulus = 8;
-    out.put(modulus);
-
-    /* Bits themselves. */
-    BitWriter writer(out);
-    while (!data.treeShape.isEmpty()) writer.put(data.treeShape.dequeue());
-    while (!data.messageBits.isEmpty()) writer.put(data.messageBits.dequeue());
+    /* Modulus, then tree bits and message bits. */
+    writeBits(data.treeShape, data.messageBits, out);
 }
 
 /**
@@ -163,9 +246,12 @@ EncodedData readData(istream& in) {
     /* Read back the magic header and make sure it matches. */
     uint32_t header;
     if (!in.read(reinterpret_cast<char *>(&header), sizeof header) ||
-        header != kFileHeader) {
+        (header != kFileHeader && header != kCodebookHeader)) {
         error("Chosen file is not a Huffman-compressed file.");
     }
+    if (header == kCodebookHeader) {
+        return readCodebookData(in);
+    }
 
     EncodedData data;
 
@@ -192,30 +278,8 @@ EncodedData readData(istream& in) {
         data.treeLeaves.enqueue(leaf);
     }
 
-    /* Read in the modulus. */
-    char signedModulus;
-    if (!in.get(signedModulus)) {
-        error("Error reading modulus.");
-    }
-    uint8_t modulus = signedModulus;
-
-    /* See how many bits we need to read. To do this, jump to the end of the file
-     * and back to where we are to count the bytes, then transform that to a number
-     * of bits.
-     *
-     * Thanks to Julie Zelenski for coming up with this technique!
-     */
-    auto currPos = in.tellg();
-    if (!in.seekg(0, istream::end)) {
-        error("Error seeking to end of file.");
-    }
-    auto endPos  = in.tellg();
-    if (!in.seekg(currPos, istream::beg)) {
-        error("Error seeking back to middle of file.");
-    }
-
-    /* Number of bits to read = (#bytes - 1) * 8 + modulus. */
-    uint64_t bitsToRead = (endPos - currPos - 1) * 8 + modulus;
+    /* Read in the modulus and work out how many bits follow. */
+    uint64_t bitsToRead = readBitCount(in);
 
     /* Read in the tree shape bits. */
     BitReader reader(in);
@@ -238,7 +302,10 @@ ostream& operator<< (ostream& out, const EncodedData& data) {
     ostringstream builder;
     builder << "{treeShape:" << data.treeShape
             << ",treeLeaves:" << data.treeLeaves
-            << ",messageBits:" << data.messageBits
-            << "}";
+            << ",messageBits:" << data.messageBits;
+    if (data.codebookId != 0) {
+        builder << ",codebookId:" << data.codebookId;
+    }
+    builder << "}";
     return out << builder.str();
 }
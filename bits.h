@@ -33,11 +33,15 @@ private:
  * Type representing a binary-encoded message. The messageBits contains
  * the encoded message text and the treeShape and treeLeaves are the
  * flattened representation of the encoding tree.
+ *
+ * If codebookId is nonzero, the message was encoded with that static codebook
+ * (see codebooks.h) and treeShape and treeLeaves are empty.
  */
 struct EncodedData {
     Queue<Bit>  treeShape;
     Queue<char> treeLeaves;
     Queue<Bit>  messageBits;
+    int         codebookId = 0;
 };
 
 
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "error.h"
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/**
+ * Fast bit-level reading and writing of in-memory buffers, for the block
+ * codecs in container.cpp. Bits are packed the same way writeData packs them:
+ * the first bit written goes in the lowest bit of the first byte.
+ *
+ * Unlike the Queue<Bit> interface, these write and read up to 32 bits at a
+ * time through a 64-bit buffer, so a whole Huffman code costs one call.
+ */
+
+/**
+ * Appends bits to the end of a string.
+ *
+ *     BitStreamWriter writer(out);
+ *     writer.put(code, length);
+ *     writer.flush();   // required before out is used
+ */
+class BitStreamWriter {
+public:
+    explicit BitStreamWriter(std::string& out) : _out(out) {}
+
+    /* Writes count bits, lowest first. count must be <= 32 and bits < 2^count. */
+    void put(uint32_t bits, int count) {
+        _buffer |= uint64_t(bits) << _count;
+        _count += count;
+        if (_count >= 32) {
+            char bytes[4];
+            for (int i = 0; i < 4; i++) {
+                bytes[i] = char(_buffer >> (8 * i));
+            }
+            _out.append(bytes, 4);
+            _buffer >>= 32;
+            _count -= 32;
+        }
+    }
+
+    /* Writes out any buffered bits, padding the last byte with zeros. */
+    void flush() {
+        while (_count > 0) {
+            _out.push_back(char(_buffer));
+            _buffer >>= 8;
+            _count = _count > 8 ? _count - 8 : 0;
+        }
+        _buffer = 0;
+    }
+
+private:
+    std::string& _out;
+    uint64_t _buffer = 0;
+    int _count = 0;
+};
+
+/**
+ * Reads bits from a buffer written by BitStreamWriter. Reading past the end of
+ * the buffer yields zero bits; call checkNotOverrun once done to report an
+ * error if that happened.
+ */
+class BitStreamReader {
+public:
+    BitStreamReader(const char* data, size_t size)
+        : _data(reinterpret_cast<const uint8_t*>(data)), _size(size) {}
+
+    /* Returns the next count bits without consuming them. count must be <= 32. */
+    uint32_t peek(int count) {
+        if (_count < count) refill();
+        return uint32_t(_buffer) & ((uint64_t(1) << count) - 1);
+    }
+
+    /* Consumes count bits, which must have been peeked first. */
+    void skip(int count) {
+        _buffer >>= count;
+        _count -= count;
+    }
+
+    /* Reads and consumes the next count bits. count must be <= 32. */
+    uint32_t get(int count) {
+        uint32_t result = peek(count);
+        skip(count);
+        return result;
+    }
+
+    /* Bits that fill leaves ready to peek and skip. */
+    static const int kFillBits = 56;
+
+    /* Tops the buffer up so that the next kFillBits bits can be read with
+     * peekBuffered and skip, without a check before each read.
+     */
+    void fill() {
+        if (_count < kFillBits) refill();
+    }
+
+    /* Returns the next count bits, which must already be in the buffer. */
+    uint32_t peekBuffered(int count) const {
+        return uint32_t(_buffer) & ((uint64_t(1) << count) - 1);
+    }
+
+    /* Number of bits consumed so far, including any beyond the end. */
+    uint64_t position() const {
+        return (_pos + _padding) * 8 - _count;
+    }
+
+    void checkNotOverrun() const {
+        if (position() > uint64_t(_size) * 8) {
+            error("Unexpected end of block when reading bits.");
+        }
+    }
+
+private:
+    /* Tops the buffer up to at least kFillBits bits. */
+    void refill() {
+        if (_pos + 8 <= _size) {
+            uint64_t word;
+            std::memcpy(&word, _data + _pos, sizeof word);   // assumes little-endian
+            _buffer |= word << _count;
+            _pos += (63 - _count) >> 3;
+            _count |= 56;
+            return;
+        }
+        while (_count <= 56) {
+            uint64_t byte = 0;
+            if (_pos < _size) {
+                byte = _data[_pos++];
+            } else {
+                _padding++;
+            }
+            _buffer |= byte << _count;
+            _count += 8;
+        }
+    }
+
+    const uint8_t* _data;
+    size_t _size;
+    size_t _pos = 0;
+    size_t _padding = 0;
+    uint64_t _buffer = 0;
+    int _count = 0;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/**
+ * A fixed-size queue that any number of threads can push to and pop from
+ * without locks (Dmitry Vyukov's bounded MPMC queue). Each cell carries a
+ * sequence number saying whether it is ready to be written or read on the
+ * current lap, so a push or pop is one compare-and-swap on the tail or head
+ * plus one store to the cell.
+ *
+ * tryPush fails when the queue is full and tryPop when it is empty; callers
+ * wait and retry, which is what gives a pipeline its backpressure.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    /* Holds capacity values, rounded up to a power of two. */
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        _mask = size - 1;
+        _cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++) {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        _tail.store(0, std::memory_order_relaxed);
+        _head.store(0, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    /* Moves value into the queue, or returns false if it is full. */
+    bool tryPush(T& value) {
+        size_t pos = _tail.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = _cells[pos & _mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            ptrdiff_t lag = ptrdiff_t(sequence) - ptrdiff_t(pos);
+            if (lag == 0) {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (lag < 0) {
+                return false;
+            } else {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /* Moves the oldest value into value, or returns false if it is empty. */
+    bool tryPop(T& value) {
+        size_t pos = _head.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = _cells[pos & _mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            ptrdiff_t lag = ptrdiff_t(sequence) - ptrdiff_t(pos + 1);
+            if (lag == 0) {
+                if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.sequence.store(pos + _mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (lag < 0) {
+                return false;
+            } else {
+                pos = _head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+
+    /* On separate cache lines, so pushers and poppers do not contend. */
+    alignas(64) std::atomic<size_t> _tail;
+    alignas(64) std::atomic<size_t> _head;
+};
@@ -0,0 +1,283 @@
+#include "bwt.h"
+#include "bitstream.h"
+#include "codetable.h"
+#include "error.h"
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "testutil.h"
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * Burrows-Wheeler, move-to-front and zero-run coding of blocks. The public
+ * interface is provided in bwt.h header file.
+ *
+ * The payload holds the row of the sorted rotations that is the block itself
+ * (32 bits), the code lengths, and then the coded symbols. Symbols 0 and 1 are
+ * RUNA and RUNB, which spell out the length of a run of zeros in bijective base
+ * two (RUNA is a one digit and RUNB a two digit, lowest digit first); symbol
+ * v + 1 is any other move-to-front value v.
+ */
+
+namespace {
+    const int kRunA = 0;
+    const int kRunB = 1;
+    const int kBwtSymbols = 257;
+
+    /**
+     * Sorts the rotations of the text by prefix doubling: after each round, the
+     * rotations are sorted and ranked by their first 2^k bytes. Returns the
+     * starting position of each rotation in sorted order.
+     */
+    vector<int32_t> sortRotations(const uint8_t* text, int32_t n) {
+        vector<int32_t> order(n), rank(n), nextOrder(n), nextRank(n);
+
+        /* Round zero: sort by first byte. */
+        vector<int32_t> count(max(n, 256), 0);
+        for (int32_t i = 0; i < n; i++) count[text[i]]++;
+        for (int b = 1; b < 256; b++) count[b] += count[b - 1];
+        for (int32_t i = n - 1; i >= 0; i--) order[--count[text[i]]] = i;
+
+        int32_t classes = 1;
+        rank[order[0]] = 0;
+        for (int32_t i = 1; i < n; i++) {
+            if (text[order[i]] != text[order[i - 1]]) classes++;
+            rank[order[i]] = classes - 1;
+        }
+
+        /* Each round sorts by (rank of first half, rank of second half). The
+         * list is already sorted by second half if each rotation is replaced by
+         * the one starting len bytes earlier, so a stable counting sort on the
+         * first half finishes the job.
+         */
+        for (int32_t len = 1; len < n && classes < n; len *= 2) {
+            for (int32_t i = 0; i < n; i++) {
+                int32_t start = order[i] - len;
+                nextOrder[i] = start < 0 ? start + n : start;
+            }
+
+            fill(count.begin(), count.begin() + classes, 0);
+            for (int32_t i = 0; i < n; i++) count[rank[nextOrder[i]]]++;
+            for (int32_t c = 1; c < classes; c++) count[c] += count[c - 1];
+            for (int32_t i = n - 1; i >= 0; i--) order[--count[rank[nextOrder[i]]]] = nextOrder[i];
+
+            classes = 1;
+            nextRank[order[0]] = 0;
+            for (int32_t i = 1; i < n; i++) {
+                int32_t a = order[i], b = order[i - 1];
+                int32_t a2 = a + len < n ? a + len : a + len - n;
+                int32_t b2 = b + len < n ? b + len : b + len - n;
+                if (rank[a] != rank[b] || rank[a2] != rank[b2]) classes++;
+                nextRank[a] = classes - 1;
+            }
+            rank.swap(nextRank);
+        }
+        return order;
+    }
+}
+
+void encodeBwt(const char* text, size_t size, string& out) {
+    if (size > kBwtMaxBlockSize) {
+        error("Block is too large for the Burrows-Wheeler transform.");
+    }
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(text);
+    int32_t n = int32_t(size);
+
+    /* Burrows-Wheeler: the byte before each sorted rotation. */
+    vector<uint8_t> last(n);
+    uint32_t primary = 0;
+    if (n > 0) {
+        vector<int32_t> order = sortRotations(bytes, n);
+        for (int32_t i = 0; i < n; i++) {
+            int32_t start = order[i];
+            if (start == 0) primary = i;
+            last[i] = bytes[start == 0 ? n - 1 : start - 1];
+        }
+    }
+
+    /* Move-to-front, with zero runs folded into RUNA/RUNB symbols. */
+    vector<uint16_t> symbols;
+    symbols.reserve(n / 2);
+    uint8_t recent[256];
+    for (int b = 0; b < 256; b++) recent[b] = uint8_t(b);
+    size_t zeros = 0;
+    for (int32_t i = 0; i <= n; i++) {
+        int value = 0;
+        if (i < n) {
+            uint8_t byte = last[i];
+            while (recent[value] != byte) value++;
+            memmove(recent + 1, recent, value);
+            recent[0] = byte;
+        }
+        if (value == 0 && i < n) {
+            zeros++;
+            continue;
+        }
+        if (zeros > 0) {
+            zeros--;
+            while (true) {
+                symbols.push_back((zeros & 1) ? kRunB : kRunA);
+                if (zeros < 2) break;
+                zeros = (zeros - 2) / 2;
+            }
+            zeros = 0;
+        }
+        if (i < n) symbols.push_back(uint16_t(value + 1));
+    }
+
+    vector<uint64_t> counts(kBwtSymbols, 0);
+    for (uint16_t symbol: symbols) counts[symbol]++;
+    vector<uint8_t> lengths = codeLengthsFromCounts(counts, kMaxBlockCodeLength);
+    SymbolCode code = canonicalSymbolCode(lengths);
+
+    BitStreamWriter writer(out);
+    writer.put(primary, 32);
+    writeCodeLengths(writer, lengths);
+    for (uint16_t symbol: symbols) {
+        writer.put(code.bits[symbol], code.length[symbol]);
+    }
+    writer.flush();
+}
+
+void decodeBwt(const char* payload, size_t payloadSize, char* out, size_t size) {
+    if (size > kBwtMaxBlockSize) {
+        error("Block is too large for the Burrows-Wheeler transform.");
+    }
+    BitStreamReader reader(payload, payloadSize);
+    uint32_t primary = reader.get(32);
+    TableDecoder decoder(readCodeLengths(reader, kBwtSymbols));
+    if (size == 0) return;
+    if (primary >= size) {
+        error("Invalid starting row in BWT block.");
+    }
+
+    /* Undo zero-run and move-to-front coding, recovering the last column. */
+    vector<uint8_t> last(size);
+    uint8_t recent[256];
+    for (int b = 0; b < 256; b++) recent[b] = uint8_t(b);
+    size_t pos = 0;
+    while (pos < size) {
+        int symbol = decoder.decode(reader);
+        if (symbol <= kRunB) {
+            size_t run = 0;
+            for (size_t digit = 1; symbol <= kRunB; digit *= 2) {
+                run += (symbol == kRunA) ? digit : 2 * digit;
+                if (run > size - pos) {
+                    error("Run extends past the end of BWT block.");
+                }
+                if (pos + run == size) break;
+                symbol = decoder.decode(reader);
+            }
+            memset(last.data() + pos, recent[0], run);
+            pos += run;
+            if (symbol <= kRunB) break;
+        }
+
+        int value = symbol - 1;
+        if (value < 1 || value > 255) {
+            error("Invalid symbol in BWT block.");
+        }
+        uint8_t byte = recent[value];
+        memmove(recent + 1, recent, value);
+        recent[0] = byte;
+        last[pos++] = byte;
+    }
+    reader.checkNotOverrun();
+
+    /* Undo Burrows-Wheeler. next[r] is the row of the rotation starting one
+     * byte after row r's, whose first byte is last[next[r]].
+     */
+    uint32_t count[256] = {};
+    for (uint8_t byte: last) count[byte]++;
+    uint32_t firstRow[256];
+    uint32_t row = 0;
+    for (int b = 0; b < 256; b++) {
+        firstRow[b] = row;
+        row += count[b];
+    }
+    vector<uint32_t> next(size);
+    for (size_t i = 0; i < size; i++) {
+        next[firstRow[last[i]]++] = uint32_t(i);
+    }
+
+    uint32_t current = next[primary];
+    for (size_t i = 0; i < size; i++) {
+        out[i] = char(last[current]);
+        current = next[current];
+    }
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+namespace {
+    string encodedBwt(const string& text) {
+        string payload;
+        encodeBwt(text.data(), text.size(), payload);
+        return payload;
+    }
+
+    string decodedBwt(const string& payload, size_t size) {
+        string text(size, '\0');
+        decodeBwt(payload.data(), payload.size(), &text[0], size);
+        return text;
+    }
+
+    string prose() {
+        string text;
+        for (int i = 0; i < 100; i++) {
+            text += "It was the best of times, it was the worst of times, it was the age of ";
+            text += (i % 3 == 0) ? "wisdom" : (i % 3 == 1) ? "foolishness" : "belief";
+            text += ". ";
+        }
+        return text;
+    }
+}
+
+STUDENT_TEST("BWT round-trips short, repetitive and random blocks") {
+    string periodic;
+    for (int i = 0; i < 1000; i++) {
+        periodic += "abcab";
+    }
+    vector<string> inputs = {
+        "", "a", "banana", "abababababab", string(5000, 'z'), periodic,
+        randomBytes(5000, 1), prose(), string(300, '\0') + randomBytes(300, 2) + string(300, '\0')
+    };
+    for (const string& text: inputs) {
+        EXPECT_EQUAL(decodedBwt(encodedBwt(text), text.size()), text);
+    }
+}
+
+STUDENT_TEST("BWT codes long zero runs and repetitive text compactly") {
+    EXPECT(encodedBwt(string(100000, 'z')).size() < 100);
+    string text = prose();
+    EXPECT(encodedBwt(text).size() < text.size() / 8);
+}
+
+STUDENT_TEST("Truncated BWT payloads are reported") {
+    string text = prose();
+    string payload = encodedBwt(text);
+    for (size_t size = 0; size < payload.size(); size++) {
+        EXPECT_ERROR(decodedBwt(payload.substr(0, size), text.size()));
+    }
+}
+
+STUDENT_TEST("Damaged BWT payloads never write past the block") {
+    string text = prose().substr(0, 2000) + randomBytes(500, 3);
+    string payload = encodedBwt(text);
+    const size_t guard = 64;
+    for (size_t i = 0; i < payload.size(); i++) {
+        string damaged = payload;
+        damaged[i] ^= 0x24;
+        string out(text.size() + guard, '#');
+        try {
+            decodeBwt(damaged.data(), damaged.size(), &out[0], text.size());
+        } catch (ErrorException&) {
+            /* Reporting the damage is expected. */
+        }
+        EXPECT_EQUAL(out.substr(text.size()), string(guard, '#'));
+    }
+}
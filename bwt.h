@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Block-sorting compression in the style of bzip2, used by the container for its
+ * Bwt block method. Each block goes through:
+ *
+ * 1. The Burrows-Wheeler transform, which sorts every rotation of the block
+ *    (with a suffix array built by prefix doubling) and keeps the last byte of
+ *    each. Bytes that precede similar contexts end up next to each other.
+ * 2. Move-to-front coding, which turns those clusters into runs of small
+ *    numbers, mostly zeros.
+ * 3. Zero-run coding, which writes each run of zeros as a few RUNA/RUNB
+ *    symbols, and Huffman coding of the result.
+ *
+ * Decoding runs the same stages backwards.
+ */
+
+/* Largest block the transform handles; positions are stored as 32-bit ints. */
+const size_t kBwtMaxBlockSize = size_t(1) << 30;
+
+/**
+ * Transforms and codes size bytes of text, appending the payload to out.
+ */
+void encodeBwt(const char* text, size_t size, std::string& out);
+
+/**
+ * Decodes a payload written by encodeBwt into exactly size bytes at out.
+ * Reports an error if the payload is malformed.
+ */
+void decodeBwt(const char* payload, size_t payloadSize, char* out, size_t size);
@@ -0,0 +1,248 @@
+#include "codebooks.h"
+#include "error.h"
+#include "huffman.h"
+#include "vector.h"
+#include <string>
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * The static codebooks shipped with the program, along with routines for
+ * compressing with them. The public interface is provided in codebooks.h.
+ *
+ * Each codebook is stored as the code length of every byte value; the codes
+ * themselves are the canonical codes for those lengths. Every byte value has a
+ * code, so any message can be compressed with any codebook.
+ */
+
+namespace {
+    /* Tuned for English prose and other plain ASCII text. */
+    constexpr uint8_t kTextV1Lengths[256] = {
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 12,  6, 15, 15, 12, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+         3, 11,  9, 14, 14, 14, 14,  9, 12, 12, 14, 14,  8, 10,  8, 14,
+        10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 11, 12, 14, 14, 14, 11,
+        14,  8, 10, 10,  9,  7, 10, 10,  8,  8, 13, 11,  9, 10,  8,  8,
+        10, 13,  9,  8,  8, 10, 11, 10, 13, 10, 13, 14, 14, 14, 14, 14,
+        14,  4,  7,  6,  5,  3,  6,  6,  5,  4, 10,  7,  5,  6,  4,  4,
+         6, 10,  5,  4,  4,  6,  7,  6, 10,  6, 11, 14, 14, 14, 14, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    };
+
+    /* Tuned for JSON, XML, HTML and CSV records. */
+    constexpr uint8_t kMarkupV1Lengths[256] = {
+        15, 15, 15, 15, 15, 15, 15, 15, 15,  9,  7, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+         4, 13,  6, 13, 13, 13, 11, 13, 13, 13, 13, 13,  7,  9,  9,  8,
+         8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  7, 11,  8,  8,  8, 13,
+        13,  7,  9,  8,  8,  6,  9,  9,  7,  7, 12, 10,  8,  9,  7,  7,
+         9, 12,  7,  7,  7,  8, 10,  9, 12,  9, 12, 10, 13, 10, 13,  9,
+        13,  4,  7,  6,  5,  4,  6,  6,  5,  4, 10,  8,  5,  6,  4,  4,
+         6, 11,  5,  4,  4,  6,  7,  6, 10,  6, 11,  9, 13,  8, 13, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 14,
+    };
+
+    /* Tuned for small binary records dominated by zero bytes and small integers. */
+    constexpr uint8_t kBinaryV1Lengths[256] = {
+         1,  5,  6,  6,  6,  7,  7,  7,  7,  8,  8,  8,  8,  8,  8,  8,
+        10,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,
+         9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,
+         9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,
+         9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,
+         9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,
+         9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,
+         9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  9,  7,
+         7, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+        11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+        11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+        11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+        11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+        11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+        11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+        11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 10,  7,  4,
+    };
+
+    /**
+     * Type describing one codebook: the id stored with messages, the name and
+     * version it is looked up by, and its code.
+     */
+    struct FixedCodebook {
+        int id;
+        const char* name;
+        int version;
+        FixedCode code;
+    };
+
+    /* Every codebook. The codes and their decoding tables are computed by the
+     * compiler.
+     */
+    constexpr FixedCodebook kFixedCodebooks[] = {
+        { 1, "text",   1, fixedCode(kTextV1Lengths) },
+        { 2, "markup", 1, fixedCode(kMarkupV1Lengths) },
+        { 3, "binary", 1, fixedCode(kBinaryV1Lengths) },
+    };
+
+    constexpr bool idsAreUnique() {
+        for (const FixedCodebook& a: kFixedCodebooks) {
+            for (const FixedCodebook& b: kFixedCodebooks) {
+                if (&a != &b && a.id == b.id) return false;
+            }
+        }
+        return true;
+    }
+    static_assert(idsAreUnique(), "codebook ids are never reused");
+
+    const FixedCodebook& fixedCodebook(int id) {
+        for (const FixedCodebook& book: kFixedCodebooks) {
+            if (book.id == id) return book;
+        }
+        error("Unknown codebook id " + to_string(id) + ".");
+    }
+
+    /**
+     * Returns every known codebook. The list is built the first time this is
+     * called and kept for the life of the program.
+     */
+    const Vector<StaticCodebook>& allCodebooks() {
+        static const Vector<StaticCodebook> books = [] {
+            Vector<StaticCodebook> result;
+            for (const FixedCodebook& fixed: kFixedCodebooks) {
+                StaticCodebook book;
+                book.id = fixed.id;
+                book.name = fixed.name;
+                book.version = fixed.version;
+                book.table = fixed.code.table;
+                result.add(book);
+            }
+            return result;
+        }();
+        return books;
+    }
+}
+
+const FixedCode& codebookCode(int id) {
+    return fixedCodebook(id).code;
+}
+
+const StaticCodebook& lookupCodebook(int id) {
+    for (const StaticCodebook& book: allCodebooks()) {
+        if (book.id == id) return book;
+    }
+    error("Unknown codebook id " + to_string(id) + ".");
+}
+
+int findCodebook(const string& name, int version) {
+    for (const FixedCodebook& book: kFixedCodebooks) {
+        if (book.name == name && book.version == version) return book.id;
+    }
+    error("No codebook named " + name + " version " + to_string(version) + ".");
+}
+
+int chooseCodebook(const string& messageText) {
+    uint64_t counts[256] = {};
+    for (char ch: messageText) {
+        counts[uint8_t(ch)]++;
+    }
+    return chooseCodebookForCounts(counts);
+}
+
+int chooseCodebookForCounts(const uint64_t counts[256]) {
+    int bestId = 0;
+    uint64_t bestBits = 0;
+    for (const FixedCodebook& book: kFixedCodebooks) {
+        uint64_t bits = 0;
+        for (int ch = 0; ch < 256; ch++) {
+            bits += counts[ch] * book.code.table.length[ch];
+        }
+        if (bestId == 0 || bits < bestBits) {
+            bestId = book.id;
+            bestBits = bits;
+        }
+    }
+    return bestId;
+}
+
+EncodedData compressWithCodebook(string messageText, int codebookId) {
+    EncodedData output;
+    output.codebookId = codebookId;
+    output.messageBits = encodeWithTable(codebookCode(codebookId).table, messageText);
+    return output;
+}
+
+string decodeWithCodebook(int codebookId, Queue<Bit>& messageBits) {
+    /* Pack the bits the way BitStreamWriter does, so the codebook's compiled
+     * decoding tables can read them.
+     */
+    const FixedCode& code = codebookCode(codebookId);
+    uint64_t bitCount = messageBits.size();
+    string packed((bitCount + 7) / 8, '\0');
+    for (uint64_t i = 0; i < bitCount; i++) {
+        if (messageBits.dequeue() == 1) {
+            packed[i / 8] |= char(1 << (i % 8));
+        }
+    }
+    BitStreamReader reader(packed.data(), packed.size());
+    string output;
+    while (reader.position() < bitCount) {
+        char ch;
+        decodeCodedBytes(code, reader, &ch, 1);
+        output += ch;
+    }
+    if (reader.position() != bitCount) {
+        error("Message bits end partway through a code.");
+    }
+    return output;
+}
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("Every codebook round-trips every byte value") {
+    string text;
+    for (int ch = 0; ch < 256; ch++) {
+        text += char(ch);
+    }
+    text += "The quick brown fox jumps over the lazy dog.";
+    for (string name: { "text", "markup", "binary" }) {
+        EncodedData data = compressWithCodebook(text, findCodebook(name, 1));
+        EXPECT_EQUAL(decompress(data), text);
+    }
+}
+
+STUDENT_TEST("Codebooks handle messages too small for a tree") {
+    for (const string& text: { string(""), string("a"), string(40, 'z') }) {
+        EncodedData data = compressWithCodebook(text, findCodebook("text", 1));
+        EXPECT_EQUAL(decompress(data), text);
+    }
+}
+
+STUDENT_TEST("chooseCodebook picks the codebook tuned for the data") {
+    EXPECT_EQUAL(chooseCodebook("It was the best of times, it was the worst of times."), findCodebook("text", 1));
+    EXPECT_EQUAL(chooseCodebook("{\"id\":1,\"tags\":[\"<a>\",\"<b>\"]}"), findCodebook("markup", 1));
+    EXPECT_EQUAL(chooseCodebook(string(64, '\0') + "\x01\x02\x01"), findCodebook("binary", 1));
+}
+
+STUDENT_TEST("Codebook messages that end partway through a code are reported") {
+    EncodedData data = compressWithCodebook("codebook", findCodebook("text", 1));
+    data.messageBits.enqueue(1);
+    EXPECT_ERROR(decompress(data));
+}
+
+STUDENT_TEST("Unknown codebooks are reported") {
+    EXPECT_ERROR(lookupCodebook(0));
+    EXPECT_ERROR(codebookCode(99));
+    EXPECT_ERROR(findCodebook("text", 2));
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "bits.h"
+#include "codetable.h"
+#include <string>
+
+/**
+ * Type representing a static codebook: a Huffman code that ships with the
+ * program, so that both the compressor and decompressor already know it and
+ * only its id needs to be stored with a message.
+ *
+ * Ids are never reused. A codebook's code never changes once released; a
+ * retuned code for the same kind of data is added as a new version with its
+ * own id, so files written with an older version always remain readable.
+ */
+struct StaticCodebook {
+    int id;
+    std::string name;
+    int version;
+    CodeTable table;
+};
+
+/* Messages up to this many bytes are compressed with a static codebook, since
+ * for them the flattened tree costs more than a tuned code saves.
+ */
+const size_t kStaticCodebookLimit = 1024;
+
+/**
+ * Returns the codebook with the given id, reporting an error if there is none.
+ */
+const StaticCodebook& lookupCodebook(int id);
+
+/**
+ * Returns the code of the codebook with the given id, reporting an error if
+ * there is none. The code and its decoding tables are computed at compile
+ * time.
+ */
+const FixedCode& codebookCode(int id);
+
+/**
+ * Returns the id of the codebook with the given name and version, reporting an
+ * error if there is none.
+ */
+int findCodebook(const std::string& name, int version);
+
+/**
+ * Returns the id of the codebook that codes the given text in the fewest bits.
+ */
+int chooseCodebook(const std::string& messageText);
+
+/**
+ * Returns the id of the codebook that codes text with the given byte counts in
+ * the fewest bits.
+ */
+int chooseCodebookForCounts(const uint64_t counts[256]);
+
+/**
+ * Compresses the text with a static codebook instead of building a Huffman
+ * tree for it. The resulting EncodedData stores no tree, only the codebook id,
+ * and unlike compress works for messages of any length, including those with
+ * fewer than two distinct characters.
+ */
+EncodedData compressWithCodebook(std::string messageText, int codebookId);
+
+/**
+ * Decodes message bits coded with the given codebook, consuming them. Reports
+ * an error if the bits do not form whole codes.
+ */
+std::string decodeWithCodebook(int codebookId, Queue<Bit>& messageBits);
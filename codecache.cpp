@@ -0,0 +1,217 @@
+#include "codecache.h"
+#include "huffman.h"
+#include "error.h"
+#include <cmath>
+#include <string>
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * Implementation of CodebookCache. The public interface is provided in
+ * codecache.h header file.
+ */
+
+namespace {
+    /* Signature buckets are half a bit of ideal code length wide, capped here. */
+    const int kMaxSignatureBucket = 63;
+
+    /**
+     * Reduces a histogram to one byte per byte value: 0 if the value does not
+     * occur, otherwise 1 plus its ideal code length, -log2(probability), in
+     * half-bit steps.
+     */
+    string histogramSignature(const uint64_t counts[256], uint64_t total) {
+        string signature(256, '\0');
+        for (int ch = 0; ch < 256; ch++) {
+            if (counts[ch] == 0) continue;
+
+            double halfBits = -2.0 * log2(double(counts[ch]) / total);
+            int bucket = 1 + min(kMaxSignatureBucket - 1, int(halfBits));
+            signature[ch] = char(bucket);
+        }
+        return signature;
+    }
+
+    /**
+     * Describes the flattened tree as a string: one character per shape bit,
+     * then the leaves. Consumes both queues.
+     */
+    string flattenedKey(Queue<Bit>& treeShape, Queue<char>& treeLeaves) {
+        string key;
+        while (!treeShape.isEmpty()) {
+            key += (treeShape.dequeue() == 0) ? '0' : '1';
+        }
+        key += ':';
+        while (!treeLeaves.isEmpty()) {
+            key += treeLeaves.dequeue();
+        }
+        return key;
+    }
+
+    /**
+     * Rebuilds the tree described by a string from flattenedKey.
+     */
+    EncodingTreeNode* unflattenKey(const string& key) {
+        size_t split = key.find(':');
+        Queue<Bit> treeShape;
+        Queue<char> treeLeaves;
+        for (size_t i = 0; i < split; i++) {
+            treeShape.enqueue(key[i] == '1' ? 1 : 0);
+        }
+        for (size_t i = split + 1; i < key.size(); i++) {
+            treeLeaves.enqueue(key[i]);
+        }
+        return unflattenTree(treeShape, treeLeaves);
+    }
+}
+
+template <typename Value>
+Value* CodebookCache::LruMap<Value>::find(const string& key) {
+    auto it = index.find(key);
+    if (it == index.end()) return nullptr;
+
+    /* Move to the front of the list as the most recently used. */
+    entries.splice(entries.begin(), entries, it->second);
+    return &it->second->second;
+}
+
+template <typename Value>
+void CodebookCache::LruMap<Value>::insert(const string& key, const Value& value, int capacity) {
+    if (find(key) != nullptr) return;
+
+    entries.emplace_front(key, value);
+    index[key] = entries.begin();
+    while (int(entries.size()) > capacity) {
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
+
+CodebookCache::CodebookCache(int capacity) : _capacity(capacity) {
+    if (capacity < 1) {
+        error("Codebook cache must hold at least one entry.");
+    }
+}
+
+EncodedData CodebookCache::compress(const string& messageText) {
+    uint64_t counts[256] = {};
+    for (char ch: messageText) {
+        counts[uint8_t(ch)]++;
+    }
+    string signature = histogramSignature(counts, messageText.size());
+
+    shared_ptr<const Encoder> encoder;
+    {
+        lock_guard<mutex> guard(_lock);
+        shared_ptr<const Encoder>* found = _encoders.find(signature);
+        if (found != nullptr) {
+            encoder = *found;
+            _stats.encodeHits++;
+        } else {
+            _stats.encodeMisses++;
+        }
+    }
+
+    /* Build outside the lock, so other threads are not held up by a miss. */
+    if (!encoder) {
+        EncodingTreeNode* tree = buildHuffmanTreeFromCounts(counts);
+        shared_ptr<Encoder> built = make_shared<Encoder>();
+        flattenTree(tree, built->treeShape, built->treeLeaves);
+        try {
+            built->table = codeTableFromTree(tree);
+        } catch (...) {
+            deallocateTree(tree);
+            throw;
+        }
+        deallocateTree(tree);
+        encoder = built;
+
+        lock_guard<mutex> guard(_lock);
+        _encoders.insert(signature, encoder, _capacity);
+    }
+
+    EncodedData output;
+    output.treeShape = encoder->treeShape;
+    output.treeLeaves = encoder->treeLeaves;
+    output.messageBits = encodeWithTable(encoder->table, messageText);
+    return output;
+}
+
+string CodebookCache::decompress(EncodedData& data) {
+    if (data.codebookId != 0) {
+        return ::decompress(data);
+    }
+
+    string key = flattenedKey(data.treeShape, data.treeLeaves);
+    shared_ptr<EncodingTreeNode> tree;
+    {
+        lock_guard<mutex> guard(_lock);
+        shared_ptr<EncodingTreeNode>* found = _decoders.find(key);
+        if (found != nullptr) {
+            tree = *found;
+            _stats.decodeHits++;
+        } else {
+            _stats.decodeMisses++;
+        }
+    }
+
+    if (!tree) {
+        tree = shared_ptr<EncodingTreeNode>(unflattenKey(key), deallocateTree);
+
+        lock_guard<mutex> guard(_lock);
+        _decoders.insert(key, tree, _capacity);
+    }
+    return decodeText(tree.get(), data.messageBits);
+}
+
+CodebookCacheStats CodebookCache::stats() const {
+    lock_guard<mutex> guard(_lock);
+    return _stats;
+}
+
+void CodebookCache::clear() {
+    lock_guard<mutex> guard(_lock);
+    _encoders.entries.clear();
+    _encoders.index.clear();
+    _decoders.entries.clear();
+    _decoders.index.clear();
+    _stats = CodebookCacheStats();
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("Messages with the same mix of bytes share one encoder") {
+    CodebookCache cache;
+    for (const string& text: { string("sensor=12 status=ok"), string("sensor=21 status=ko"),
+                               string("status=ok sensor=12") }) {
+        EncodedData data = cache.compress(text);
+        EXPECT_EQUAL(cache.decompress(data), text);
+    }
+    CodebookCacheStats stats = cache.stats();
+    EXPECT_EQUAL(stats.encodeMisses, 1);
+    EXPECT_EQUAL(stats.encodeHits, 2);
+    EXPECT_EQUAL(stats.decodeMisses, 1);
+    EXPECT_EQUAL(stats.decodeHits, 2);
+}
+
+STUDENT_TEST("A byte the cached encoder lacks gets an encoder of its own") {
+    CodebookCache cache;
+    EncodedData first = cache.compress("aaaabbbc");
+    EncodedData second = cache.compress("aaaabbbd");
+    EXPECT_EQUAL(cache.decompress(first), "aaaabbbc");
+    EXPECT_EQUAL(cache.decompress(second), "aaaabbbd");
+    EXPECT_EQUAL(cache.stats().encodeMisses, 2);
+}
+
+STUDENT_TEST("The cache holds at most its capacity and forgets the oldest") {
+    CodebookCache cache(2);
+    cache.compress("ab");
+    cache.compress("cd");
+    cache.compress("ef");
+    cache.compress("ab");
+    EXPECT_EQUAL(cache.stats().encodeMisses, 4);
+    cache.clear();
+    EXPECT_EQUAL(cache.stats().encodeMisses, 0);
+    EXPECT_ERROR(CodebookCache(0));
+}
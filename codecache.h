@@ -0,0 +1,79 @@
+#pragma once
+
+#include "bits.h"
+#include "codetable.h"
+#include "treenode.h"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/* Default number of encoders and of decoding trees a CodebookCache keeps. */
+const int kDefaultCodebookCacheSize = 64;
+
+/**
+ * Type recording how often a CodebookCache found what it was looking for.
+ */
+struct CodebookCacheStats {
+    uint64_t encodeHits   = 0;
+    uint64_t encodeMisses = 0;
+    uint64_t decodeHits   = 0;
+    uint64_t decodeMisses = 0;
+};
+
+/**
+ * Type that compresses and decompresses streams of similar messages without
+ * rebuilding a Huffman tree for each one.
+ *
+ * When compressing, the message's histogram is reduced to a signature that
+ * records which bytes occur and roughly how often (to within half a bit of
+ * code length). Messages with the same signature share one encoder: the
+ * flattened tree and code table built for the first of them. Every byte of
+ * the message is guaranteed to have a code, since the signature includes
+ * exactly which bytes occur.
+ *
+ * When decompressing, trees rebuilt by unflattenTree are kept, keyed by the
+ * flattened tree, so repeated trees cost one lookup.
+ *
+ * Both caches hold at most capacity entries and discard the least recently
+ * used entry when full. A single cache may be shared between threads.
+ *
+ * This is a library type for programs that code many small messages in the
+ * format of huffman.h, such as records sent one at a time. The console program
+ * codes whole files into containers (see container.h), where each block has
+ * its own histogram, so nothing in it uses the cache.
+ */
+class CodebookCache {
+public:
+    explicit CodebookCache(int capacity = kDefaultCodebookCacheSize);
+
+    EncodedData compress(const std::string& messageText);
+    std::string decompress(EncodedData& data);
+
+    CodebookCacheStats stats() const;
+    void clear();
+
+private:
+    struct Encoder {
+        Queue<Bit>  treeShape;
+        Queue<char> treeLeaves;
+        CodeTable   table;
+    };
+
+    /* Least recently used list of keys, plus an index into it. */
+    template <typename Value> struct LruMap {
+        typedef std::pair<std::string, Value> Entry;
+        std::list<Entry> entries;
+        std::unordered_map<std::string, typename std::list<Entry>::iterator> index;
+
+        Value* find(const std::string& key);
+        void insert(const std::string& key, const Value& value, int capacity);
+    };
+
+    int _capacity;
+    mutable std::mutex _lock;
+    LruMap<std::shared_ptr<const Encoder>> _encoders;
+    LruMap<std::shared_ptr<EncodingTreeNode>> _decoders;
+    CodebookCacheStats _stats;
+};
@@ -0,0 +1,500 @@
+#include "codetable.h"
+#include "error.h"
+#include "priorityqueue.h"
+#include <algorithm>
+#include <random>
+#include <string>
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * Routines for converting between code lengths, flat code tables, and encoding
+ * trees. The public interface is provided in codetable.h header file.
+ */
+
+namespace {
+    /**
+     * Records the code of every leaf below node, which is reached by following
+     * the first depth steps of path.
+     */
+    void recordCodes(EncodingTreeNode* node, uint32_t path, int depth, CodeTable& table) {
+        if (node->isLeaf()) {
+            uint8_t ch = node->getChar();
+            table.bits[ch] = path;
+            table.length[ch] = depth;
+            return;
+        }
+        if (depth == kMaxCodeLength) {
+            error("Encoding tree is too deep for a code table.");
+        }
+        recordCodes(node->zero, path, depth + 1, table);
+        recordCodes(node->one, path | (1U << depth), depth + 1, table);
+    }
+
+    /**
+     * Decodes size bytes with a decoder that has a decode(BitStreamReader&)
+     * member, such as TableDecoder or FixedCode.
+     */
+    template <typename Decoder>
+    void decodeEach(const Decoder& decoder, BitStreamReader& reader, char* out, size_t size) {
+        /* A local copy lets the compiler keep the bit buffer in registers,
+         * where it cannot alias out.
+         */
+        BitStreamReader local = reader;
+        for (size_t i = 0; i < size; i++) {
+            out[i] = char(decoder.decode(local));
+        }
+        local.checkNotOverrun();
+        reader = local;
+    }
+
+    /**
+     * Type that decodes a complete canonical byte code with no code longer
+     * than MaxLength bits. The table covers MaxLength bits, so every code
+     * resolves with one lookup, and as no code takes more than MaxLength bits,
+     * the bit buffer is checked once per kPerFill codes rather than once per
+     * code.
+     */
+    template <int MaxLength>
+    class ShortCodeDecoder {
+    public:
+        explicit ShortCodeDecoder(const vector<uint8_t>& lengths) {
+            SymbolCode code = canonicalSymbolCode(lengths);
+            for (int sym = 0; sym < int(lengths.size()); sym++) {
+                int len = lengths[sym];
+                if (len == 0) continue;
+                for (uint32_t index = code.bits[sym]; index < kTableSize; index += 1U << len) {
+                    _table[index] = uint16_t(sym << 4 | len);
+                }
+            }
+        }
+
+        void decode(BitStreamReader& reader, char* out, size_t size) const {
+            /* As in decodeEach, the bit buffer stays in registers. */
+            BitStreamReader local = reader;
+            size_t i = 0;
+            while (size - i >= kPerFill) {
+                local.fill();
+                for (int j = 0; j < kPerFill; j++) {
+                    out[i + j] = decodeBuffered(local);
+                }
+                i += kPerFill;
+            }
+
+            /* Fewer than kPerFill codes remain. */
+            local.fill();
+            for (; i < size; i++) {
+                out[i] = decodeBuffered(local);
+            }
+            local.checkNotOverrun();
+            reader = local;
+        }
+
+    private:
+        static_assert(MaxLength <= 15, "lengths are stored in four bits");
+        static const uint32_t kTableSize = 1U << MaxLength;
+        static const int kPerFill = BitStreamReader::kFillBits / MaxLength;
+
+        char decodeBuffered(BitStreamReader& reader) const {
+            uint16_t entry = _table[reader.peekBuffered(MaxLength)];
+            reader.skip(entry & 0xF);
+            return char(entry >> 4);
+        }
+
+        uint16_t _table[kTableSize];   // symbol << 4 | length
+    };
+
+    template <int MaxLength>
+    void decodeShortCodes(const vector<uint8_t>& lengths, BitStreamReader& reader, char* out, size_t size) {
+        ShortCodeDecoder<MaxLength>(lengths).decode(reader, out, size);
+    }
+
+    /**
+     * Computes unrestricted Huffman code lengths for the symbols with nonzero
+     * counts, returning the longest.
+     */
+    int huffmanCodeLengths(const vector<uint64_t>& counts, vector<uint8_t>& lengths) {
+        /* Nodes 0..n-1 are the symbols; merged nodes are numbered after them. */
+        int n = counts.size();
+        vector<int> parent(n, -1);
+        PriorityQueue<int> pq;
+        for (int sym = 0; sym < n; sym++) {
+            if (counts[sym] != 0) {
+                pq.enqueue(sym, counts[sym]);
+            }
+        }
+        while (pq.size() > 1) {
+            double sum = pq.peekPriority();
+            int zero = pq.dequeue();
+            sum += pq.peekPriority();
+            int one = pq.dequeue();
+
+            int merged = parent.size();
+            parent.push_back(-1);
+            parent[zero] = parent[one] = merged;
+            pq.enqueue(merged, sum);
+        }
+
+        /* A node's depth is one more than its parent's, and parents are always
+         * numbered after their children, so walk the nodes from the root down.
+         */
+        vector<int> depth(parent.size(), 0);
+        for (int node = int(parent.size()) - 1; node >= 0; node--) {
+            if (parent[node] != -1) depth[node] = depth[parent[node]] + 1;
+        }
+
+        int longest = 0;
+        lengths.assign(n, 0);
+        for (int sym = 0; sym < n; sym++) {
+            if (counts[sym] == 0) continue;
+            lengths[sym] = max(depth[sym], 1);
+            longest = max(longest, int(lengths[sym]));
+        }
+        return longest;
+    }
+}
+
+CodeTable codeTableFromTree(EncodingTreeNode* tree) {
+    CodeTable table = {};
+    recordCodes(tree, 0, 0, table);
+    return table;
+}
+
+Queue<Bit> encodeWithTable(const CodeTable& table, const string& text) {
+    Queue<Bit> result;
+    for (char ch: text) {
+        uint8_t byte = ch;
+        if (table.length[byte] == 0) {
+            error("Character " + to_string(byte) + " has no code in this table.");
+        }
+        for (int i = 0; i < table.length[byte]; i++) {
+            result.enqueue((table.bits[byte] >> i) & 1);
+        }
+    }
+    return result;
+}
+
+vector<uint8_t> codeLengthsFromCounts(const vector<uint64_t>& counts, int maxLength) {
+    /* Flatten the distribution until the tree is shallow enough. Halving every
+     * count (keeping nonzero counts nonzero) evens out the rare symbols that
+     * make a tree deep, and eventually leaves all counts equal.
+     */
+    vector<uint64_t> scaled = counts;
+    vector<uint8_t> lengths;
+    while (huffmanCodeLengths(scaled, lengths) > maxLength) {
+        for (uint64_t& count: scaled) {
+            if (count != 0) count = count / 2 + 1;
+        }
+    }
+    return lengths;
+}
+
+SymbolCode canonicalSymbolCode(const vector<uint8_t>& lengths) {
+    SymbolCode code;
+    code.length = lengths;
+    code.bits.resize(lengths.size());
+    codetableDetail::assignCanonicalCodes(lengths.data(), lengths.size(), code.bits.data());
+    return code;
+}
+
+void writeCodeLengths(BitStreamWriter& writer, const vector<uint8_t>& lengths) {
+    for (uint8_t len: lengths) {
+        if (len == 0) {
+            writer.put(0, 1);
+        } else {
+            writer.put(1 | ((len - 1) << 1), 5);
+        }
+    }
+}
+
+vector<uint8_t> readCodeLengths(BitStreamReader& reader, int alphabetSize) {
+    vector<uint8_t> lengths(alphabetSize);
+    for (int sym = 0; sym < alphabetSize; sym++) {
+        if (reader.get(1)) {
+            lengths[sym] = reader.get(4) + 1;
+        }
+    }
+    reader.checkNotOverrun();
+    return lengths;
+}
+
+TableDecoder::TableDecoder(const vector<uint8_t>& lengths) {
+    SymbolCode code = canonicalSymbolCode(lengths);
+
+    _maxLength = 0;
+    for (uint8_t len: lengths) {
+        _maxLength = max(_maxLength, int(len));
+    }
+    _tableBits = min(max(_maxLength, 1), kDecodeTableBits);
+
+    /* Every index whose low bits are a short code decodes to that code. */
+    _table.assign(size_t(1) << _tableBits, 0);
+    for (int sym = 0; sym < int(lengths.size()); sym++) {
+        int len = lengths[sym];
+        if (len == 0 || len > _tableBits) continue;
+        for (uint32_t index = code.bits[sym]; index < _table.size(); index += 1U << len) {
+            _table[index] = (uint32_t(sym) << 8) | len;
+        }
+    }
+
+    /* Canonical code ranges, for the codes too long for the table. */
+    _lengthCount.assign(_maxLength + 1, 0);
+    for (uint8_t len: lengths) {
+        if (len != 0) _lengthCount[len]++;
+    }
+    _firstCode.assign(_maxLength + 1, 0);
+    _firstIndex.assign(_maxLength + 1, 0);
+    uint32_t first = 0, index = 0;
+    for (int len = 1; len <= _maxLength; len++) {
+        first = (first + _lengthCount[len - 1]) << 1;
+        _firstCode[len] = first;
+        _firstIndex[len] = index;
+        index += _lengthCount[len];
+    }
+    for (int len = 1; len <= _maxLength; len++) {
+        for (int sym = 0; sym < int(lengths.size()); sym++) {
+            if (lengths[sym] == len) _sortedSymbols.push_back(sym);
+        }
+    }
+}
+
+int TableDecoder::decodeLong(BitStreamReader& reader) const {
+    uint32_t code = 0;
+    for (int len = 1; len <= _maxLength; len++) {
+        code = (code << 1) | reader.get(1);
+        if (code - _firstCode[len] < _lengthCount[len]) {
+            return _sortedSymbols[_firstIndex[len] + code - _firstCode[len]];
+        }
+    }
+    error("Invalid Huffman code in block.");
+}
+
+int FixedCode::decodeLong(BitStreamReader& reader) const {
+    uint32_t code = 0;
+    for (int len = 1; len <= maxLength; len++) {
+        code = (code << 1) | reader.get(1);
+        if (code - firstCode[len] < lengthCount[len]) {
+            return sortedSymbols[firstIndex[len] + code - firstCode[len]];
+        }
+    }
+    error("Invalid Huffman code in block.");
+}
+
+void decodeCodedBytes(const vector<uint8_t>& lengths, BitStreamReader& reader, char* out, size_t size) {
+    /* A complete code fills every entry of the table, so the short decoders
+     * never meet bits that match no code.
+     */
+    int maxLength = 0;
+    uint64_t filled = 0;
+    for (uint8_t len: lengths) {
+        if (len == 0) continue;
+        maxLength = max(maxLength, int(len));
+        if (len <= kMaxShortCodeLength) {
+            filled += uint64_t(1) << (kMaxShortCodeLength - len);
+        }
+    }
+    bool shortCode = lengths.size() <= 256 && maxLength <= kMaxShortCodeLength &&
+                     filled == uint64_t(1) << kMaxShortCodeLength;
+    if (!shortCode) {
+        decodeEach(TableDecoder(lengths), reader, out, size);
+        return;
+    }
+
+    /* Below eight bits the smaller table gains little. */
+    switch (maxLength) {
+    case 9:  decodeShortCodes<9>(lengths, reader, out, size);  break;
+    case 10: decodeShortCodes<10>(lengths, reader, out, size); break;
+    case 11: decodeShortCodes<11>(lengths, reader, out, size); break;
+    case 12: decodeShortCodes<12>(lengths, reader, out, size); break;
+    default: decodeShortCodes<8>(lengths, reader, out, size);  break;
+    }
+}
+
+void decodeCodedBytes(const FixedCode& code, BitStreamReader& reader, char* out, size_t size) {
+    decodeEach(code, reader, out, size);
+}
+
+void encodeCodedBytes(const char* text, size_t size, const uint8_t* length, const uint32_t* bits,
+                      BitStreamWriter& writer) {
+    for (size_t i = 0; i < size; i++) {
+        uint8_t byte = text[i];
+        writer.put(bits[byte], length[byte]);
+    }
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+namespace {
+    /* Code lengths for bytes 'A' onwards with Fibonacci counts, whose codes
+     * are as unbalanced as possible: the longest is longest bits. */
+    vector<uint8_t> fibonacciLengths(int longest) {
+        int symbols = longest + 1;
+        vector<uint64_t> counts(256, 0);
+        uint64_t a = 1, b = 1;
+        for (int i = 0; i < symbols; i++) {
+            counts['A' + i] = a;
+            uint64_t next = a + b;
+            a = b;
+            b = next;
+        }
+        return codeLengthsFromCounts(counts, longest);
+    }
+
+    /* Bytes drawn at random from those with a code. */
+    string codedText(const vector<uint8_t>& lengths, size_t size, unsigned seed) {
+        string alphabet;
+        for (int ch = 0; ch < 256; ch++) {
+            if (lengths[ch] != 0) alphabet += char(ch);
+        }
+        mt19937 random(seed);
+        string text;
+        while (text.size() < size) {
+            text += alphabet[random() % alphabet.size()];
+        }
+        return text;
+    }
+
+    string encodeText(const vector<uint8_t>& lengths, const string& text) {
+        SymbolCode code = canonicalSymbolCode(lengths);
+        string bits;
+        BitStreamWriter writer(bits);
+        encodeCodedBytes(text.data(), text.size(), code.length.data(), code.bits.data(), writer);
+        writer.flush();
+        return bits;
+    }
+
+    /* Codes for bytes 0 to 3; the other bytes have none. */
+    constexpr uint8_t kSmallLengths[256] = { 1, 2, 3, 3 };
+}
+
+STUDENT_TEST("A constexpr FixedCode decodes what its own table codes") {
+    static constexpr FixedCode kCode = fixedCode(kSmallLengths);
+    EXPECT_EQUAL(kCode.maxLength, 3);
+    EXPECT_EQUAL(int(kCode.table.length[0]), 1);
+
+    string text = string("\0\1\0\2\0\1\0\3\0\1\0\2\0\1\0\3\3\2\1\0", 20);
+    string bits;
+    BitStreamWriter writer(bits);
+    encodeCodedBytes(text.data(), text.size(), kCode.table.length, kCode.table.bits, writer);
+    writer.flush();
+    string out(text.size(), '\0');
+    BitStreamReader reader(bits.data(), bits.size());
+    decodeCodedBytes(kCode, reader, &out[0], out.size());
+    EXPECT_EQUAL(out, text);
+}
+
+STUDENT_TEST("FixedCode and TableDecoder agree on codes short and long") {
+    for (int longest: { 4, 11, 12, 15 }) {
+        vector<uint8_t> lengths = fibonacciLengths(longest);
+        uint8_t array[256];
+        copy(lengths.begin(), lengths.end(), array);
+        FixedCode fixed = fixedCode(array);
+        TableDecoder table(lengths);
+        EXPECT_EQUAL(fixed.maxLength, longest);
+        EXPECT_EQUAL(table.maxLength(), longest);
+
+        SymbolCode code = canonicalSymbolCode(lengths);
+        for (int ch = 0; ch < 256; ch++) {
+            EXPECT_EQUAL(fixed.table.bits[ch], code.bits[ch]);
+        }
+
+        string text = codedText(lengths, 2000, longest);
+        string bits = encodeText(lengths, text);
+        BitStreamReader fixedReader(bits.data(), bits.size());
+        BitStreamReader tableReader(bits.data(), bits.size());
+        for (char ch: text) {
+            EXPECT_EQUAL(fixed.decode(fixedReader), int(uint8_t(ch)));
+            EXPECT_EQUAL(table.decode(tableReader), int(uint8_t(ch)));
+        }
+    }
+}
+
+STUDENT_TEST("fixedCode refuses lengths that are too long or do not form a code") {
+    uint8_t lengths[256] = {};
+    lengths['a'] = kMaxBlockCodeLength + 1;
+    lengths['b'] = 1;
+    EXPECT_ERROR(fixedCode(lengths));
+    lengths['a'] = 1;
+    lengths['c'] = 1;
+    EXPECT_ERROR(fixedCode(lengths));
+}
+
+STUDENT_TEST("decodeCodedBytes decodes codes of every longest length") {
+    for (int longest = 1; longest <= kMaxBlockCodeLength; longest++) {
+        vector<uint8_t> lengths = fibonacciLengths(longest);
+        for (size_t size: { 0, 1, 5, 6, 7, 100, 4097 }) {
+            string text = codedText(lengths, size, longest);
+            string bits = encodeText(lengths, text);
+            string out(size, '\0');
+            BitStreamReader reader(bits.data(), bits.size());
+            decodeCodedBytes(lengths, reader, &out[0], size);
+            EXPECT_EQUAL(out, text);
+            EXPECT_EQUAL((reader.position() + 7) / 8, uint64_t(bits.size()));
+        }
+    }
+}
+
+STUDENT_TEST("decodeCodedBytes decodes incomplete codes and reports bits matching none") {
+    /* One code of one bit leaves the other bit pattern unused. */
+    vector<uint8_t> lengths(256, 0);
+    lengths['x'] = 1;
+    string text(50, 'x');
+    string bits = encodeText(lengths, text);
+    string out(text.size(), '\0');
+    BitStreamReader reader(bits.data(), bits.size());
+    decodeCodedBytes(lengths, reader, &out[0], out.size());
+    EXPECT_EQUAL(out, text);
+
+    string ones(bits.size(), char(0xFF));
+    BitStreamReader bad(ones.data(), ones.size());
+    EXPECT_ERROR(decodeCodedBytes(lengths, bad, &out[0], out.size()));
+}
+
+STUDENT_TEST("encodeCodedBytes writes the same bits as encodeWithTable") {
+    vector<uint8_t> lengths = fibonacciLengths(12);
+    uint8_t array[256];
+    copy(lengths.begin(), lengths.end(), array);
+    CodeTable table = canonicalCodeTable(array);
+    string text = codedText(lengths, 300, 1);
+
+    Queue<Bit> expected = encodeWithTable(table, text);
+    string bits = encodeText(lengths, text);
+    EXPECT_EQUAL(bits.size(), size_t((expected.size() + 7) / 8));
+    for (int i = 0; !expected.isEmpty(); i++) {
+        EXPECT_EQUAL(Bit((bits[i / 8] >> (i % 8)) & 1), expected.dequeue());
+    }
+}
+
+STUDENT_TEST("decodeCodedBytes reports truncated bits") {
+    for (int longest: { 8, 12, 15 }) {
+        vector<uint8_t> lengths = fibonacciLengths(longest);
+        string text = codedText(lengths, 200, longest);
+        string bits = encodeText(lengths, text);
+        for (size_t size = 0; size < bits.size(); size++) {
+            string out(text.size(), '\0');
+            BitStreamReader reader(bits.data(), size);
+            EXPECT_ERROR(decodeCodedBytes(lengths, reader, &out[0], out.size()));
+        }
+    }
+}
+
+STUDENT_TEST("Damaged coded bytes never write past the output") {
+    for (int longest: { 3, 8, 12, 15 }) {
+        vector<uint8_t> lengths = fibonacciLengths(longest);
+        string text = codedText(lengths, 500, longest);
+        string bits = encodeText(lengths, text);
+        for (size_t i = 0; i < bits.size(); i++) {
+            string damaged = bits;
+            damaged[i] ^= 0x44;
+            string out(text.size() + 64, '#');
+            try {
+                BitStreamReader reader(damaged.data(), damaged.size());
+                decodeCodedBytes(lengths, reader, &out[0], text.size());
+            } catch (ErrorException&) {
+                /* Running out of bits is reported, which is just as good. */
+            }
+            EXPECT_EQUAL(out.substr(text.size()), string(64, '#'));
+        }
+    }
+}
@@ -0,0 +1,325 @@
+#pragma once
+
+#include "bits.h"
+#include "bitstream.h"
+#include "error.h"
+#include "treenode.h"
+#include "queue.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Longest code a CodeTable can hold. */
+const int kMaxCodeLength = 32;
+
+/* Longest code used inside container blocks, so each length fits in four bits. */
+const int kMaxBlockCodeLength = 15;
+
+/* Number of bits a TableDecoder resolves with a single lookup. */
+const int kDecodeTableBits = 11;
+
+/**
+ * Type representing a byte-oriented Huffman code as a flat lookup table rather
+ * than a tree. For every byte value, length is the number of bits in its code
+ * (0 if the byte has no code), and bits is the path from the root of the
+ * encoding tree, with the first step (0 = zero child, 1 = one child) stored in
+ * the lowest bit.
+ */
+struct CodeTable {
+    uint32_t bits[256];
+    uint8_t  length[256];
+};
+
+/* Helpers for the constexpr functions below. */
+namespace codetableDetail {
+    /**
+     * Assigns canonical codes for the given lengths, storing them in path order
+     * in bits.
+     */
+    constexpr void assignCanonicalCodes(const uint8_t* lengths, int alphabetSize, uint32_t* bits) {
+        /* Count codes of each length, rejecting codes that could not all fit in a
+         * binary tree (the Kraft inequality).
+         */
+        uint32_t lengthCount[kMaxCodeLength + 1] = {};
+        for (int sym = 0; sym < alphabetSize; sym++) {
+            if (lengths[sym] > kMaxCodeLength) {
+                error("Code length " + std::to_string(lengths[sym]) + " is too long.");
+            }
+            lengthCount[lengths[sym]]++;
+        }
+        lengthCount[0] = 0;
+
+        uint64_t space = uint64_t(1) << kMaxCodeLength;
+        for (int len = 1; len <= kMaxCodeLength; len++) {
+            uint64_t used = uint64_t(lengthCount[len]) << (kMaxCodeLength - len);
+            if (used > space) {
+                error("Code lengths do not describe a valid prefix code.");
+            }
+            space -= used;
+        }
+
+        /* The first code of each length follows the last code of the previous
+         * length, shifted over by one bit.
+         */
+        uint32_t nextCode[kMaxCodeLength + 1] = {};
+        uint32_t code = 0;
+        for (int len = 1; len <= kMaxCodeLength; len++) {
+            code = (code + lengthCount[len - 1]) << 1;
+            nextCode[len] = code;
+        }
+
+        /* Assign codes in symbol order within each length. Canonical codes are
+         * written most significant bit first, so reverse them into path order.
+         */
+        for (int sym = 0; sym < alphabetSize; sym++) {
+            int len = lengths[sym];
+            bits[sym] = 0;
+            if (len == 0) continue;
+
+            uint32_t canonical = nextCode[len]++;
+            for (int i = 0; i < len; i++) {
+                if (canonical & (1U << (len - 1 - i))) {
+                    bits[sym] |= 1U << i;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Builds the canonical code for the given code lengths (one per byte value,
+ * 0 for bytes without a code). Canonical codes are fully determined by their
+ * lengths, so a code can be shipped or stored as just those 256 lengths.
+ *
+ * This can run at compile time, in which case invalid lengths fail to compile.
+ */
+constexpr CodeTable canonicalCodeTable(const uint8_t lengths[256]) {
+    CodeTable table = {};
+    for (int ch = 0; ch < 256; ch++) {
+        table.length[ch] = lengths[ch];
+    }
+    codetableDetail::assignCanonicalCodes(lengths, 256, table.bits);
+    return table;
+}
+
+/**
+ * Builds the code table for the given encoding tree. Reports an error if the
+ * tree is deeper than kMaxCodeLength.
+ */
+CodeTable codeTableFromTree(EncodingTreeNode* tree);
+
+/**
+ * Encodes the text with the code table, the table equivalent of encodeText.
+ * Reports an error if the text has a byte without a code.
+ */
+Queue<Bit> encodeWithTable(const CodeTable& table, const std::string& text);
+
+
+
+/**
+ * Type representing a Huffman code over an alphabet of any size, with symbols
+ * numbered from 0. Codes are stored as in CodeTable: length[s] bits (0 if s has
+ * no code), path order, first step in the lowest bit.
+ */
+struct SymbolCode {
+    std::vector<uint8_t>  length;
+    std::vector<uint32_t> bits;
+};
+
+/**
+ * Computes Huffman code lengths for the given symbol counts, using the same
+ * merge-the-two-rarest algorithm as buildHuffmanTree, with no code longer than
+ * maxLength. Symbols with a count of zero get no code. If only one symbol
+ * occurs, it gets a one-bit code.
+ */
+std::vector<uint8_t> codeLengthsFromCounts(const std::vector<uint64_t>& counts, int maxLength);
+
+/**
+ * Builds the canonical code for the given code lengths.
+ */
+SymbolCode canonicalSymbolCode(const std::vector<uint8_t>& lengths);
+
+/**
+ * Writes or reads code lengths of at most kMaxBlockCodeLength bits, as one
+ * presence bit per symbol followed, for present symbols, by four bits holding
+ * the length minus one.
+ */
+void writeCodeLengths(BitStreamWriter& writer, const std::vector<uint8_t>& lengths);
+std::vector<uint8_t> readCodeLengths(BitStreamReader& reader, int alphabetSize);
+
+/**
+ * Splits a value into a bucket number and extra bits, the way Deflate codes
+ * match lengths and distances, so that a wide range of values needs only a
+ * small alphabet of symbols. Values 0-3 are buckets 0-3. A larger value is
+ * placed by the position of its leading one bit and the bit after it, and the
+ * rest of its bits follow the bucket's code as is. Values below 2^n fit in
+ * 2n buckets.
+ */
+inline void toBucket(uint32_t value, int& bucket, int& extraBits, uint32_t& extra) {
+    if (value < 4) {
+        bucket = value;
+        extraBits = 0;
+        extra = 0;
+        return;
+    }
+    int top = 31 - __builtin_clz(value);
+    bucket = 2 * top + ((value >> (top - 1)) & 1);
+    extraBits = top - 1;
+    extra = value & ((1U << extraBits) - 1);
+}
+
+/**
+ * Reads the extra bits that follow a bucket's code and returns the value.
+ */
+inline uint32_t fromBucket(int bucket, BitStreamReader& reader) {
+    if (bucket < 4) return bucket;
+    int extraBits = bucket / 2 - 1;
+    return ((2U | (bucket & 1)) << extraBits) | reader.get(extraBits);
+}
+
+/**
+ * Type that decodes a canonical code a symbol at a time. Codes of up to
+ * kDecodeTableBits bits are resolved with one table lookup; longer codes fall
+ * back to walking the canonical code a bit at a time.
+ */
+class TableDecoder {
+public:
+    explicit TableDecoder(const std::vector<uint8_t>& lengths);
+
+    /* Reads one code and returns its symbol. */
+    int decode(BitStreamReader& reader) const {
+        uint32_t entry = _table[reader.peek(_tableBits)];
+        if (entry & 0xFF) {
+            reader.skip(entry & 0xFF);
+            return entry >> 8;
+        }
+        return decodeLong(reader);
+    }
+
+    int maxLength() const { return _maxLength; }
+
+private:
+    int decodeLong(BitStreamReader& reader) const;
+
+    int _tableBits;
+    int _maxLength;
+    std::vector<uint32_t> _table;            // symbol << 8 | length, 0 if longer
+    std::vector<uint32_t> _firstCode;        // per length, canonical first code
+    std::vector<uint32_t> _lengthCount;      // per length, number of codes
+    std::vector<uint32_t> _firstIndex;       // per length, index into _sortedSymbols
+    std::vector<int> _sortedSymbols;         // symbols ordered by (length, symbol)
+};
+
+/**
+ * Type holding a byte code that is fixed when the program is compiled, such as
+ * a static codebook, with both its code table and its decoding tables. Built
+ * by fixedCode into a constexpr variable, all of it is computed by the
+ * compiler and sits in read-only data, so coding with it needs no setup at run
+ * time and no lock to share it between threads.
+ *
+ * decode works as TableDecoder's does: codes of up to kDecodeTableBits bits
+ * take one lookup and longer ones walk the canonical code.
+ */
+struct FixedCode {
+    CodeTable table;
+    int tableBits;
+    int maxLength;
+    uint32_t decodeTable[1 << kDecodeTableBits];        // symbol << 8 | length, 0 if longer
+    uint32_t firstCode[kMaxBlockCodeLength + 1];        // per length, canonical first code
+    uint32_t lengthCount[kMaxBlockCodeLength + 1];      // per length, number of codes
+    uint32_t firstIndex[kMaxBlockCodeLength + 1];       // per length, index into sortedSymbols
+    uint8_t  sortedSymbols[256];                        // symbols ordered by (length, symbol)
+
+    /* Reads one code and returns its byte. */
+    int decode(BitStreamReader& reader) const {
+        uint32_t entry = decodeTable[reader.peek(tableBits)];
+        if (entry & 0xFF) {
+            reader.skip(entry & 0xFF);
+            return entry >> 8;
+        }
+        return decodeLong(reader);
+    }
+
+    int decodeLong(BitStreamReader& reader) const;
+};
+
+/**
+ * Codes size bytes of text with the given per-byte code lengths and bits, in
+ * the form CodeTable and SymbolCode hold them, appending the bits to writer.
+ */
+void encodeCodedBytes(const char* text, size_t size, const uint8_t* length, const uint32_t* bits,
+                      BitStreamWriter& writer);
+
+/* Longest code that decodeCodedBytes decodes with a single lookup. */
+const int kMaxShortCodeLength = 12;
+
+/**
+ * Decodes size bytes, coded with the canonical code for the given byte code
+ * lengths, from reader into out. Reports an error if the bits run out or do
+ * not form codes.
+ *
+ * The decoder is picked after looking at the lengths. Complete codes of up to
+ * kMaxShortCodeLength bits use a decoder compiled for their longest code: one
+ * lookup resolves any code, and as every code fits in a known number of bits,
+ * several are read for each check of the bit buffer. Other codes use a
+ * TableDecoder.
+ */
+void decodeCodedBytes(const std::vector<uint8_t>& lengths, BitStreamReader& reader, char* out,
+                      size_t size);
+
+/**
+ * Decodes size bytes coded with a fixed code, such as a static codebook, from
+ * reader into out, reporting an error as above.
+ */
+void decodeCodedBytes(const FixedCode& code, BitStreamReader& reader, char* out, size_t size);
+
+/**
+ * Builds the fixed code for the given code lengths, of at most
+ * kMaxBlockCodeLength bits. Meant for constexpr variables:
+ *
+ *     constexpr uint8_t kLengths[256] = { ... };
+ *     constexpr FixedCode kCode = fixedCode(kLengths);
+ */
+constexpr FixedCode fixedCode(const uint8_t (&lengths)[256]) {
+    FixedCode code = {};
+    code.table = canonicalCodeTable(lengths);
+
+    code.maxLength = 0;
+    for (int ch = 0; ch < 256; ch++) {
+        if (lengths[ch] > kMaxBlockCodeLength) {
+            error("Fixed codes are limited to " + std::to_string(kMaxBlockCodeLength) + " bits.");
+        }
+        code.maxLength = std::max(code.maxLength, int(lengths[ch]));
+    }
+    code.tableBits = std::min(std::max(code.maxLength, 1), kDecodeTableBits);
+
+    /* Every index whose low bits are a short code decodes to that code. */
+    uint32_t tableSize = 1U << code.tableBits;
+    for (int ch = 0; ch < 256; ch++) {
+        int len = lengths[ch];
+        if (len == 0 || len > code.tableBits) continue;
+        for (uint32_t index = code.table.bits[ch]; index < tableSize; index += 1U << len) {
+            code.decodeTable[index] = (uint32_t(ch) << 8) | len;
+        }
+    }
+
+    /* Canonical code ranges, for the codes too long for the table. */
+    for (int ch = 0; ch < 256; ch++) {
+        if (lengths[ch] != 0) code.lengthCount[lengths[ch]]++;
+    }
+    uint32_t first = 0, index = 0;
+    for (int len = 1; len <= code.maxLength; len++) {
+        first = (first + code.lengthCount[len - 1]) << 1;
+        code.firstCode[len] = first;
+        code.firstIndex[len] = index;
+        index += code.lengthCount[len];
+    }
+    for (int len = 1; len <= code.maxLength; len++) {
+        for (int ch = 0; ch < 256; ch++) {
+            if (lengths[ch] == len) code.sortedSymbols[code.firstIndex[len]++] = ch;
+        }
+        code.firstIndex[len] -= code.lengthCount[len];
+    }
+    return code;
+}
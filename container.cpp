@@ -0,0 +1,1294 @@
+#include "container.h"
+#include "ans.h"
+#include "bitstream.h"
+#include "bwt.h"
+#include "codebooks.h"
+#include "codetable.h"
+#include "context.h"
+#include "crc32c.h"
+#include "error.h"
+#include "interleaved.h"
+#include "lz77.h"
+#include "parallel.h"
+#include "rle.h"
+#include "wide.h"
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "testutil.h"
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * Reading and writing of the block container format described in container.h.
+ */
+
+namespace {
+    /* "CS106B A9" */
+    const uint32_t kContainerHeader = 0xC5106BA9;
+    const uint8_t kContainerVersion = 1;
+
+    /* Flags in the header. */
+    const uint8_t kChecksumFlag = 1;
+    const uint8_t kIndexFlag    = 2;
+    const uint8_t kKnownFlags   = kChecksumFlag | kIndexFlag;
+
+    /* "CS106B AB", at the very end of a container with an index. */
+    const uint32_t kIndexTrailer = 0xC5106BAB;
+
+    /* Bytes after the index: its length and the trailer magic. */
+    const size_t kIndexFooterBytes = 8;
+
+    /* Magic, version and flags. */
+    const size_t kHeaderBytes = sizeof kContainerHeader + 2;
+
+    /* Checksums are computed this many bytes at a time alongside counting or
+     * copying, so each piece is still in the L1 cache when it is read again.
+     */
+    const size_t kChecksumChunk = 16 * 1024;
+
+    /* Bits needed to write the code lengths of a byte alphabet. */
+    uint64_t codeLengthsBits(const vector<uint8_t>& lengths) {
+        uint64_t bits = 0;
+        for (uint8_t len: lengths) {
+            bits += (len == 0) ? 1 : 5;
+        }
+        return bits;
+    }
+
+    void putVarint(string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(char(0x80 | (value & 0x7F)));
+            value >>= 7;
+        }
+        out.push_back(char(value));
+    }
+
+    uint64_t getVarint(const string& data, size_t& pos) {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= data.size()) {
+                error("Unexpected end of container.");
+            }
+            uint8_t byte = data[pos++];
+            value |= uint64_t(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) return value;
+        }
+        error("Malformed size in container.");
+    }
+
+    /**
+     * Appends a block with the given method, decoded size and payload.
+     */
+    void writeBlock(string& out, BlockMethod method, uint64_t rawSize, const char* payload, size_t size) {
+        out.push_back(char(method));
+        putVarint(out, rawSize);
+        putVarint(out, size);
+        out.append(payload, size);
+    }
+
+    /**
+     * Returns the number of payload bytes needed for headerBits of header plus
+     * a block of size bytes coded with the given code lengths, when counts is a
+     * histogram of counted of those bytes.
+     */
+    uint64_t payloadBytes(uint64_t headerBits, const uint64_t* counts, const uint8_t* lengths,
+                          uint64_t counted, uint64_t size) {
+        uint64_t bits = 0;
+        for (int ch = 0; ch < 256; ch++) {
+            bits += counts[ch] * lengths[ch];
+        }
+        if (counted != size) {
+            bits = uint64_t(double(bits) * size / counted);
+        }
+        return (headerBits + bits + 7) / 8;
+    }
+
+    /**
+     * Every coded byte takes at least one bit, so a block claiming to decode to
+     * more bytes than it has bits is corrupt; catch that before allocating.
+     */
+    void checkCodedSize(uint64_t rawSize, uint64_t payloadSize) {
+        if (rawSize / 8 > payloadSize) {
+            error("Block claims more bytes than its payload can hold.");
+        }
+    }
+
+    /**
+     * Reads the magic, version and flags at the start of a container, storing
+     * the flags, and returns the position of the first block.
+     */
+    size_t readContainerHeader(const char* data, size_t size, uint8_t& flags) {
+        uint32_t header;
+        if (size < sizeof header || (memcpy(&header, data, sizeof header), header != kContainerHeader)) {
+            error("Chosen file is not a Huffman-compressed file.");
+        }
+        size_t pos = sizeof header;
+        if (pos >= size) {
+            error("Unexpected end of container.");
+        }
+        if (uint8_t(data[pos++]) != kContainerVersion) {
+            error("Unsupported container version.");
+        }
+        if (pos >= size) {
+            error("Unexpected end of container.");
+        }
+        flags = data[pos++];
+        if (flags & ~kKnownFlags) {
+            error("Container uses features this version does not support.");
+        }
+        return pos;
+    }
+
+    uint64_t readVarint(istream& in) {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            char byte;
+            if (!in.get(byte)) {
+                error("Unexpected end of container.");
+            }
+            value |= uint64_t(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) return value;
+        }
+        error("Malformed size in container.");
+    }
+
+    /* Four bytes, little-endian. */
+    void putUint32(string& out, uint32_t value) {
+        for (int i = 0; i < 4; i++) {
+            out.push_back(char(value >> (8 * i)));
+        }
+    }
+
+    uint32_t getUint32(const string& data, size_t& pos) {
+        if (data.size() - pos < 4) {
+            error("Unexpected end of container.");
+        }
+        uint32_t value = 0;
+        for (int i = 0; i < 4; i++) {
+            value |= uint32_t(uint8_t(data[pos++])) << (8 * i);
+        }
+        return value;
+    }
+
+    /**
+     * Appends the block index: the decoded and stored size of every block,
+     * followed by the index length and the trailer magic, so a reader can find
+     * the index from the end of the file.
+     */
+    void writeIndex(string& out, const vector<uint64_t>& rawSizes, const vector<uint64_t>& blockBytes) {
+        size_t start = out.size();
+        putVarint(out, rawSizes.size());
+        for (size_t i = 0; i < rawSizes.size(); i++) {
+            putVarint(out, rawSizes[i]);
+            putVarint(out, blockBytes[i]);
+        }
+        uint64_t length = out.size() - start;
+        if (length > UINT32_MAX) {
+            error("Container index is too large.");
+        }
+        putUint32(out, uint32_t(length));
+        out.append(reinterpret_cast<const char *>(&kIndexTrailer), sizeof kIndexTrailer);
+    }
+
+    /**
+     * Adds the size bytes of text to counts and returns their checksum, reading
+     * the text from memory once.
+     */
+    uint32_t countAndChecksum(const char* text, size_t size, uint64_t* counts) {
+        uint32_t checksum = 0;
+        for (size_t pos = 0; pos < size; pos += kChecksumChunk) {
+            size_t chunk = min(kChecksumChunk, size - pos);
+            for (size_t i = 0; i < chunk; i++) {
+                counts[uint8_t(text[pos + i])]++;
+            }
+            checksum = crc32c(text + pos, chunk, checksum);
+        }
+        return checksum;
+    }
+
+    /**
+     * Copies size bytes from source to dest and returns their checksum.
+     */
+    uint32_t copyAndChecksum(char* dest, const char* source, size_t size) {
+        uint32_t checksum = 0;
+        for (size_t pos = 0; pos < size; pos += kChecksumChunk) {
+            size_t chunk = min(kChecksumChunk, size - pos);
+            memcpy(dest + pos, source + pos, chunk);
+            checksum = crc32c(dest + pos, chunk, checksum);
+        }
+        return checksum;
+    }
+
+    /**
+     * Writes the size bytes of text as a stored block and returns their
+     * checksum, reading the text from memory once.
+     */
+    uint32_t storeAndChecksum(string& out, const char* text, size_t size) {
+        out.push_back(char(BlockMethod::Stored));
+        putVarint(out, size);
+        putVarint(out, size);
+        size_t start = out.size();
+        out.resize(start + size);
+        return copyAndChecksum(&out[start], text, size);
+    }
+
+    /**
+     * Codes the size bytes of text as encodeCodedBytes does and returns their
+     * checksum, reading the text from memory once.
+     */
+    uint32_t codeAndChecksum(const char* text, size_t size, const uint8_t* length, const uint32_t* bits,
+                             BitStreamWriter& writer) {
+        uint32_t checksum = 0;
+        for (size_t pos = 0; pos < size; pos += kChecksumChunk) {
+            size_t chunk = min(kChecksumChunk, size - pos);
+            encodeCodedBytes(text + pos, chunk, length, bits, writer);
+            checksum = crc32c(text + pos, chunk, checksum);
+        }
+        return checksum;
+    }
+
+    /**
+     * Grows out by size bytes and returns where the new bytes start. Sizes come
+     * from the container, so running out of memory is reported as an error
+     * like any other bad container.
+     */
+    char* extend(string& out, size_t size) {
+        size_t start = out.size();
+        try {
+            out.resize(start + size);
+        } catch (const bad_alloc&) {
+            error("Not enough memory to decompress the container.");
+        }
+        return &out[0] + start;
+    }
+
+    /* Where a block's payload lies in the container, and how it is coded. */
+    struct BlockInfo {
+        size_t   start;
+        uint8_t  method;
+        uint64_t rawSize;
+        size_t   payload;
+        uint64_t payloadSize;
+        bool     hasChecksum = false;
+        uint32_t checksum = 0;
+        size_t   end;           // position just past the block
+    };
+
+    /**
+     * Reads the header (and checksum, if the container has them) of the block
+     * starting at data[pos] and checks that its sizes are plausible for its
+     * method, so that its output can be allocated before the payload is
+     * decoded.
+     */
+    BlockInfo readBlockInfo(const string& data, size_t pos, bool checksums) {
+        if (pos >= data.size()) {
+            error("Unexpected end of container.");
+        }
+        BlockInfo block;
+        block.start = pos;
+        block.method = data[pos++];
+        block.rawSize = getVarint(data, pos);
+        block.payloadSize = getVarint(data, pos);
+        block.payload = pos;
+        if (block.payloadSize > data.size() - pos) {
+            error("Block extends past the end of the container.");
+        }
+        block.end = pos + block.payloadSize;
+        if (block.rawSize > kMaxBlockSize) {
+            error("Block claims more bytes than any block may hold.");
+        }
+        if (checksums) {
+            block.hasChecksum = true;
+            block.checksum = getUint32(data, block.end);
+        }
+
+        uint64_t rawSize = block.rawSize;
+        uint64_t payloadSize = block.payloadSize;
+        switch (BlockMethod(block.method)) {
+        case BlockMethod::Stored:
+            if (payloadSize != rawSize) {
+                error("Stored block has the wrong size.");
+            }
+            break;
+        case BlockMethod::Huffman:
+            checkCodedSize(rawSize, payloadSize);
+            break;
+        case BlockMethod::Codebook:
+            if (payloadSize < 1) {
+                error("Codebook block is missing its codebook id.");
+            }
+            checkCodedSize(rawSize, payloadSize);
+            break;
+        case BlockMethod::Lz77:
+            if (rawSize / kLzMaxMatch / 8 > payloadSize) {
+                error("Block claims more bytes than its payload can hold.");
+            }
+            break;
+        case BlockMethod::Rle:
+            if (rawSize / kRleMaxRepeat / 8 > payloadSize) {
+                error("Block claims more bytes than its payload can hold.");
+            }
+            break;
+        case BlockMethod::Context:
+        case BlockMethod::Interleaved:
+            checkCodedSize(rawSize, payloadSize);
+            break;
+        case BlockMethod::Wide:
+            /* Every pair of bytes takes at least one bit. */
+            if (rawSize / 16 > payloadSize) {
+                error("Block claims more bytes than its payload can hold.");
+            }
+            break;
+        case BlockMethod::Ans:
+            /* A byte can cost as little as 1/2^kAnsMaxTableLog of a bit. */
+            if (rawSize / (uint64_t(8) << kAnsMaxTableLog) > payloadSize) {
+                error("Block claims more bytes than its payload can hold.");
+            }
+            break;
+        case BlockMethod::Bwt:
+            /* Zero runs are coded in logarithmic space, so only the transform's
+             * own limit bounds the size.
+             */
+            if (rawSize > kBwtMaxBlockSize) {
+                error("Block claims more bytes than its payload can hold.");
+            }
+            break;
+        default:
+            error("Unknown block method " + to_string(block.method) + ".");
+        }
+        return block;
+    }
+
+    /**
+     * Decodes a block checked by readBlockInfo into its rawSize bytes at out.
+     */
+    void decodePayload(const BlockInfo& block, const char* payload, char* out) {
+        uint64_t rawSize = block.rawSize;
+        uint64_t payloadSize = block.payloadSize;
+        switch (BlockMethod(block.method)) {
+        case BlockMethod::Stored:
+            memcpy(out, payload, rawSize);
+            break;
+        case BlockMethod::Huffman: {
+            BitStreamReader reader(payload, payloadSize);
+            decodeCodedBytes(readCodeLengths(reader, 256), reader, out, rawSize);
+            break;
+        }
+        case BlockMethod::Codebook: {
+            BitStreamReader reader(payload + 1, payloadSize - 1);
+            decodeCodedBytes(codebookCode(uint8_t(payload[0])), reader, out, rawSize);
+            break;
+        }
+        case BlockMethod::Lz77:
+            decodeLz77(payload, payloadSize, out, rawSize);
+            break;
+        case BlockMethod::Rle:
+            decodeRle(payload, payloadSize, out, rawSize);
+            break;
+        case BlockMethod::Bwt:
+            decodeBwt(payload, payloadSize, out, rawSize);
+            break;
+        case BlockMethod::Context:
+            decodeContextModel(payload, payloadSize, out, rawSize);
+            break;
+        case BlockMethod::Ans:
+            decodeAns(payload, payloadSize, out, rawSize);
+            break;
+        case BlockMethod::Wide:
+            decodeWide(payload, payloadSize, out, rawSize);
+            break;
+        case BlockMethod::Interleaved:
+            decodeInterleaved(payload, payloadSize, out, rawSize);
+            break;
+        }
+    }
+
+    /**
+     * Decodes a block as decodePayload does, then checks the result against the
+     * block's checksum, if it has one.
+     */
+    void decodeChecked(const BlockInfo& block, const char* payload, char* out) {
+        if (!block.hasChecksum) {
+            decodePayload(block, payload, out);
+            return;
+        }
+
+        uint32_t checksum;
+        if (BlockMethod(block.method) == BlockMethod::Stored) {
+            checksum = copyAndChecksum(out, payload, block.rawSize);
+        } else {
+            decodePayload(block, payload, out);
+            checksum = crc32c(out, block.rawSize);
+        }
+        if (checksum != block.checksum) {
+            error("Block checksum does not match; the data is corrupt.");
+        }
+    }
+
+    /**
+     * Finds and checks every block of a container without decoding any, so
+     * each one's place in the output is known and the blocks can be decoded
+     * in any order. Sets checksums to whether the blocks carry them, and total
+     * to the decoded size of the whole container.
+     */
+    vector<BlockInfo> scanBlocks(const string& data, bool& checksums, size_t& total) {
+        uint8_t flags;
+        size_t pos = readContainerHeader(data.data(), data.size(), flags);
+        checksums = flags & kChecksumFlag;
+
+        vector<BlockInfo> blocks;
+        total = 0;
+        while (true) {
+            if (pos >= data.size()) {
+                error("Unexpected end of container.");
+            }
+            if (uint8_t(data[pos]) == kEndOfBlocks) break;
+            BlockInfo block = readBlockInfo(data, pos, checksums);
+            if (block.rawSize > string().max_size() - total) {
+                error("Container is too large to decompress.");
+            }
+            total += block.rawSize;
+            blocks.push_back(block);
+            pos = block.end;
+        }
+        return blocks;
+    }
+}
+
+void checkContainerOptions(const ContainerOptions& options) {
+    if (options.blockSize == 0 || options.blockSize > kMaxBlockSize) {
+        error("Block size must be between 1 and " + to_string(kMaxBlockSize) + ".");
+    }
+}
+
+bool isContainer(const string& data) {
+    uint32_t header;
+    if (data.size() < sizeof header) return false;
+    memcpy(&header, data.data(), sizeof header);
+    return header == kContainerHeader;
+}
+
+void encodeBlock(const char* text, size_t size, const ContainerOptions& options, string& out) {
+    /* The checksum is taken along with the histogram when there is a full one,
+     * and otherwise along with storing or coding the block where that reads the
+     * text in one pass. Only the other methods need a pass of its own.
+     */
+    uint32_t checksum = 0;
+    bool checksummed = false;
+    auto finish = [&]() {
+        if (!options.checksums) return;
+        if (!checksummed) checksum = crc32c(text, size);
+        putUint32(out, checksum);
+    };
+    auto store = [&]() {
+        if (options.checksums && !checksummed) {
+            checksum = storeAndChecksum(out, text, size);
+            checksummed = true;
+        } else {
+            writeBlock(out, BlockMethod::Stored, size, text, size);
+        }
+    };
+    auto codeBytes = [&](const uint8_t* length, const uint32_t* bits, BitStreamWriter& writer) {
+        if (options.checksums && !checksummed) {
+            checksum = codeAndChecksum(text, size, length, bits, writer);
+            checksummed = true;
+        } else {
+            encodeCodedBytes(text, size, length, bits, writer);
+        }
+    };
+
+    /* Count every byte, unless asked to build the code from a sample. */
+    vector<uint64_t> counts(256, 0);
+    uint64_t counted = size;
+    bool sampled = options.histogramSampleBytes != 0 && size > options.histogramSampleBytes;
+    /* The sample sees only the mix of byte values, so with methods that look
+     * further it skips just the blocks that look random.
+     */
+    bool orderZeroOnly = options.lzLevel == 0 && !options.rle && !options.bwt && !options.contexts &&
+                         !options.wide;
+    auto hopeless = [&](const CompressionEstimate& estimate) {
+        return !worthCompressing(estimate, options.minPredictedGain) &&
+               (orderZeroOnly || looksRandom(estimate));
+    };
+    if (sampled) {
+        counted = sampleHistogram(text, size, options.histogramSampleBytes, counts.data());
+        if (hopeless(estimateFromCounts(counts.data(), counted))) {
+            store();
+            finish();
+            return;
+        }
+
+        /* Bytes the sample missed may still occur, so every byte needs a code. */
+        for (uint64_t& count: counts) {
+            if (count == 0) count = 1;
+        }
+    } else {
+        /* Skip even the histogram if a sample says the block is hopeless. */
+        if (size > options.sampleBytes && hopeless(estimateCompression(text, size, options.sampleBytes))) {
+            store();
+            finish();
+            return;
+        }
+        if (options.checksums) {
+            checksum = countAndChecksum(text, size, counts.data());
+            checksummed = true;
+        } else {
+            for (size_t i = 0; i < size; i++) {
+                counts[uint8_t(text[i])]++;
+            }
+        }
+    }
+
+    /* Work out the size of every candidate before coding anything, so data that
+     * would not shrink is never coded at all. With a full histogram the sizes are
+     * exact; from a sample they are scaled up to the whole block.
+     */
+    BlockMethod method = BlockMethod::Stored;
+    uint64_t bestBytes = size;
+
+    /* Interleaved streams stand in for the single Huffman stream when asked for. */
+    bool interleaved = options.interleaved && size <= kInterleavedMaxBlockSize;
+    vector<uint8_t> lengths = codeLengthsFromCounts(counts, interleaved ? kInterleavedMaxCodeLength
+                                                                        : kMaxBlockCodeLength);
+    uint64_t huffmanBytes = payloadBytes(codeLengthsBits(lengths), counts.data(), lengths.data(),
+                                         counted, size);
+    if (interleaved) {
+        huffmanBytes += kInterleavedOverheadBytes;
+    }
+    if (huffmanBytes < bestBytes) {
+        method = interleaved ? BlockMethod::Interleaved : BlockMethod::Huffman;
+        bestBytes = huffmanBytes;
+    }
+
+    int codebookId = chooseCodebookForCounts(counts.data());
+    const CodeTable& table = codebookCode(codebookId).table;
+    uint64_t codebookBytes = payloadBytes(8, counts.data(), table.length, counted, size);
+    if (codebookBytes < bestBytes) {
+        method = BlockMethod::Codebook;
+        bestBytes = codebookBytes;
+    }
+
+    if (options.ans) {
+        uint64_t ansBytes = ansPayloadBytes(counts.data(), counted, size);
+        if (ansBytes < bestBytes) {
+            method = BlockMethod::Ans;
+            bestBytes = ansBytes;
+        }
+    }
+
+    string payload;
+    if (options.lzLevel != 0) {
+        encodeLz77(text, size, options.lzLevel, payload);
+        if (payload.size() < bestBytes) {
+            method = BlockMethod::Lz77;
+            bestBytes = payload.size();
+        } else {
+            payload.clear();
+        }
+    }
+    if (options.rle) {
+        string rlePayload;
+        if (encodeRle(text, size, rlePayload) && rlePayload.size() < bestBytes) {
+            method = BlockMethod::Rle;
+            bestBytes = rlePayload.size();
+            payload.swap(rlePayload);
+        }
+    }
+    if (options.bwt && size <= kBwtMaxBlockSize) {
+        string bwtPayload;
+        encodeBwt(text, size, bwtPayload);
+        if (bwtPayload.size() < bestBytes) {
+            method = BlockMethod::Bwt;
+            bestBytes = bwtPayload.size();
+            payload.swap(bwtPayload);
+        }
+    }
+    if (options.contexts && size >= kContextMinBlockSize) {
+        string contextPayload;
+        if (encodeContextModel(text, size, bestBytes, contextPayload)) {
+            method = BlockMethod::Context;
+            bestBytes = contextPayload.size();
+            payload.swap(contextPayload);
+        }
+    }
+    if (options.wide) {
+        string widePayload;
+        if (encodeWide(text, size, bestBytes, widePayload)) {
+            method = BlockMethod::Wide;
+            bestBytes = widePayload.size();
+            payload.swap(widePayload);
+        }
+    }
+
+    if (method == BlockMethod::Huffman) {
+        SymbolCode code = canonicalSymbolCode(lengths);
+        BitStreamWriter writer(payload);
+        writeCodeLengths(writer, lengths);
+        codeBytes(code.length.data(), code.bits.data(), writer);
+        writer.flush();
+    } else if (method == BlockMethod::Codebook) {
+        payload.push_back(char(codebookId));
+        BitStreamWriter writer(payload);
+        codeBytes(table.length, table.bits, writer);
+        writer.flush();
+    } else if (method == BlockMethod::Interleaved) {
+        encodeInterleaved(text, size, lengths, payload);
+    } else if (method == BlockMethod::Ans) {
+        encodeAns(text, size, counts.data(), payload);
+    }
+
+    /* A code built from a sample can turn out worse than predicted. */
+    if (method == BlockMethod::Stored || payload.size() >= size) {
+        store();
+    } else {
+        writeBlock(out, method, size, payload.data(), payload.size());
+    }
+    finish();
+}
+
+size_t decodeBlock(const string& data, size_t pos, string& out, bool checksums) {
+    BlockInfo block = readBlockInfo(data, pos, checksums);
+    decodeChecked(block, data.data() + block.payload, extend(out, block.rawSize));
+    return block.end;
+}
+
+string containerHeader(const ContainerOptions& options) {
+    string out;
+    out.append(reinterpret_cast<const char *>(&kContainerHeader), sizeof kContainerHeader);
+    out.push_back(char(kContainerVersion));
+    out.push_back(char((options.checksums ? kChecksumFlag : 0) | (options.index ? kIndexFlag : 0)));
+    return out;
+}
+
+string containerTrailer(const ContainerOptions& options, const vector<uint64_t>& rawSizes,
+                        const vector<uint64_t>& blockBytes) {
+    string out(1, char(kEndOfBlocks));
+    if (options.index) {
+        writeIndex(out, rawSizes, blockBytes);
+    }
+    return out;
+}
+
+string compressContainer(const string& text, const ContainerOptions& options) {
+    checkContainerOptions(options);
+
+    string out = containerHeader(options);
+    size_t numBlocks = (text.size() + options.blockSize - 1) / options.blockSize;
+    vector<uint64_t> rawSizes, blockBytes;
+    for (size_t pos = 0; pos < text.size(); pos += options.blockSize) {
+        rawSizes.push_back(min(options.blockSize, text.size() - pos));
+    }
+
+    if (workerCount(options.threads, numBlocks) == 1) {
+        for (size_t i = 0; i < numBlocks; i++) {
+            size_t start = out.size();
+            encodeBlock(text.data() + i * options.blockSize, rawSizes[i], options, out);
+            blockBytes.push_back(out.size() - start);
+        }
+    } else {
+        vector<string> blocks(numBlocks);
+        parallelFor(numBlocks, options.threads, [&](size_t i) {
+            encodeBlock(text.data() + i * options.blockSize, rawSizes[i], options, blocks[i]);
+        });
+        for (string& block: blocks) {
+            blockBytes.push_back(block.size());
+            out += block;
+            string().swap(block);
+        }
+    }
+    out += containerTrailer(options, rawSizes, blockBytes);
+    return out;
+}
+
+ContainerLayout scanContainer(const string& data) {
+    ContainerLayout layout;
+    size_t total;
+    for (const BlockInfo& block: scanBlocks(data, layout.checksums, total)) {
+        layout.blockStarts.push_back(block.start);
+        layout.rawSizes.push_back(block.rawSize);
+    }
+    return layout;
+}
+
+string decompressContainer(const string& data, int threads) {
+    bool checksums;
+    size_t total;
+    vector<BlockInfo> blocks = scanBlocks(data, checksums, total);
+    vector<size_t> starts;
+    size_t offset = 0;
+    for (const BlockInfo& block: blocks) {
+        starts.push_back(offset);
+        offset += block.rawSize;
+    }
+
+    string out;
+    char* start = extend(out, total);
+    parallelFor(blocks.size(), threads, [&](size_t i) {
+        decodeChecked(blocks[i], data.data() + blocks[i].payload, start + starts[i]);
+    });
+    return out;
+}
+
+ContainerReader::ContainerReader(istream& in) : _in(in) {
+    char header[kHeaderBytes];
+    _in.seekg(0, ios::end);
+    streamoff fileEnd = _in.tellg();
+    if (fileEnd < 0) {
+        error("Unable to read container.");
+    }
+    uint64_t fileSize = fileEnd;
+    _in.seekg(0);
+    size_t headerBytes = min<uint64_t>(kHeaderBytes, fileSize);
+    if (!_in.read(header, headerBytes)) {
+        error("Unable to read container.");
+    }
+    uint8_t flags;
+    uint64_t pos = readContainerHeader(header, headerBytes, flags);
+    _checksums = flags & kChecksumFlag;
+
+    if (flags & kIndexFlag) {
+        /* Find the index from the footer, and check it accounts for exactly
+         * the bytes between the header and the end marker.
+         */
+        if (fileSize < pos + 1 + kIndexFooterBytes) {
+            error("Unexpected end of container.");
+        }
+        string footer(kIndexFooterBytes, '\0');
+        _in.seekg(fileSize - kIndexFooterBytes);
+        _in.read(&footer[0], kIndexFooterBytes);
+        size_t footerPos = 0;
+        uint64_t indexBytes = getUint32(footer, footerPos);
+        uint32_t trailer;
+        memcpy(&trailer, footer.data() + footerPos, sizeof trailer);
+        if (!_in || trailer != kIndexTrailer || indexBytes > fileSize - kIndexFooterBytes - pos - 1) {
+            error("Container index is missing or damaged.");
+        }
+
+        uint64_t indexStart = fileSize - kIndexFooterBytes - indexBytes;
+        string index(indexBytes, '\0');
+        _in.seekg(indexStart);
+        if (!_in.read(&index[0], indexBytes)) {
+            error("Unable to read container index.");
+        }
+        size_t indexPos = 0;
+        uint64_t count = getVarint(index, indexPos);
+        if (count > indexBytes) {
+            error("Container index is missing or damaged.");
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            SyncPoint point;
+            point.rawOffset = _size;
+            point.filePos = pos;
+            point.rawSize = getVarint(index, indexPos);
+            point.blockBytes = getVarint(index, indexPos);
+            if (point.rawSize > kMaxBlockSize || point.blockBytes > indexStart - pos) {
+                error("Container index is missing or damaged.");
+            }
+            _syncPoints.push_back(point);
+            _size += point.rawSize;
+            pos += point.blockBytes;
+        }
+        if (pos + 1 != indexStart) {
+            error("Container index does not match its blocks.");
+        }
+    } else {
+        /* No index, so walk the block headers, skipping the payloads. */
+        _in.seekg(pos);
+        while (true) {
+            char method;
+            if (!_in.get(method)) {
+                error("Unexpected end of container.");
+            }
+            if (uint8_t(method) == kEndOfBlocks) break;
+            SyncPoint point;
+            point.rawOffset = _size;
+            point.filePos = pos;
+            point.rawSize = readVarint(_in);
+            uint64_t payloadSize = readVarint(_in);
+            streamoff payloadStart = _in.tellg();
+            if (payloadStart < 0) {
+                error("Unable to read container.");
+            }
+            uint64_t end = payloadStart + payloadSize + (_checksums ? 4 : 0);
+            if (payloadSize > fileSize || end > fileSize) {
+                error("Block extends past the end of the container.");
+            }
+            if (point.rawSize > kMaxBlockSize) {
+                error("Block claims more bytes than any block may hold.");
+            }
+            point.blockBytes = end - pos;
+            _syncPoints.push_back(point);
+            _size += point.rawSize;
+            pos = end;
+            _in.seekg(pos);
+        }
+    }
+}
+
+uint64_t ContainerReader::size() const {
+    return _size;
+}
+
+string ContainerReader::readRange(uint64_t offset, uint64_t length) {
+    if (offset > _size || length > _size - offset) {
+        error("Range extends past the end of the data.");
+    }
+
+    /* The last block starting at or before offset covers it. */
+    size_t first = upper_bound(_syncPoints.begin(), _syncPoints.end(), offset,
+                               [](uint64_t value, const SyncPoint& point) {
+                                   return value < point.rawOffset;
+                               }) - _syncPoints.begin();
+    string result;
+    string block, decoded;
+    for (size_t i = first == 0 ? 0 : first - 1; i < _syncPoints.size() && result.size() < length; i++) {
+        const SyncPoint& point = _syncPoints[i];
+        block.resize(point.blockBytes);
+        _in.clear();
+        _in.seekg(point.filePos);
+        if (!_in.read(&block[0], point.blockBytes)) {
+            error("Unable to read block from container.");
+        }
+        decoded.clear();
+        decodeBlock(block, 0, decoded, _checksums);
+        if (decoded.size() != point.rawSize) {
+            error("Block does not match the container index.");
+        }
+
+        /* A damaged index can place the range outside the block it picked. */
+        uint64_t skip = offset + result.size() - point.rawOffset;
+        if (offset + result.size() < point.rawOffset || skip > decoded.size()) {
+            error("Block does not match the container index.");
+        }
+        result.append(decoded, skip, min<uint64_t>(length - result.size(), decoded.size() - skip));
+    }
+    return result;
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+namespace {
+    /* Letters drawn at random, about as often as in English, so that a code
+     * per byte shrinks them but no longer string repeats often.
+     */
+    string weightedLetters(size_t size, unsigned seed) {
+        const string letters = "eeeeeeeetttttaaaaooooiiinnnsshhrrdlcumwfgypbvk  \n";
+        mt19937 random(seed);
+        string text;
+        while (text.size() < size) {
+            text += letters[random() % letters.size()];
+        }
+        return text;
+    }
+
+    /* The method each block of a container was coded with, in order. */
+    vector<BlockMethod> blockMethods(const string& container) {
+        vector<BlockMethod> methods;
+        for (size_t start: scanContainer(container).blockStarts) {
+            methods.push_back(BlockMethod(container[start]));
+        }
+        return methods;
+    }
+
+    /* A container of one block with the given header fields and payload. */
+    string oneBlock(BlockMethod method, uint64_t rawSize, const string& payload) {
+        string data = containerHeader(ContainerOptions());
+        data += char(method);
+        putVarint(data, rawSize);
+        putVarint(data, payload.size());
+        data += payload;
+        data += char(kEndOfBlocks);
+        return data;
+    }
+}
+
+STUDENT_TEST("Containers round-trip empty, text and binary input at any block size") {
+    vector<string> inputs = {
+        "", "a", string(1000, 'z'), weightedLetters(5000, 1), randomBytes(3000, 2),
+        weightedLetters(2000, 3) + randomBytes(2000, 4)
+    };
+    for (size_t blockSize: { size_t(1), size_t(7), size_t(1000), kDefaultBlockSize }) {
+        for (const string& text: inputs) {
+            ContainerOptions options;
+            options.blockSize = blockSize;
+            string data = compressContainer(text, options);
+            EXPECT(isContainer(data));
+            EXPECT_EQUAL(decompressContainer(data), text);
+            EXPECT_EQUAL(decompressContainer(data, 4), text);
+        }
+    }
+}
+
+STUDENT_TEST("The output does not depend on the number of threads") {
+    string text = weightedLetters(20000, 5) + randomBytes(5000, 6);
+    ContainerOptions options;
+    options.blockSize = 1024;
+    string oneThread = compressContainer(text, options);
+    options.threads = 4;
+    EXPECT_EQUAL(compressContainer(text, options), oneThread);
+}
+
+STUDENT_TEST("scanContainer finds every block and its size") {
+    string text = weightedLetters(2500, 7);
+    ContainerOptions options;
+    options.blockSize = 1000;
+    ContainerLayout layout = scanContainer(compressContainer(text, options));
+    EXPECT_EQUAL(layout.blockStarts.size(), size_t(3));
+    EXPECT(layout.rawSizes == vector<uint64_t>({ 1000, 1000, 500 }));
+    EXPECT(!layout.checksums);
+}
+
+STUDENT_TEST("Each block is stored, Huffman coded or codebook coded, whichever is smallest") {
+    EXPECT(blockMethods(compressContainer(randomBytes(4096, 8))) == vector<BlockMethod>({ BlockMethod::Stored }));
+    EXPECT(blockMethods(compressContainer(weightedLetters(65536, 9))) == vector<BlockMethod>({ BlockMethod::Huffman }));
+    string sentence = "It was the best of times, it was the worst of times, it was the age of wisdom.";
+    EXPECT(blockMethods(compressContainer(sentence)) == vector<BlockMethod>({ BlockMethod::Codebook }));
+}
+
+STUDENT_TEST("Blocks of one container may use different methods") {
+    string text = weightedLetters(65536, 10) + randomBytes(65536, 11);
+    ContainerOptions options;
+    options.blockSize = 65536;
+    string data = compressContainer(text, options);
+    EXPECT(blockMethods(data) == vector<BlockMethod>({ BlockMethod::Huffman, BlockMethod::Stored }));
+    EXPECT_EQUAL(decompressContainer(data), text);
+}
+
+STUDENT_TEST("Stored data grows by only a few bytes") {
+    string bytes = randomBytes(100000, 12);
+    EXPECT(compressContainer(bytes).size() < bytes.size() + 16);
+}
+
+STUDENT_TEST("Block sizes outside the allowed range are reported") {
+    ContainerOptions options;
+    options.blockSize = 0;
+    EXPECT_ERROR(checkContainerOptions(options));
+    EXPECT_ERROR(compressContainer("text", options));
+    options.blockSize = kMaxBlockSize + 1;
+    EXPECT_ERROR(checkContainerOptions(options));
+    options.blockSize = kMaxBlockSize;
+    EXPECT_NO_ERROR(checkContainerOptions(options));
+}
+
+STUDENT_TEST("Data that is not a container is reported") {
+    EXPECT(!isContainer(""));
+    EXPECT(!isContainer("not a container"));
+    EXPECT_ERROR(decompressContainer(""));
+    EXPECT_ERROR(decompressContainer("not a container"));
+    EXPECT_ERROR(scanContainer("not a container"));
+}
+
+STUDENT_TEST("Truncated containers are reported") {
+    string data = compressContainer(weightedLetters(3000, 13));
+    for (size_t size = 0; size < data.size(); size++) {
+        EXPECT_ERROR(decompressContainer(data.substr(0, size)));
+    }
+}
+
+STUDENT_TEST("Damaged block headers are reported") {
+    EXPECT_EQUAL(decompressContainer(oneBlock(BlockMethod::Stored, 2, "ab")), "ab");
+    EXPECT_ERROR(decompressContainer(oneBlock(BlockMethod::Stored, 3, "ab")));
+    EXPECT_ERROR(decompressContainer(oneBlock(BlockMethod(0x7F), 2, "ab")));
+    EXPECT_ERROR(decompressContainer(oneBlock(BlockMethod::Codebook, 2, "")));
+    EXPECT_ERROR(decompressContainer(oneBlock(BlockMethod::Codebook, 2, string(1, char(99)) + "ab")));
+
+    /* A block claiming more than kMaxBlockSize bytes is refused before
+     * anything is allocated for it. */
+    string data = containerHeader(ContainerOptions());
+    data += char(BlockMethod::Huffman);
+    data += "\x80\x80\x80\x80\x01";
+    data += '\0';
+    data += char(kEndOfBlocks);
+    EXPECT_ERROR(decompressContainer(data));
+    EXPECT_ERROR(scanContainer(data));
+}
+
+STUDENT_TEST("Damaged coded bytes are reported or decode to the stated size") {
+    string data = compressContainer(weightedLetters(3000, 14));
+    for (size_t i = scanContainer(data).blockStarts[0]; i + 1 < data.size(); i++) {
+        string damaged = data;
+        damaged[i] ^= 0x10;
+        try {
+            string text = decompressContainer(damaged);
+            EXPECT_EQUAL(text.size(), size_t(scanContainer(damaged).rawSizes[0]));
+        } catch (ErrorException&) {
+            /* Reporting the damage is just as good. */
+        }
+    }
+}
+
+STUDENT_TEST("Codes built from a sample still code bytes the sample missed") {
+    /* Sample runs start at multiples of the stride, so these bytes, a little
+     * past the start of the input's second half, are never sampled. */
+    string text = weightedLetters(200000, 15);
+    for (int ch = 0; ch < 256; ch += 3) {
+        text[100000 + 100 + ch] = char(ch);
+    }
+    ContainerOptions options;
+    options.histogramSampleBytes = 4096;
+    string data = compressContainer(text, options);
+    EXPECT_EQUAL(decompressContainer(data), text);
+    EXPECT(blockMethods(data) == vector<BlockMethod>({ BlockMethod::Huffman }));
+    EXPECT(data.size() < compressContainer(text).size() * 1.05);
+}
+
+STUDENT_TEST("Sampled codes are used only for blocks larger than the sample") {
+    string text = weightedLetters(3000, 16);
+    ContainerOptions options;
+    options.histogramSampleBytes = 4096;
+    EXPECT_EQUAL(compressContainer(text, options), compressContainer(text));
+}
+
+STUDENT_TEST("Blocks with repeated strings are coded with LZ77 when enabled") {
+    string text;
+    for (int i = 0; i < 500; i++) {
+        text += "<record id=\"" + to_string(i % 7) + "\">" + weightedLetters(6, i % 5) + "</record>\n";
+    }
+    ContainerOptions options;
+    options.lzLevel = kLzDefaultLevel;
+    string data = compressContainer(text, options);
+    EXPECT(blockMethods(data) == vector<BlockMethod>({ BlockMethod::Lz77 }));
+    EXPECT_EQUAL(decompressContainer(data), text);
+    EXPECT(data.size() < compressContainer(text).size() / 2);
+
+    options.lzLevel = kLzMaxLevel + 1;
+    EXPECT_ERROR(compressContainer(text, options));
+}
+
+STUDENT_TEST("Random-looking blocks are stored whatever methods are enabled") {
+    ContainerOptions options;
+    options.lzLevel = kLzMaxLevel;
+    options.rle = true;
+    options.bwt = true;
+    options.contexts = true;
+    string bytes = randomBytes(1 << 20, 17);
+    string data = compressContainer(bytes, options);
+    EXPECT(blockMethods(data) == vector<BlockMethod>({ BlockMethod::Stored }));
+    EXPECT_EQUAL(decompressContainer(data), bytes);
+}
+
+STUDENT_TEST("Blocks with runs are run-length coded when enabled") {
+    string text;
+    for (int i = 0; i < 200; i++) {
+        text += weightedLetters(20, i) + string(300 + i, '\0');
+    }
+    ContainerOptions options;
+    options.rle = true;
+    string data = compressContainer(text, options);
+    EXPECT(blockMethods(data) == vector<BlockMethod>({ BlockMethod::Rle }));
+    EXPECT_EQUAL(decompressContainer(data), text);
+    EXPECT(data.size() < compressContainer(text).size() / 4);
+}
+
+STUDENT_TEST("A small block claiming a huge run is refused") {
+    string payload;
+    string zeros(100000, '\0');
+    EXPECT(encodeRle(zeros.data(), zeros.size(), payload));
+    EXPECT_EQUAL(decompressContainer(oneBlock(BlockMethod::Rle, zeros.size(), payload)), zeros);
+    EXPECT_ERROR(decompressContainer(oneBlock(BlockMethod::Rle, kMaxBlockSize + 1, payload)));
+}
+
+STUDENT_TEST("Text blocks are coded with the Burrows-Wheeler transform when enabled") {
+    string text;
+    for (int i = 0; i < 300; i++) {
+        text += "the " + weightedLetters(5, i % 11) + " of the " + weightedLetters(4, i % 13) + ", ";
+    }
+    ContainerOptions options;
+    options.bwt = true;
+    string data = compressContainer(text, options);
+    EXPECT(blockMethods(data) == vector<BlockMethod>({ BlockMethod::Bwt }));
+    EXPECT_EQUAL(decompressContainer(data), text);
+}
+
+STUDENT_TEST("Blocks whose bytes predict the next are context coded when enabled") {
+    /* Each letter is followed by one of two letters, so the byte before
+     * halves the choices. */
+    string text;
+    mt19937 random(18);
+    char ch = 'a';
+    while (text.size() < 50000) {
+        text += ch;
+        ch = char('a' + (ch - 'a' + 1 + random() % 2 * 13) % 26);
+    }
+    ContainerOptions options;
+    options.contexts = true;
+    string data = compressContainer(text, options);
+    EXPECT(blockMethods(data) == vector<BlockMethod>({ BlockMethod::Context }));
+    EXPECT_EQUAL(decompressContainer(data), text);
+}
+
+STUDENT_TEST("Blocks dominated by one byte value are tANS coded when enabled") {
+    string text;
+    mt19937 random(19);
+    while (text.size() < 50000) {
+        text += (random() % 50 == 0) ? char('a' + random() % 4) : '.';
+    }
+    ContainerOptions options;
+    options.ans = true;
+    string data = compressContainer(text, options);
+    EXPECT(blockMethods(data) == vector<BlockMethod>({ BlockMethod::Ans }));
+    EXPECT_EQUAL(decompressContainer(data), text);
+    EXPECT(data.size() < compressContainer(text).size() / 2);
+}
+
+STUDENT_TEST("Blocks of 16-bit samples are wide coded when enabled") {
+    string text;
+    mt19937 random(20);
+    for (int i = 0; i < 30000; i++) {
+        int sample = int(random() % 1500);
+        text += char(sample & 0xFF);
+        text += char(sample >> 8);
+    }
+    ContainerOptions options;
+    options.wide = true;
+    string data = compressContainer(text, options);
+    EXPECT(blockMethods(data) == vector<BlockMethod>({ BlockMethod::Wide }));
+    EXPECT_EQUAL(decompressContainer(data), text);
+}
+
+STUDENT_TEST("Huffman blocks are coded as interleaved streams when enabled") {
+    string text = weightedLetters(65536, 21);
+    ContainerOptions options;
+    options.interleaved = true;
+    string data = compressContainer(text, options);
+    EXPECT(blockMethods(data) == vector<BlockMethod>({ BlockMethod::Interleaved }));
+    EXPECT_EQUAL(decompressContainer(data), text);
+    EXPECT_EQUAL(decompressContainer(data, 4), text);
+    EXPECT(data.size() < compressContainer(text).size() + kInterleavedOverheadBytes + 8);
+}
+
+STUDENT_TEST("Checksums catch blocks that decode to the wrong bytes") {
+    /* Stored blocks decode to whatever they hold, so only the checksum can
+     * tell that a byte has changed. */
+    ContainerOptions options;
+    options.checksums = true;
+    options.blockSize = 1000;
+    string text = randomBytes(3000, 21);
+    string data = compressContainer(text, options);
+    ContainerLayout layout = scanContainer(data);
+    EXPECT(layout.checksums);
+    EXPECT_EQUAL(decompressContainer(data), text);
+
+    for (size_t start: layout.blockStarts) {
+        string damaged = data;
+        damaged[start + 10] ^= 1;
+        EXPECT_ERROR(decompressContainer(damaged));
+        string block;
+        EXPECT_ERROR(decodeBlock(damaged, start, block, true));
+        EXPECT_NO_ERROR(decodeBlock(damaged, start, block, false));
+    }
+}
+
+STUDENT_TEST("Blocks coded from a sample carry the right checksums") {
+    /* Without a full histogram the checksum is taken while the block is coded
+     * or stored, over several chunks for blocks this large. */
+    ContainerOptions options;
+    options.checksums = true;
+    options.histogramSampleBytes = 4096;
+    options.blockSize = 100000;
+    string text = weightedLetters(100000, 23) + randomBytes(100000, 24);
+    string data = compressContainer(text, options);
+    EXPECT(blockMethods(data) == vector<BlockMethod>({ BlockMethod::Huffman, BlockMethod::Stored }));
+    EXPECT_EQUAL(decompressContainer(data), text);
+}
+
+STUDENT_TEST("readRange returns every range, with and without an index") {
+    string text = weightedLetters(700, 22);
+    for (bool index: { false, true }) {
+        for (size_t blockSize: { size_t(1), size_t(7), size_t(100), kDefaultBlockSize }) {
+            ContainerOptions options;
+            options.index = index;
+            options.checksums = blockSize == 7;
+            options.blockSize = blockSize;
+            istringstream in(compressContainer(text, options));
+            ContainerReader reader(in);
+            EXPECT_EQUAL(reader.size(), uint64_t(text.size()));
+            for (size_t offset = 0; offset <= text.size(); offset += 37) {
+                for (size_t length: { size_t(0), size_t(1), size_t(6), size_t(99), size_t(250) }) {
+                    length = min(length, text.size() - offset);
+                    EXPECT_EQUAL(reader.readRange(offset, length), text.substr(offset, length));
+                }
+            }
+            EXPECT_EQUAL(reader.readRange(0, text.size()), text);
+        }
+    }
+}
+
+STUDENT_TEST("readRange reports ranges past the end of the data") {
+    string text = weightedLetters(500, 23);
+    ContainerOptions options;
+    options.index = true;
+    options.blockSize = 100;
+    istringstream in(compressContainer(text, options));
+    ContainerReader reader(in);
+    EXPECT_EQUAL(reader.readRange(text.size(), 0), "");
+    EXPECT_ERROR(reader.readRange(text.size(), 1));
+    EXPECT_ERROR(reader.readRange(450, 51));
+    EXPECT_ERROR(reader.readRange(UINT64_MAX, 2));
+}
+
+STUDENT_TEST("An index adds to the end of a container and changes nothing else") {
+    string text = weightedLetters(500, 24);
+    ContainerOptions options;
+    options.blockSize = 64;
+    string plain = compressContainer(text, options);
+    options.index = true;
+    string indexed = compressContainer(text, options);
+    EXPECT(indexed.size() > plain.size());
+    EXPECT_EQUAL(decompressContainer(indexed), text);
+    EXPECT(scanContainer(indexed).blockStarts == scanContainer(plain).blockStarts);
+}
+
+STUDENT_TEST("ContainerReader reports damaged containers and indexes") {
+    istringstream notContainer("not a container at all");
+    EXPECT_ERROR(ContainerReader reader(notContainer));
+
+    string text = weightedLetters(500, 25);
+    ContainerOptions options;
+    options.index = true;
+    options.blockSize = 100;
+    string data = compressContainer(text, options);
+
+    /* Damage to any byte of the index or its footer is found either when
+     * the reader opens the container or when it checks a block against it. */
+    size_t blocksEnd = data.size();
+    while (uint8_t(data[blocksEnd - 1]) != kEndOfBlocks) {
+        blocksEnd--;
+    }
+    for (size_t i = blocksEnd; i < data.size(); i++) {
+        string damaged = data;
+        damaged[i] ^= 0x01;
+        istringstream in(damaged);
+        EXPECT_ERROR(ContainerReader reader(in); reader.readRange(0, text.size()));
+    }
+
+    /* A container cut off anywhere. */
+    for (size_t size = 0; size < data.size(); size += 13) {
+        istringstream in(data.substr(0, size));
+        EXPECT_ERROR(ContainerReader reader(in); reader.readRange(0, text.size()));
+    }
+}
+
+STUDENT_TEST("readRange reports blocks that no longer match the index") {
+    string text = weightedLetters(500, 26);
+    ContainerOptions options;
+    options.index = true;
+    options.blockSize = 100;
+    string data = compressContainer(text, options);
+    ContainerLayout layout = scanContainer(data);
+
+    /* A damaged method byte leaves the index intact but the block wrong. */
+    string damaged = data;
+    damaged[layout.blockStarts[2]] = char(0x7F);
+    istringstream in(damaged);
+    ContainerReader reader(in);
+    EXPECT_EQUAL(reader.readRange(0, 200), text.substr(0, 200));
+    EXPECT_ERROR(reader.readRange(200, 100));
+}
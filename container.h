@@ -0,0 +1,228 @@
+#pragma once
+
+#include "entropy.h"
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+/**
+ * The container format splits a file into blocks and codes each block with
+ * whichever method makes it smallest. Unlike writeData, a block that Huffman
+ * coding cannot shrink (already-compressed or encrypted data) is stored as is,
+ * so such data never grows by more than a few bytes and is copied rather than
+ * coded in both directions.
+ *
+ * On disk:
+ *
+ * 4 bytes: magic header.
+ * 1 byte:  format version (1).
+ * 1 byte:  flags; bit 0 set if blocks carry checksums.
+ * blocks:  each one
+ *            1 byte:  method (a BlockMethod).
+ *            varint:  number of bytes the block decodes to.
+ *            varint:  number of payload bytes that follow.
+ *            payload.
+ *            4 bytes: CRC32C of the decoded bytes, little-endian, if blocks
+ *                     carry checksums.
+ * 1 byte:  kEndOfBlocks.
+ * index:   if bit 1 of the flags is set,
+ *            varint:  number of blocks.
+ *            varints: for each block, the number of bytes it decodes to and
+ *                     the number of bytes it takes up, header to checksum.
+ *            4 bytes: number of bytes in the index above, little-endian.
+ *            4 bytes: index trailer magic.
+ *
+ * Varints are little-endian base 128, seven bits per byte, with the high bit
+ * set on every byte but the last.
+ */
+
+/* How a block's payload is coded. These values are stored in files, so existing
+ * values must never change meaning.
+ */
+enum class BlockMethod : uint8_t {
+    Stored   = 0,   // the bytes themselves
+    Huffman  = 1,   // code lengths, then coded bytes
+    Codebook = 2,   // static codebook id, then coded bytes
+    Lz77     = 3,   // LZ77 literals and matches, see lz77.h
+    Rle      = 4,   // run-length coded bytes, see rle.h
+    Bwt      = 5,   // Burrows-Wheeler and move-to-front coded bytes, see bwt.h
+    Context  = 6,   // bytes coded by the byte before them, see context.h
+    Ans      = 7,   // tANS coded bytes, see ans.h
+    Wide     = 8,   // pairs of bytes coded as 16-bit symbols, see wide.h
+    Interleaved = 9,   // code lengths, then eight coded streams, see interleaved.h
+};
+
+/* Method byte that marks the end of the blocks. */
+const uint8_t kEndOfBlocks = 0xFF;
+
+/* Default number of input bytes per block. */
+const size_t kDefaultBlockSize = 1 << 20;
+
+/* Most bytes a block may decode to. Readers reject larger blocks before
+ * allocating anything for them, since a few bytes of RLE or BWT payload can
+ * otherwise claim gigabytes of output.
+ */
+const size_t kMaxBlockSize = size_t(1) << 27;
+
+/**
+ * Type holding the settings used when writing a container.
+ *
+ * Before a block is coded, a sample of sampleBytes of it is used to predict how
+ * well it will compress (see entropy.h). Blocks predicted to shrink by less
+ * than minPredictedGain are stored without further work; set it below zero to
+ * always try coding.
+ *
+ * If histogramSampleBytes is nonzero, larger blocks have their code built from
+ * a sample of that many bytes instead of from a full histogram, so each block
+ * is read once, to code it, rather than twice. Every byte value is given a
+ * code, so bytes the sample missed can still be coded. The code fits the block
+ * less well; on our test data that cost between 0.2% and 1.1% of output size.
+ *
+ * If ans is set, a tANS code (see ans.h) built from the same histogram is
+ * considered alongside the Huffman code. It comes closer to the entropy when a
+ * few byte values dominate.
+ *
+ * If lzLevel is nonzero, blocks are also tried with LZ77 at that level (see
+ * lz77.h), which finds repeated strings that per-byte codes cannot exploit.
+ * If rle is set, blocks are also tried with run-length coding (see rle.h),
+ * which codes a long run of one byte value in a couple of symbols. If bwt is
+ * set, blocks are also tried with the Burrows-Wheeler pipeline (see bwt.h),
+ * which is slower than the others but usually strongest on text. If contexts
+ * is set, blocks of at least kContextMinBlockSize bytes are also tried with a
+ * code per preceding byte (see context.h).
+ *
+ * If interleaved is set, blocks of up to kInterleavedMaxBlockSize bytes are
+ * Huffman coded as eight streams that decode side by side (see interleaved.h)
+ * instead of as one. The code is limited to shorter lengths and the streams
+ * add a few bytes, in return for decoding several times faster.
+ *
+ * The entropy sample can see neither repeated strings, runs, contexts nor
+ * pairs, so when any of these is enabled it skips only blocks whose sample
+ * looks random (see looksRandom in entropy.h), such as compressed or encrypted
+ * data, which none of them can shrink either.
+ *
+ * If checksums is set, each block carries a CRC32C of its bytes (see crc32c.h),
+ * and decompressContainer reports an error if a block decodes to anything
+ * else. The checksum is taken while the histogram is counted, so it costs very
+ * little compared to the coding itself.
+ *
+ * If index is set, the container ends with an index of its blocks, so that
+ * ContainerReader can find the blocks covering a range of the original data
+ * without reading the rest. Each block boundary is a point where decoding can
+ * start, so smaller blocks mean less to decode for each range read.
+ *
+ * Blocks are coded independently, so threads of them are coded at once; zero
+ * means one thread per hardware thread. The output does not depend on it.
+ */
+struct ContainerOptions {
+    size_t blockSize            = kDefaultBlockSize;
+    double minPredictedGain     = kDefaultMinPredictedGain;
+    size_t sampleBytes          = kDefaultSampleBytes;
+    size_t histogramSampleBytes = 0;
+    bool   ans                  = false;
+    int    lzLevel              = 0;
+    bool   rle                  = false;
+    bool   bwt                  = false;
+    bool   contexts             = false;
+    bool   wide                 = false;
+    bool   interleaved          = false;
+    bool   checksums            = false;
+    bool   index                = false;
+    int    threads              = 1;
+};
+
+/**
+ * Reports an error unless the options can be used to write a container: the
+ * block size must be between 1 and kMaxBlockSize.
+ */
+void checkContainerOptions(const ContainerOptions& options);
+
+/**
+ * Returns whether the data begins with the container magic header.
+ */
+bool isContainer(const std::string& data);
+
+/**
+ * Compresses text into a container, or decompresses a container back into the
+ * original text. decompressContainer reports an error if the data is not a
+ * valid container, and decodes threads blocks at once, as in ContainerOptions.
+ */
+std::string compressContainer(const std::string& text, const ContainerOptions& options = ContainerOptions());
+std::string decompressContainer(const std::string& data, int threads = 1);
+
+/**
+ * Appends one block holding size bytes of text to out, choosing the method
+ * that gives the smallest block, and its checksum if options.checksums is set.
+ */
+void encodeBlock(const char* text, size_t size, const ContainerOptions& options, std::string& out);
+
+/**
+ * The bytes that go before the first block and after the last one, for callers
+ * that code the blocks themselves with encodeBlock, such as the file pipeline
+ * in pipeline.h. rawSizes and blockBytes give the decoded and coded size of each
+ * block, and are used only if options.index is set.
+ */
+std::string containerHeader(const ContainerOptions& options);
+std::string containerTrailer(const ContainerOptions& options, const std::vector<uint64_t>& rawSizes,
+                             const std::vector<uint64_t>& blockBytes);
+
+/**
+ * Where each block of a container starts and how many bytes it decodes to,
+ * found and checked without decoding any, for callers that decode the blocks
+ * themselves with decodeBlock, such as decompressAsync in async.h. Reports an
+ * error if the data is not a valid container.
+ */
+struct ContainerLayout {
+    bool checksums = false;
+    std::vector<size_t> blockStarts;
+    std::vector<uint64_t> rawSizes;
+};
+
+ContainerLayout scanContainer(const std::string& data);
+
+/**
+ * Decodes the block starting at data[pos], appending its bytes to out, and
+ * returns the position just past the block. If checksums is set, the block is
+ * followed by a checksum, which is verified.
+ */
+size_t decodeBlock(const std::string& data, size_t pos, std::string& out, bool checksums = false);
+
+/**
+ * Type that reads ranges of the original data out of a container in a seekable
+ * stream, such as a file, decoding only the blocks that cover each range.
+ * Where each block starts is read from the container's index if it has one;
+ * otherwise the block headers are walked once, skipping their payloads.
+ *
+ *     ifstream in("log.huf", ios::binary);
+ *     ContainerReader reader(in);
+ *     string slice = reader.readRange(1 << 30, 4096);
+ */
+class ContainerReader {
+public:
+    explicit ContainerReader(std::istream& in);
+
+    /* Number of bytes the whole container decodes to. */
+    uint64_t size() const;
+
+    /* Returns length bytes starting at offset of the original data. Reports an
+     * error if the range extends past its end.
+     */
+    std::string readRange(uint64_t offset, uint64_t length);
+
+private:
+    /* A block boundary: where the block starts in the original data and in
+     * the container, and its size in each.
+     */
+    struct SyncPoint {
+        uint64_t rawOffset;
+        uint64_t filePos;
+        uint64_t rawSize;
+        uint64_t blockBytes;
+    };
+
+    std::istream& _in;
+    bool _checksums = false;
+    uint64_t _size = 0;
+    std::vector<SyncPoint> _syncPoints;
+};
@@ -0,0 +1,415 @@
+#include "context.h"
+#include "bitstream.h"
+#include "codetable.h"
+#include "entropy.h"
+#include "error.h"
+#include <bit>
+#include <cmath>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+#include "testutil.h"
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * Order-1 context modeling of blocks. The public interface is provided in
+ * context.h header file.
+ *
+ * The payload holds the number of clusters less one (5 bits), the cluster of
+ * each of the 256 contexts (just enough bits each for the number of clusters),
+ * the code lengths of each cluster, and then the coded bytes. The first byte of
+ * a block is coded in the context of a zero byte.
+ */
+
+namespace {
+    const int kClusterCountBits = 5;
+
+    /* count * log2(count), the term each byte value adds to a code's cost.
+     * Most counts are small, and looking those up saves a log2 call each.
+     */
+    double countLogCount(uint64_t count) {
+        static const vector<double> small = []() {
+            vector<double> table(4096, 0);
+            for (size_t i = 1; i < table.size(); i++) {
+                table[i] = double(i) * log2(double(i));
+            }
+            return table;
+        }();
+        return count < small.size() ? small[count] : double(count) * log2(double(count));
+    }
+
+    /**
+     * Estimates the bits needed to code a cluster's bytes with a code of their
+     * own: the order-0 entropy, total * log2(total) less the sum of
+     * count * log2(count), plus the code lengths written for them.
+     */
+    double clusterCost(uint64_t total, double countLogCounts, size_t present) {
+        return countLogCount(total) - countLogCounts + 256 + 4 * double(present);
+    }
+
+    /* The count of a byte value that occurs in a cluster. */
+    struct ByteCount {
+        uint64_t count;
+        double term;   // countLogCount(count)
+    };
+
+    /**
+     * A group of contexts sharing one code. The bytes that occur are kept in
+     * order, with a bit set for each in present, along with the sum of
+     * countLogCount over them. So the cost of merging two clusters needs only
+     * the bytes they have in common, found by intersecting the bit sets.
+     */
+    struct Cluster {
+        uint64_t present[4] = {};
+        int before[4] = {};   // bytes present in the earlier words
+        vector<ByteCount> bytes;
+        uint64_t total = 0;
+        double countLogCounts = 0;
+        double cost = 0;
+        int version = 0;   // bumped on every merge, to spot stale candidates
+        bool merged = false;
+
+        /* The entry for byte bit of word, which must be present. */
+        const ByteCount& at(int word, int bit) const {
+            return bytes[before[word] + popcount(present[word] & ((uint64_t(1) << bit) - 1))];
+        }
+
+        void add(int ch, uint64_t count) {
+            present[ch / 64] |= uint64_t(1) << (ch % 64);
+            ByteCount entry = { count, countLogCount(count) };
+            bytes.push_back(entry);
+            total += count;
+            countLogCounts += entry.term;
+        }
+
+        void finish() {
+            for (int word = 1; word < 4; word++) {
+                before[word] = before[word - 1] + popcount(present[word - 1]);
+            }
+            cost = clusterCost(total, countLogCounts, bytes.size());
+        }
+    };
+
+    /* The increase in cost from giving two clusters one code. */
+    double mergeCost(const Cluster& a, const Cluster& b) {
+        double countLogCounts = a.countLogCounts + b.countLogCounts;
+        size_t present = a.bytes.size() + b.bytes.size();
+        for (int word = 0; word < 4; word++) {
+            for (uint64_t common = a.present[word] & b.present[word]; common != 0; common &= common - 1) {
+                int bit = countr_zero(common);
+                const ByteCount& x = a.at(word, bit);
+                const ByteCount& y = b.at(word, bit);
+                countLogCounts += countLogCount(x.count + y.count) - x.term - y.term;
+                present--;
+            }
+        }
+        return clusterCost(a.total + b.total, countLogCounts, present) - a.cost - b.cost;
+    }
+
+    /* Adds the counts of from into into. */
+    void mergeInto(Cluster& into, Cluster& from) {
+        Cluster both;
+        for (int ch = 0; ch < 256; ch++) {
+            int word = ch / 64, bit = ch % 64;
+            uint64_t count = 0;
+            if (into.present[word] >> bit & 1) count += into.at(word, bit).count;
+            if (from.present[word] >> bit & 1) count += from.at(word, bit).count;
+            if (count != 0) both.add(ch, count);
+        }
+        both.finish();
+        both.version = into.version + 1;
+        into = move(both);
+        from.merged = true;
+    }
+
+    /* A pair of clusters that could be merged, as of the given versions. */
+    struct MergeCandidate {
+        double cost;
+        int i, j;
+        int versionI, versionJ;
+
+        /* Orders the cheapest merge first in a priority_queue. */
+        bool operator <(const MergeCandidate& other) const {
+            if (cost != other.cost) return cost > other.cost;
+            return make_pair(i, j) > make_pair(other.i, other.j);
+        }
+    };
+
+    /* Bits needed to write a cluster number below count. */
+    int clusterBits(int count) {
+        int bits = 0;
+        while ((1 << bits) < count) bits++;
+        return bits;
+    }
+
+    /**
+     * Makes a cluster for each context that occurs, and stores in owner the
+     * cluster of each context, or -1 for contexts that never occur.
+     */
+    vector<Cluster> contextClusters(const vector<uint64_t>& counts, vector<int>& owner) {
+        vector<Cluster> clusters;
+        owner.assign(256, -1);
+        for (int context = 0; context < 256; context++) {
+            const uint64_t* row = &counts[context * 256];
+            Cluster cluster;
+            for (int ch = 0; ch < 256; ch++) {
+                if (row[ch] != 0) cluster.add(ch, row[ch]);
+            }
+            if (cluster.total == 0) continue;
+            cluster.finish();
+            owner[context] = int(clusters.size());
+            clusters.push_back(move(cluster));
+        }
+        return clusters;
+    }
+
+    /**
+     * Groups the context clusters, greedily merging whichever two are cheapest
+     * to merge, until merging no longer pays and there are at most
+     * kMaxContextClusters. The candidate merges wait in a heap; those whose
+     * clusters have changed since are dropped when they come up. Returns the
+     * counts of each cluster and stores the cluster of each context in
+     * clusterOf; contexts that never occur are put in cluster 0.
+     */
+    vector<vector<uint64_t>> clusterContexts(vector<Cluster>& clusters, vector<int>& owner,
+                                             uint8_t clusterOf[256]) {
+        int n = int(clusters.size());
+        priority_queue<MergeCandidate> candidates;
+        for (int i = 0; i < n; i++) {
+            for (int j = i + 1; j < n; j++) {
+                candidates.push({ mergeCost(clusters[i], clusters[j]), i, j, 0, 0 });
+            }
+        }
+
+        for (int remaining = n; remaining > 1 && !candidates.empty(); ) {
+            MergeCandidate best = candidates.top();
+            candidates.pop();
+            Cluster& into = clusters[best.i];
+            Cluster& from = clusters[best.j];
+            if (into.merged || from.merged || into.version != best.versionI || from.version != best.versionJ) {
+                continue;
+            }
+            if (best.cost >= 0 && remaining <= kMaxContextClusters) break;
+
+            mergeInto(into, from);
+            remaining--;
+            for (int& context: owner) {
+                if (context == best.j) context = best.i;
+            }
+            for (int k = 0; k < n; k++) {
+                if (k == best.i || clusters[k].merged) continue;
+                int i = min(k, best.i), j = max(k, best.i);
+                candidates.push({ mergeCost(into, clusters[k]), i, j, clusters[i].version, clusters[j].version });
+            }
+        }
+
+        /* Number the surviving clusters from zero. */
+        vector<vector<uint64_t>> result;
+        vector<int> number(n, -1);
+        for (int i = 0; i < n; i++) {
+            if (clusters[i].merged) continue;
+            number[i] = int(result.size());
+            vector<uint64_t> counts(256, 0);
+            for (int ch = 0; ch < 256; ch++) {
+                if (clusters[i].present[ch / 64] >> (ch % 64) & 1) {
+                    counts[ch] = clusters[i].at(ch / 64, ch % 64).count;
+                }
+            }
+            result.push_back(counts);
+        }
+        for (int context = 0; context < 256; context++) {
+            clusterOf[context] = owner[context] < 0 ? 0 : uint8_t(number[owner[context]]);
+        }
+        return result;
+    }
+}
+
+bool encodeContextModel(const char* text, size_t size, uint64_t maxBytes, string& out) {
+    if (size == 0) {
+        error("Cannot context-code an empty block.");
+    }
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(text);
+
+    /* counts[context * 256 + byte] */
+    vector<uint64_t> counts(256 * 256, 0);
+    uint8_t previous = 0;
+    for (size_t i = 0; i < size; i++) {
+        counts[previous * 256 + bytes[i]]++;
+        previous = bytes[i];
+    }
+
+    /* Merging contexts only adds to the order-1 entropy, so it bounds the
+     * payload from below. Clustering is skipped if that bound is not well
+     * under maxBytes.
+     */
+    vector<int> owner;
+    vector<Cluster> contexts = contextClusters(counts, owner);
+    double orderOneBits = kClusterCountBits;
+    for (const Cluster& context: contexts) {
+        orderOneBits += countLogCount(context.total) - context.countLogCounts;
+    }
+    if (orderOneBits / 8 >= double(maxBytes) * (1 - kContextMinGain)) return false;
+
+    uint8_t clusterOf[256];
+    vector<vector<uint64_t>> clusters = clusterContexts(contexts, owner, clusterOf);
+    int numClusters = int(clusters.size());
+
+    size_t start = out.size();
+    vector<SymbolCode> codes;
+    BitStreamWriter writer(out);
+    writer.put(numClusters - 1, kClusterCountBits);
+    int bits = clusterBits(numClusters);
+    for (int context = 0; context < 256; context++) {
+        writer.put(clusterOf[context], bits);
+    }
+    for (const vector<uint64_t>& cluster: clusters) {
+        vector<uint8_t> lengths = codeLengthsFromCounts(cluster, kMaxBlockCodeLength);
+        writeCodeLengths(writer, lengths);
+        codes.push_back(canonicalSymbolCode(lengths));
+    }
+
+    /* Point each context straight at its code, saving a lookup per byte. */
+    const SymbolCode* codeFor[256];
+    for (int context = 0; context < 256; context++) {
+        codeFor[context] = &codes[clusterOf[context]];
+    }
+    previous = 0;
+    for (size_t i = 0; i < size; i++) {
+        const SymbolCode& code = *codeFor[previous];
+        writer.put(code.bits[bytes[i]], code.length[bytes[i]]);
+        previous = bytes[i];
+    }
+    writer.flush();
+    if (out.size() - start >= maxBytes) {
+        out.resize(start);
+        return false;
+    }
+    return true;
+}
+
+void decodeContextModel(const char* payload, size_t payloadSize, char* out, size_t size) {
+    BitStreamReader reader(payload, payloadSize);
+    int numClusters = int(reader.get(kClusterCountBits)) + 1;
+    int bits = clusterBits(numClusters);
+    uint8_t clusterOf[256];
+    for (int context = 0; context < 256; context++) {
+        uint32_t cluster = reader.get(bits);
+        if (cluster >= uint32_t(numClusters)) {
+            error("Invalid context cluster in block.");
+        }
+        clusterOf[context] = uint8_t(cluster);
+    }
+
+    vector<TableDecoder> decoders;
+    decoders.reserve(numClusters);
+    for (int i = 0; i < numClusters; i++) {
+        decoders.push_back(TableDecoder(readCodeLengths(reader, 256)));
+    }
+    const TableDecoder* decoderFor[256];
+    for (int context = 0; context < 256; context++) {
+        decoderFor[context] = &decoders[clusterOf[context]];
+    }
+
+    uint8_t previous = 0;
+    for (size_t i = 0; i < size; i++) {
+        previous = uint8_t(decoderFor[previous]->decode(reader));
+        out[i] = char(previous);
+    }
+    reader.checkNotOverrun();
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+namespace {
+    string encodedContexts(const string& text) {
+        string payload;
+        encodeContextModel(text.data(), text.size(), UINT64_MAX, payload);
+        return payload;
+    }
+
+    string decodedContexts(const string& payload, size_t size) {
+        string text(size, '\0');
+        decodeContextModel(payload.data(), payload.size(), &text[0], size);
+        return text;
+    }
+
+    /* Bytes that each say which byte comes next: every letter is followed by
+     * the next letter of the alphabet, or by a space.
+     */
+    string predictableText(size_t size, unsigned seed) {
+        mt19937 random(seed);
+        string text;
+        char ch = 'a';
+        while (text.size() < size) {
+            text += ch;
+            ch = (ch == ' ' || random() % 8 == 0) ? char('a' + random() % 26) : (ch == 'z' ? ' ' : char(ch + 1));
+        }
+        return text;
+    }
+}
+
+STUDENT_TEST("Context coding round-trips blocks with few and many contexts") {
+    string allBytes;
+    for (int ch = 0; ch < 256; ch++) {
+        allBytes += char(ch);
+    }
+    vector<string> inputs = {
+        "a", "ab", string(1000, 'q'), allBytes, predictableText(20000, 1), randomBytes(20000, 2)
+    };
+    for (const string& text: inputs) {
+        EXPECT_EQUAL(decodedContexts(encodedContexts(text), text.size()), text);
+    }
+}
+
+STUDENT_TEST("Context coding refuses empty blocks") {
+    EXPECT_ERROR(encodedContexts(""));
+}
+
+STUDENT_TEST("Context coding beats any single code on predictable text") {
+    string text = predictableText(50000, 3);
+    double orderZeroBytes = estimateCompression(text, text.size()).entropyBits * text.size() / 8;
+    EXPECT(encodedContexts(text).size() < orderZeroBytes / 2);
+}
+
+STUDENT_TEST("Context coding turns down blocks it cannot shrink enough") {
+    string text = randomBytes(20000, 6);
+    string payload = "kept";
+    EXPECT(!encodeContextModel(text.data(), text.size(), text.size(), payload));
+    EXPECT_EQUAL(payload, "kept");
+
+    /* Coding that would not come in under maxBytes writes nothing either. */
+    string predictable = predictableText(20000, 7);
+    size_t codedSize = encodedContexts(predictable).size();
+    EXPECT(!encodeContextModel(predictable.data(), predictable.size(), codedSize, payload));
+    EXPECT_EQUAL(payload, "kept");
+    EXPECT(encodeContextModel(predictable.data(), predictable.size(), codedSize + 1, payload));
+    EXPECT_EQUAL(payload.size(), codedSize + 4);
+}
+
+STUDENT_TEST("Truncated context payloads are reported") {
+    string text = predictableText(3000, 4);
+    string payload = encodedContexts(text);
+    for (size_t size = 0; size < payload.size(); size++) {
+        EXPECT_ERROR(decodedContexts(payload.substr(0, size), text.size()));
+    }
+}
+
+STUDENT_TEST("Damaged context payloads never write past the block") {
+    string text = predictableText(3000, 5);
+    string payload = encodedContexts(text);
+    const size_t guard = 64;
+    for (size_t i = 0; i < payload.size(); i++) {
+        string damaged = payload;
+        damaged[i] ^= 0x24;
+        string out(text.size() + guard, '#');
+        try {
+            decodeContextModel(damaged.data(), damaged.size(), &out[0], text.size());
+        } catch (ErrorException&) {
+            /* Reporting the damage is expected. */
+        }
+        EXPECT_EQUAL(out.substr(text.size()), string(guard, '#'));
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Order-1 context modeling, used by the container for its Context block
+ * method. A single Huffman code gives each byte value the same code wherever
+ * it appears, but in text and structured data the byte before says a lot about
+ * the byte that comes next: after 'q' comes 'u', after '<' comes a tag name.
+ * This method codes each byte with a code chosen by the byte before it.
+ *
+ * One code per preceding byte would need 256 sets of code lengths, more than a
+ * block can afford, and most contexts are too rare to fill a code well. So
+ * contexts whose byte statistics are alike are merged into clusters that share
+ * a code, for as long as merging saves more in code lengths than it costs in
+ * coded bytes. At most kMaxContextClusters codes are kept. Decoding is still
+ * one table lookup per byte; only the table changes from byte to byte.
+ */
+
+const int kMaxContextClusters = 32;
+
+/* Blocks smaller than this spread too few bytes over the contexts to pay for
+ * the codes, so the container does not try them.
+ */
+const size_t kContextMinBlockSize = 4096;
+
+/* Contexts are clustered only if their order-1 entropy promises a payload at
+ * least this fraction smaller than the one to beat.
+ */
+const double kContextMinGain = 0.02;
+
+/**
+ * Codes size bytes of text, appending the payload to out, if it takes fewer
+ * than maxBytes bytes. Returns whether the payload was written. Blocks whose
+ * order-1 entropy shows they cannot gain enough are turned down before any
+ * contexts are clustered.
+ */
+bool encodeContextModel(const char* text, size_t size, uint64_t maxBytes, std::string& out);
+
+/**
+ * Decodes a payload written by encodeContextModel into exactly size bytes at
+ * out. Reports an error if the payload is malformed.
+ */
+void decodeContextModel(const char* payload, size_t payloadSize, char* out, size_t size);
@@ -0,0 +1,187 @@
+#include "crc32c.h"
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+#include <string>
+#include "SimpleTest.h"
+
+/**
+ * CRC32C implementations and the choice between them. The public interface is
+ * provided in crc32c.h header file.
+ *
+ * Every implementation works on the bit-inverted CRC, which crc32c inverts on
+ * the way in and out.
+ */
+
+namespace {
+    /* The Castagnoli polynomial, bit-reversed. */
+    const uint32_t kPolynomial = 0x82F63B78;
+
+    typedef uint32_t (*CrcFunction)(uint32_t crc, const uint8_t* data, size_t size);
+
+    /**
+     * Tables for processing eight bytes at a time ("slicing by 8"): entry
+     * [k][b] is the CRC of byte b followed by k zero bytes.
+     */
+    struct CrcTables {
+        uint32_t table[8][256];
+
+        CrcTables() {
+            for (int b = 0; b < 256; b++) {
+                uint32_t crc = b;
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = (crc >> 1) ^ ((crc & 1) ? kPolynomial : 0);
+                }
+                table[0][b] = crc;
+            }
+            for (int k = 1; k < 8; k++) {
+                for (int b = 0; b < 256; b++) {
+                    uint32_t prev = table[k - 1][b];
+                    table[k][b] = (prev >> 8) ^ table[0][prev & 0xFF];
+                }
+            }
+        }
+    };
+
+    uint32_t softwareCrc(uint32_t crc, const uint8_t* data, size_t size) {
+        static const CrcTables tables;
+        const uint32_t (*t)[256] = tables.table;
+        while (size >= 8) {
+            uint32_t low, high;
+            memcpy(&low, data, 4);       // assumes little-endian
+            memcpy(&high, data + 4, 4);
+            low ^= crc;
+            crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^
+                  t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+                  t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^
+                  t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+            data += 8;
+            size -= 8;
+        }
+        while (size-- > 0) {
+            crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xFF];
+        }
+        return crc;
+    }
+
+#if defined(__x86_64__)
+    __attribute__((target("sse4.2")))
+    uint32_t hardwareCrc(uint32_t crc, const uint8_t* data, size_t size) {
+        uint64_t wide = crc;
+        while (size >= 8) {
+            uint64_t word;
+            memcpy(&word, data, sizeof word);
+            wide = _mm_crc32_u64(wide, word);
+            data += 8;
+            size -= 8;
+        }
+        crc = uint32_t(wide);
+        while (size-- > 0) {
+            crc = _mm_crc32_u8(crc, *data++);
+        }
+        return crc;
+    }
+
+    bool hardwareAvailable() {
+        return __builtin_cpu_supports("sse4.2");
+    }
+#elif defined(__aarch64__)
+#if defined(__clang__)
+    __attribute__((target("crc")))
+#else
+    __attribute__((target("+crc")))
+#endif
+    uint32_t hardwareCrc(uint32_t crc, const uint8_t* data, size_t size) {
+        while (size >= 8) {
+            uint64_t word;
+            memcpy(&word, data, sizeof word);
+            crc = __crc32cd(crc, word);
+            data += 8;
+            size -= 8;
+        }
+        while (size-- > 0) {
+            crc = __crc32cb(crc, *data++);
+        }
+        return crc;
+    }
+
+    bool hardwareAvailable() {
+#if defined(__APPLE__)
+        return true;
+#elif defined(__linux__)
+        return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+        return false;
+#endif
+    }
+#else
+    uint32_t hardwareCrc(uint32_t crc, const uint8_t* data, size_t size) {
+        return softwareCrc(crc, data, size);
+    }
+
+    bool hardwareAvailable() {
+        return false;
+    }
+#endif
+
+    CrcFunction chosenCrc() {
+        static const CrcFunction chosen = hardwareAvailable() ? hardwareCrc : softwareCrc;
+        return chosen;
+    }
+}
+
+uint32_t crc32c(const char* data, size_t size, uint32_t crc) {
+    return ~chosenCrc()(~crc, reinterpret_cast<const uint8_t*>(data), size);
+}
+
+bool crc32cAccelerated() {
+    return hardwareAvailable();
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("CRC32C matches published check values") {
+    /* From RFC 3720, appendix B.4. */
+    std::string zeros(32, '\0');
+    std::string ones(32, '\xFF');
+    std::string ascending;
+    for (int i = 0; i < 32; i++) {
+        ascending += char(i);
+    }
+    EXPECT_EQUAL(crc32c("123456789", 9), 0xE3069283U);
+    EXPECT_EQUAL(crc32c(zeros.data(), zeros.size()), 0x8A9136AAU);
+    EXPECT_EQUAL(crc32c(ones.data(), ones.size()), 0x62A8AB43U);
+    EXPECT_EQUAL(crc32c(ascending.data(), ascending.size()), 0x46DD794EU);
+    EXPECT_EQUAL(crc32c("", 0), 0U);
+}
+
+STUDENT_TEST("CRC32C of data in pieces matches the CRC32C of the whole") {
+    std::string data = "The quick brown fox jumps over the lazy dog, again and again.";
+    uint32_t whole = crc32c(data.data(), data.size());
+    for (size_t split = 0; split <= data.size(); split++) {
+        uint32_t crc = crc32c(data.data(), split);
+        EXPECT_EQUAL(crc32c(data.data() + split, data.size() - split, crc), whole);
+    }
+}
+
+STUDENT_TEST("Processor and table CRC32C agree at every length and alignment") {
+    std::string data;
+    for (int i = 0; i < 300; i++) {
+        data += char(i * 37 + 11);
+    }
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+    for (size_t start = 0; start < 8; start++) {
+        for (size_t size = 0; start + size <= data.size(); size += 7) {
+            EXPECT_EQUAL(hardwareCrc(~0U, bytes + start, size), softwareCrc(~0U, bytes + start, size));
+        }
+    }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * CRC32C (the Castagnoli polynomial used by iSCSI, ext4 and others), for
+ * checking that decompressed blocks match what was compressed.
+ *
+ * On x86-64 processors with SSE4.2 and ARMv8 processors with the CRC
+ * extension the dedicated instructions are used, checking eight bytes per
+ * instruction; elsewhere a table-driven version does the work. The choice is
+ * made once, at run time, so one build runs everywhere.
+ */
+
+/**
+ * Returns the CRC32C of size bytes of data. To checksum data in pieces, pass
+ * the result for the earlier pieces as crc.
+ *
+ *     crc32c("123456789", 9) == 0xE3069283
+ */
+uint32_t crc32c(const char* data, size_t size, uint32_t crc = 0);
+
+/**
+ * Returns whether crc32c uses processor instructions rather than tables.
+ */
+bool crc32cAccelerated();
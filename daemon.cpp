@@ -0,0 +1,568 @@
+#include "daemon.h"
+#include "error.h"
+#include "filelib.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <random>
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "testutil.h"
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * The compression service. The public interface is provided in daemon.h
+ * header file.
+ */
+
+#if defined(_WIN32)
+
+CompressionDaemon::CompressionDaemon(const string& socketPath, const ContainerOptions& options)
+    : _socketPath(socketPath), _options(options), _stopping(false), _listenFd(-1) {}
+
+CompressionDaemon::~CompressionDaemon() {}
+
+void CompressionDaemon::run() {
+    error("The compression service needs Unix domain sockets.");
+}
+
+void CompressionDaemon::stop() {}
+
+string daemonRequest(const string&, char, const string&) {
+    error("The compression service needs Unix domain sockets.");
+}
+
+#else
+
+namespace {
+    const size_t kFrameHeaderBytes = 9;
+
+#if defined(MSG_NOSIGNAL)
+    /* A client hanging up must not kill the service with SIGPIPE. */
+    const int kSendFlags = MSG_NOSIGNAL;
+#else
+    const int kSendFlags = 0;
+#endif
+
+    /* Sample coded once at startup, so tables built on first use are ready
+     * before the first client arrives.
+     */
+    const char kWarmupText[] =
+        "The quick brown fox jumps over the lazy dog. 0123456789 "
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa "
+        "{\"id\": 42, \"name\": \"sample\", \"tags\": [\"a\", \"b\"]}\n";
+
+    /* Reads exactly size bytes, or returns false if the peer hung up first. */
+    bool readFully(int fd, char* data, size_t size) {
+        while (size > 0) {
+            ssize_t got = recv(fd, data, size, 0);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            data += got;
+            size -= got;
+        }
+        return true;
+    }
+
+    bool writeFully(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t sent = send(fd, data, size, kSendFlags);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            data += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    void putFrameHeader(char* header, char code, uint64_t length) {
+        header[0] = code;
+        for (int i = 0; i < 8; i++) {
+            header[1 + i] = char(length >> (8 * i));
+        }
+    }
+
+    uint64_t frameLength(const char* header) {
+        uint64_t length = 0;
+        for (int i = 0; i < 8; i++) {
+            length |= uint64_t(uint8_t(header[1 + i])) << (8 * i);
+        }
+        return length;
+    }
+
+    bool writeFrame(int fd, char code, const string& data) {
+        char header[kFrameHeaderBytes];
+        putFrameHeader(header, code, data.size());
+        return writeFully(fd, header, sizeof header) && writeFully(fd, data.data(), data.size());
+    }
+
+    sockaddr_un socketAddress(const string& path) {
+        sockaddr_un address;
+        memset(&address, 0, sizeof address);
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof address.sun_path) {
+            error("Socket path " + path + " is too long.");
+        }
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return address;
+    }
+
+    /**
+     * Removes the socket at path if it was left behind by a service that has
+     * stopped, which is the case when nothing answers a connection to it.
+     * Reports an error if the path holds anything but a socket, or a socket
+     * something still listens on.
+     */
+    void removeStaleSocket(const string& path, const sockaddr_un& address) {
+        struct stat info;
+        if (lstat(path.c_str(), &info) < 0) {
+            if (errno == ENOENT) return;
+            error("Unable to check " + path + ": " + string(strerror(errno)));
+        }
+        if (!S_ISSOCK(info.st_mode)) {
+            error(path + " already exists and is not a socket.");
+        }
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            error("Unable to create socket: " + string(strerror(errno)));
+        }
+        int result = connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof address);
+        int reason = errno;
+        close(fd);
+        if (result == 0) {
+            error("Another service is already listening on " + path + ".");
+        }
+        if (reason != ECONNREFUSED) {
+            error("Unable to check " + path + ": " + string(strerror(reason)));
+        }
+        if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+            error("Unable to remove stale socket " + path + ": " + string(strerror(errno)));
+        }
+    }
+
+    /**
+     * Decompresses a container for a client, refusing one that claims to
+     * decode to more than kDaemonMaxResponseBytes before allocating anything.
+     */
+    string decompressRequest(const string& data) {
+        uint64_t total = 0;
+        for (uint64_t rawSize: scanContainer(data).rawSizes) {
+            total += rawSize;
+            if (total > kDaemonMaxResponseBytes) {
+                error("Decompressed data would be too large.");
+            }
+        }
+        return decompressContainer(data);
+    }
+}
+
+CompressionDaemon::CompressionDaemon(const string& socketPath, const ContainerOptions& options)
+    : _socketPath(socketPath), _options(options), _stopping(false), _listenFd(-1) {}
+
+CompressionDaemon::~CompressionDaemon() {
+    stop();
+}
+
+void CompressionDaemon::run() {
+    sockaddr_un address = socketAddress(_socketPath);
+    removeStaleSocket(_socketPath, address);
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        error("Unable to create socket: " + string(strerror(errno)));
+    }
+    if (::bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof address) < 0
+            || chmod(_socketPath.c_str(), S_IRUSR | S_IWUSR) < 0
+            || listen(listenFd, SOMAXCONN) < 0) {
+        string reason = strerror(errno);
+        close(listenFd);
+        error("Unable to listen on " + _socketPath + ": " + reason);
+    }
+
+    ContainerOptions warmup = _options;
+    warmup.threads = 1;
+    string sample(kWarmupText, sizeof kWarmupText - 1);
+    decompressContainer(compressContainer(sample, warmup));
+
+    _listenFd = listenFd;
+    size_t workers = workerCount(_options.threads, SIZE_MAX);
+    for (size_t i = 0; i < workers; i++) {
+        _workers.emplace_back(&CompressionDaemon::work, this);
+    }
+
+    while (!_stopping) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        lock_guard<mutex> guard(_lock);
+        _connections.push_back(fd);
+        thread(&CompressionDaemon::serveConnection, this, fd).detach();
+    }
+
+    /* Wake the connections blocked reading, and wait for them to finish. */
+    {
+        unique_lock<mutex> guard(_lock);
+        _stopping = true;
+        for (int fd: _connections) {
+            shutdown(fd, SHUT_RD);
+        }
+        _closed.wait(guard, [&]() { return _connections.empty(); });
+    }
+    _queued.notify_all();
+    for (thread& worker: _workers) {
+        worker.join();
+    }
+    _workers.clear();
+    close(listenFd);
+    _listenFd = -1;
+    unlink(_socketPath.c_str());
+}
+
+void CompressionDaemon::stop() {
+    _stopping = true;
+    int fd = _listenFd;
+    if (fd >= 0) {
+        shutdown(fd, SHUT_RDWR);
+    }
+}
+
+void CompressionDaemon::serveConnection(int fd) {
+    char header[kFrameHeaderBytes];
+    while (readFully(fd, header, sizeof header)) {
+        Job job;
+        job.op = header[0];
+        uint64_t length = frameLength(header);
+        if (job.op == 'Q') {
+            writeFrame(fd, 0, "");
+            stop();
+            break;
+        }
+        if (length > kDaemonMaxRequestBytes) {
+            writeFrame(fd, 1, "Request is too large.");
+            break;
+        }
+        job.data.resize(length);
+        if (!readFully(fd, &job.data[0], length)) break;
+
+        {
+            unique_lock<mutex> guard(_lock);
+            _queue.push_back(&job);
+            _queued.notify_one();
+            _finished.wait(guard, [&]() { return job.done; });
+        }
+        if (!writeFrame(fd, job.failed ? 1 : 0, job.data)) break;
+    }
+
+    close(fd);
+    lock_guard<mutex> guard(_lock);
+    _connections.erase(find(_connections.begin(), _connections.end(), fd));
+    _closed.notify_all();
+}
+
+void CompressionDaemon::work() {
+    vector<Job*> batch;
+    while (true) {
+        {
+            unique_lock<mutex> guard(_lock);
+            _queued.wait(guard, [&]() { return !_queue.empty() || (_stopping && _connections.empty()); });
+            if (_queue.empty()) return;
+
+            /* Take the first request whatever its size, then more while the
+             * batch stays small.
+             */
+            size_t bytes = 0;
+            batch.clear();
+            do {
+                bytes += _queue.front()->data.size();
+                batch.push_back(_queue.front());
+                _queue.pop_front();
+            } while (!_queue.empty() && batch.size() < kDaemonBatchRequests
+                     && bytes + _queue.front()->data.size() <= kDaemonBatchBytes);
+        }
+
+        for (Job* job: batch) {
+            runJob(*job);
+        }
+        {
+            lock_guard<mutex> guard(_lock);
+            for (Job* job: batch) {
+                job->done = true;
+            }
+        }
+        _finished.notify_all();
+    }
+}
+
+void CompressionDaemon::runJob(Job& job) {
+    try {
+        if (job.op == 'C') {
+            ContainerOptions options = _options;
+            options.threads = 1;
+            job.data = compressContainer(job.data, options);
+        } else if (job.op == 'D') {
+            job.data = decompressRequest(job.data);
+        } else {
+            error("Unknown request.");
+        }
+    } catch (ErrorException& e) {
+        job.failed = true;
+        job.data = e.getMessage();
+    } catch (exception& e) {
+        /* Out of memory, say: fail this request, not the whole service. */
+        job.failed = true;
+        job.data = "Request failed: " + string(e.what());
+    }
+}
+
+string daemonRequest(const string& socketPath, char op, const string& data) {
+    sockaddr_un address = socketAddress(socketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof address) < 0) {
+        string reason = strerror(errno);
+        if (fd >= 0) close(fd);
+        error("Unable to reach the service at " + socketPath + ": " + reason);
+    }
+
+    char header[kFrameHeaderBytes];
+    putFrameHeader(header, op, data.size());
+    bool ok = writeFully(fd, header, sizeof header) && writeFully(fd, data.data(), data.size())
+              && readFully(fd, header, sizeof header);
+    string response;
+    if (ok) {
+        response.resize(frameLength(header));
+        ok = readFully(fd, &response[0], response.size());
+    }
+    close(fd);
+    if (!ok) {
+        error("The service at " + socketPath + " hung up.");
+    }
+    if (header[0] != 0) {
+        error(response);
+    }
+    return response;
+}
+
+/* * * * * * Test Cases * * * * * */
+
+namespace {
+    /* A fresh temporary directory for a socket, removed when done. */
+    struct TestDirectory {
+        string path;
+
+        TestDirectory() {
+            char pattern[] = "/tmp/daemon-test-XXXXXX";
+            path = mkdtemp(pattern);
+        }
+
+        ~TestDirectory() {
+            rmdir(path.c_str());
+        }
+
+        string socketPath() const {
+            return path + "/service.sock";
+        }
+    };
+
+    /* A service running on its own thread for as long as this is in scope. */
+    class TestService {
+    public:
+        TestService(const string& path, const ContainerOptions& options = ContainerOptions())
+            : _path(path), _daemon(path, options) {
+            _runner = thread([this]() {
+                try {
+                    _daemon.run();
+                } catch (ErrorException& e) {
+                    _failure = e.getMessage();
+                }
+            });
+
+            /* Wait for the first answer, so run has finished starting up. */
+            auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+            while (true) {
+                try {
+                    daemonRequest(_path, 'C', "");
+                    return;
+                } catch (ErrorException&) {
+                    if (chrono::steady_clock::now() > deadline) throw;
+                    this_thread::sleep_for(chrono::milliseconds(5));
+                }
+            }
+        }
+
+        ~TestService() {
+            _daemon.stop();
+            _runner.join();
+        }
+
+        /* Waits for run to return, and returns any error it reported. */
+        string finish() {
+            _runner.join();
+            _runner = thread([]() {});
+            return _failure;
+        }
+
+    private:
+        string _path;
+        CompressionDaemon _daemon;
+        thread _runner;
+        string _failure;
+    };
+
+    string sampleText(size_t size) {
+        string text;
+        for (int i = 0; text.size() < size; i++) {
+            text += "request " + to_string(i % 100) + " of many; ";
+        }
+        return text.substr(0, size);
+    }
+}
+
+STUDENT_TEST("The service round-trips compress and decompress requests") {
+    TestDirectory directory;
+    string path = directory.socketPath();
+    ContainerOptions options;
+    options.blockSize = 65536;
+    {
+        TestService service(path, options);
+        ContainerOptions oneThread = options;
+        oneThread.threads = 1;
+        for (const string& text: { string(""), string("a"), sampleText(1000), sampleText(300000), randomBytes(100000, 1) }) {
+            string container = daemonRequest(path, 'C', text);
+            EXPECT_EQUAL(container, compressContainer(text, oneThread));
+            EXPECT_EQUAL(daemonRequest(path, 'D', container), text);
+        }
+    }
+    EXPECT(!fileExists(path));
+}
+
+STUDENT_TEST("The service answers many clients at once") {
+    TestDirectory directory;
+    string path = directory.socketPath();
+    ContainerOptions options;
+    options.threads = 3;
+    TestService service(path, options);
+    atomic<int> wrong(0);
+    vector<thread> clients;
+    for (int client = 0; client < 8; client++) {
+        clients.emplace_back([&, client]() {
+            for (int i = 0; i < 20; i++) {
+                string text = sampleText(100 + 50 * client + i);
+                try {
+                    if (daemonRequest(path, 'D', daemonRequest(path, 'C', text)) != text) wrong++;
+                } catch (ErrorException&) {
+                    wrong++;
+                }
+            }
+        });
+    }
+    for (thread& client: clients) {
+        client.join();
+    }
+    EXPECT_EQUAL(wrong.load(), 0);
+}
+
+STUDENT_TEST("Failed requests are reported and the service carries on") {
+    TestDirectory directory;
+    string path = directory.socketPath();
+    TestService service(path);
+    EXPECT_ERROR(daemonRequest(path, 'D', "not a container"));
+    EXPECT_ERROR(daemonRequest(path, 'X', "unknown request"));
+    string container = compressContainer(sampleText(5000));
+    EXPECT_ERROR(daemonRequest(path, 'D', container.substr(0, container.size() / 2)));
+    EXPECT_EQUAL(daemonRequest(path, 'D', container), sampleText(5000));
+}
+
+STUDENT_TEST("Containers claiming too many bytes are refused without being decoded") {
+    /* Nine RLE blocks of kMaxBlockSize bytes each, with only as much payload
+     * as the container format demands, claim more than a gigabyte. */
+    string bomb = containerHeader(ContainerOptions());
+    for (int block = 0; block < 9; block++) {
+        bomb += char(BlockMethod::Rle);
+        bomb += "\x80\x80\x80\x40";    // kMaxBlockSize as a varint
+        bomb += char(16);
+        bomb += string(16, '\0');
+    }
+    bomb += char(kEndOfBlocks);
+    EXPECT_EQUAL(scanContainer(bomb).rawSizes.size(), size_t(9));
+
+    TestDirectory directory;
+    string path = directory.socketPath();
+    TestService service(path);
+    string message;
+    try {
+        daemonRequest(path, 'D', bomb);
+    } catch (ErrorException& e) {
+        message = e.getMessage();
+    }
+    EXPECT_EQUAL(message, "Decompressed data would be too large.");
+}
+
+STUDENT_TEST("A 'Q' request stops the service and removes its socket") {
+    TestDirectory directory;
+    string path = directory.socketPath();
+    TestService service(path);
+    EXPECT_EQUAL(daemonRequest(path, 'Q', ""), "");
+    EXPECT_EQUAL(service.finish(), "");
+    EXPECT(!fileExists(path));
+    EXPECT_ERROR(daemonRequest(path, 'C', "text"));
+}
+
+STUDENT_TEST("The service refuses paths holding anything but a stale socket") {
+    TestDirectory directory;
+    string path = directory.socketPath();
+
+    ofstream(path) << "precious";
+    CompressionDaemon onFile(path, ContainerOptions());
+    EXPECT_ERROR(onFile.run());
+    ifstream in(path);
+    string contents;
+    getline(in, contents);
+    EXPECT_EQUAL(contents, "precious");
+    remove(path.c_str());
+
+    {
+        TestService first(path);
+        CompressionDaemon second(path, ContainerOptions());
+        EXPECT_ERROR(second.run());
+        EXPECT_EQUAL(daemonRequest(path, 'D', daemonRequest(path, 'C', "still here")), "still here");
+    }
+}
+
+STUDENT_TEST("A socket left behind by a stopped service is replaced") {
+    TestDirectory directory;
+    string path = directory.socketPath();
+    sockaddr_un address = socketAddress(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    EXPECT_EQUAL(::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof address), 0);
+    close(fd);
+    EXPECT(fileExists(path));
+    {
+        TestService service(path);
+        EXPECT_EQUAL(daemonRequest(path, 'D', daemonRequest(path, 'C', "fresh")), "fresh");
+    }
+}
+
+STUDENT_TEST("Stopping before the service is ready makes run return once it is") {
+    TestDirectory directory;
+    string path = directory.socketPath();
+    CompressionDaemon daemon(path, ContainerOptions());
+    daemon.stop();
+    daemon.run();
+    EXPECT(!fileExists(path));
+}
+
+#endif
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "container.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * A long-running compression service on a Unix domain socket, so programs on
+ * the same machine can compress and decompress without starting this program
+ * or linking its code.
+ *
+ * Protocol (integers little-endian). A client connects and sends any number of
+ * requests, each answered before the next is read:
+ *
+ * request:
+ *   1 byte:  'C' to compress, 'D' to decompress a container, 'Q' to stop the
+ *            service.
+ *   8 bytes: length of the data.
+ *   data.
+ * response:
+ *   1 byte:  0 on success, 1 on failure.
+ *   8 bytes: length of the data.
+ *   data:    the container or decompressed bytes, or a message on failure.
+ *
+ * Requests from every connection share one queue and a fixed pool of worker
+ * threads. A worker takes several small requests at a time, up to
+ * kDaemonBatchRequests of them or kDaemonBatchBytes in all, so bursts of tiny
+ * requests cost one wakeup per batch rather than per request.
+ */
+
+/* Requests longer than this are refused without being read. */
+const uint64_t kDaemonMaxRequestBytes = uint64_t(1) << 30;
+
+/* Containers that would decompress to more than this are refused without
+ * being decoded.
+ */
+const uint64_t kDaemonMaxResponseBytes = uint64_t(1) << 30;
+
+const size_t kDaemonBatchRequests = 32;
+const size_t kDaemonBatchBytes    = 256 * 1024;
+
+/**
+ * Type that runs the service. Compression uses the given options, except that
+ * options.threads is the number of workers and each request is coded on one.
+ *
+ *     CompressionDaemon daemon("/tmp/huffman.sock", options);
+ *     daemon.run();   // until a client sends 'Q' or another thread calls stop
+ */
+class CompressionDaemon {
+public:
+    CompressionDaemon(const std::string& socketPath, const ContainerOptions& options);
+    ~CompressionDaemon();
+
+    /* Listens on the socket and serves clients until stopped. A socket left
+     * behind by a service that is no longer running is replaced; anything
+     * else at the path, including a socket something still listens on, is
+     * left alone and reported as an error.
+     */
+    void run();
+
+    /* Makes run return once the requests in progress are answered. If run is
+     * still starting up, it returns as soon as it is ready.
+     */
+    void stop();
+
+private:
+    struct Job {
+        char op;
+        std::string data;
+        bool failed = false;
+        bool done = false;
+    };
+
+    void serveConnection(int fd);
+    void work();
+    void runJob(Job& job);
+
+    std::string _socketPath;
+    ContainerOptions _options;
+    std::atomic<bool> _stopping;
+    std::atomic<int> _listenFd;
+
+    std::mutex _lock;
+    std::condition_variable _queued;
+    std::condition_variable _finished;
+    std::condition_variable _closed;
+    std::deque<Job*> _queue;
+    std::vector<int> _connections;   // each served by a detached thread
+    std::vector<std::thread> _workers;
+};
+
+/**
+ * Sends one request to the service listening on socketPath and returns the
+ * response data. Reports an error, with the service's message, if it fails.
+ */
+std::string daemonRequest(const std::string& socketPath, char op, const std::string& data);
@@ -0,0 +1,412 @@
+#include "directory.h"
+#include "error.h"
+#include "filelib.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <system_error>
+#include "testutil.h"
+#include "SimpleTest.h"
+using namespace std;
+namespace fs = std::filesystem;
+
+/**
+ * Directory tree compression. The public interface is provided in directory.h
+ * header file.
+ */
+
+namespace {
+    /**
+     * A file found in the tree, with its path relative to the root.
+     */
+    struct TreeFile {
+        string relative;
+        uint64_t size;
+    };
+
+    string joinPath(const string& directory, const string& name) {
+        if (directory.empty()) return name;
+        if (name.empty()) return directory;
+        return directory + getDirectoryPathSeparator() + name;
+    }
+
+    /**
+     * Adds every file under root/relative to files, and creates the matching
+     * directory under outRoot. Does not descend into the directory skip, however
+     * its path is written. Links are not followed.
+     */
+    void walkTree(const string& root, const string& relative, const string& outRoot,
+                  const string& skip, vector<TreeFile>& files) {
+        string directory = joinPath(root, relative);
+        createDirectoryPath(joinPath(outRoot, relative));
+        for (const string& name: listDirectory(directory)) {
+            string path = joinPath(directory, name);
+            string child = joinPath(relative, name);
+            error_code failed;
+            fs::file_status status = fs::symlink_status(path, failed);
+            if (failed) continue;   // gone since it was listed
+            if (fs::is_directory(status)) {
+                if (fs::equivalent(path, skip, failed)) continue;
+                walkTree(root, child, outRoot, skip, files);
+            } else if (fs::is_regular_file(status)) {
+                uint64_t size = fs::file_size(path, failed);
+                if (failed) continue;
+                TreeFile file = { child, size };
+                files.push_back(file);
+            }
+        }
+    }
+
+    string readFile(const string& path) {
+        ifstream in(path, ios::binary);
+        if (!in) {
+            error("unable to open");
+        }
+        string contents((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        if (in.bad()) {
+            error("unable to read");
+        }
+        return contents;
+    }
+
+    void writeFile(const string& path, const string& contents) {
+        ofstream out(path, ios::binary);
+        out.write(contents.data(), contents.size());
+        if (!out) {
+            error("unable to write " + path);
+        }
+    }
+
+    /**
+     * One file being converted: its input, its converted pieces, and how many
+     * pieces are still to do. Its share of the memory budget is given back
+     * when the last task holding it lets go.
+     */
+    struct FileJob {
+        FileJob(MemoryBudget& budget, uint64_t held) : budget(budget), held(held), remaining(0) {}
+
+        ~FileJob() {
+            budget.release(held);
+        }
+
+        MemoryBudget& budget;
+        uint64_t held;
+        string inPath;
+        string outPath;
+        string input;
+        ContainerLayout layout;     // used when decompressing
+        vector<string> pieces;
+        atomic<size_t> remaining;
+        mutex lock;
+        string failure;             // first error in any piece
+    };
+
+    /**
+     * How to convert a file a piece at a time. split reads the input and
+     * returns the number of pieces, piece converts one of them, on any worker
+     * and in any order, and join puts the results together.
+     */
+    struct PieceCodec {
+        function<size_t(FileJob&)> split;
+        function<void(FileJob&, size_t)> piece;
+        function<string(FileJob&)> join;
+    };
+
+    /**
+     * Walks inRoot and converts each file accepted by wanted with codec,
+     * writing the result under outRoot at the path given by rename.
+     *
+     * Files are started largest first, each as one task in a work-stealing
+     * pool (see scheduler.h); that task splits its file into a task per piece,
+     * which idle workers steal, so a large file is spread over every worker
+     * rather than holding one up. This thread waits for memory budget before
+     * starting each file, so workers never block.
+     */
+    DirectoryStats convertTree(const string& inRoot, const string& outRoot, int threads,
+                               const function<bool(const string&)>& wanted,
+                               const function<string(const string&)>& rename,
+                               const PieceCodec& codec) {
+        if (!isDirectory(inRoot)) {
+            error(inRoot + " is not a directory.");
+        }
+        vector<TreeFile> found, files;
+        createDirectoryPath(outRoot);
+        walkTree(inRoot, "", outRoot, outRoot, found);
+        for (TreeFile& file: found) {
+            if (wanted(file.relative)) files.push_back(file);
+        }
+        stable_sort(files.begin(), files.end(), [](const TreeFile& a, const TreeFile& b) {
+            return a.size > b.size;
+        });
+
+        DirectoryStats stats;
+        mutex statsLock;
+        MemoryBudget budget(kDirectoryMemoryBudget);
+        WorkStealingPool pool(threads);
+
+        auto fail = [&](const FileJob& job, const string& message) {
+            lock_guard<mutex> guard(statsLock);
+            stats.failures.push_back(job.inPath + ": " + message);
+        };
+        auto finish = [&](FileJob& job) {
+            if (!job.failure.empty()) {
+                fail(job, job.failure);
+                return;
+            }
+            try {
+                string output = codec.join(job);
+                writeFile(job.outPath, output);
+                lock_guard<mutex> guard(statsLock);
+                stats.files++;
+                stats.inputBytes += job.input.size();
+                stats.outputBytes += output.size();
+            } catch (ErrorException& e) {
+                fail(job, e.getMessage());
+            }
+        };
+
+        for (const TreeFile& file: files) {
+            shared_ptr<FileJob> job = make_shared<FileJob>(budget, budget.acquire(file.size));
+            job->inPath = joinPath(inRoot, file.relative);
+            job->outPath = joinPath(outRoot, rename(file.relative));
+            pool.submit([&, job]() {
+                size_t count;
+                try {
+                    job->input = readFile(job->inPath);
+                    count = codec.split(*job);
+                } catch (ErrorException& e) {
+                    fail(*job, e.getMessage());
+                    return;
+                }
+                job->pieces.resize(count);
+                job->remaining = count;
+                if (count == 0) {
+                    finish(*job);
+                    return;
+                }
+                for (size_t i = 0; i < count; i++) {
+                    pool.submit([&, job, i]() {
+                        try {
+                            codec.piece(*job, i);
+                        } catch (ErrorException& e) {
+                            lock_guard<mutex> guard(job->lock);
+                            if (job->failure.empty()) job->failure = e.getMessage();
+                        }
+                        if (--job->remaining == 0) {
+                            finish(*job);
+                        }
+                    });
+                }
+            });
+        }
+        pool.wait();
+        sort(stats.failures.begin(), stats.failures.end());
+        return stats;
+    }
+
+    bool endsWith(const string& text, const string& suffix) {
+        return text.size() >= suffix.size()
+            && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+}
+
+DirectoryStats compressDirectory(const string& inRoot, const string& outRoot,
+                                 const string& extension, const ContainerOptions& options) {
+    checkContainerOptions(options);
+    size_t blockSize = options.blockSize;
+    PieceCodec codec;
+    codec.split = [=](FileJob& job) {
+        return (job.input.size() + blockSize - 1) / blockSize;
+    };
+    codec.piece = [&](FileJob& job, size_t i) {
+        size_t start = i * blockSize;
+        encodeBlock(job.input.data() + start, min(blockSize, job.input.size() - start), options, job.pieces[i]);
+    };
+    codec.join = [&](FileJob& job) {
+        vector<uint64_t> rawSizes, blockBytes;
+        string out = containerHeader(options);
+        out.reserve(job.input.size() / 2);
+        for (size_t i = 0; i < job.pieces.size(); i++) {
+            rawSizes.push_back(min(blockSize, job.input.size() - i * blockSize));
+            blockBytes.push_back(job.pieces[i].size());
+            out += job.pieces[i];
+        }
+        return out + containerTrailer(options, rawSizes, blockBytes);
+    };
+    return convertTree(inRoot, outRoot, options.threads,
+                       [](const string&) { return true; },
+                       [&](const string& relative) { return relative + extension; },
+                       codec);
+}
+
+DirectoryStats decompressDirectory(const string& inRoot, const string& outRoot,
+                                   const string& extension, int threads) {
+    PieceCodec codec;
+    codec.split = [](FileJob& job) {
+        job.layout = scanContainer(job.input);
+        return job.layout.blockStarts.size();
+    };
+    codec.piece = [](FileJob& job, size_t i) {
+        decodeBlock(job.input, job.layout.blockStarts[i], job.pieces[i], job.layout.checksums);
+    };
+    codec.join = [](FileJob& job) {
+        string out;
+        out.reserve(job.input.size() * 2);
+        for (const string& piece: job.pieces) {
+            out += piece;
+        }
+        return out;
+    };
+    return convertTree(inRoot, outRoot, threads,
+                       [&](const string& relative) { return endsWith(relative, extension); },
+                       [&](const string& relative) {
+                           return relative.substr(0, relative.size() - extension.size());
+                       },
+                       codec);
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+#if !defined(_WIN32)
+
+namespace {
+    /* A tree of files in a fresh temporary directory, removed when done. */
+    struct TestTree {
+        string root;
+
+        TestTree() {
+            char pattern[] = "/tmp/directory-test-XXXXXX";
+            root = mkdtemp(pattern);
+        }
+
+        ~TestTree() {
+            error_code ignored;
+            fs::remove_all(root, ignored);
+        }
+
+        void add(const string& relative, const string& contents) {
+            string path = root + "/" + relative;
+            createDirectoryPath(getHead(path));
+            ofstream(path, ios::binary) << contents;
+        }
+
+        string read(const string& relative) const {
+            ifstream in(root + "/" + relative, ios::binary);
+            ostringstream contents;
+            contents << in.rdbuf();
+            return contents.str();
+        }
+
+        bool has(const string& relative) const {
+            return fileExists(root + "/" + relative);
+        }
+    };
+
+    /* The files added by addTestFiles, by path relative to the tree. */
+    vector<pair<string, string>> testFiles() {
+        string text;
+        for (int i = 0; i < 3000; i++) {
+            text += "entry " + to_string(i % 13) + "\n";
+        }
+        return {
+            { "in/notes.txt", "It was the best of times." },
+            { "in/empty", "" },
+            { "in/logs/today.log", text },
+            { "in/logs/old/random.bin", randomBytes(300000, 1) },
+        };
+    }
+
+    void addTestFiles(TestTree& tree) {
+        for (const auto& file: testFiles()) {
+            tree.add(file.first, file.second);
+        }
+    }
+}
+
+STUDENT_TEST("Directory trees round-trip through compress and decompress") {
+    for (int threads: { 1, 4 }) {
+        TestTree tree;
+        addTestFiles(tree);
+        ContainerOptions options;
+        options.threads = threads;
+        options.blockSize = 65536;
+        DirectoryStats packed = compressDirectory(tree.root + "/in", tree.root + "/packed", ".huf", options);
+        EXPECT_EQUAL(packed.files, testFiles().size());
+        EXPECT(packed.failures.empty());
+        EXPECT(packed.outputBytes < packed.inputBytes);
+
+        DirectoryStats unpacked = decompressDirectory(tree.root + "/packed", tree.root + "/out", ".huf", threads);
+        EXPECT_EQUAL(unpacked.files, testFiles().size());
+        EXPECT_EQUAL(unpacked.outputBytes, packed.inputBytes);
+        for (const auto& file: testFiles()) {
+            string relative = file.first.substr(string("in/").size());
+            EXPECT(isContainer(tree.read("packed/" + relative + ".huf")));
+            EXPECT_EQUAL(tree.read("out/" + relative), file.second);
+        }
+    }
+}
+
+STUDENT_TEST("Decompressing leaves files without the extension alone") {
+    TestTree tree;
+    tree.add("in/a.huf", compressContainer("contents"));
+    tree.add("in/readme.txt", "not compressed");
+    DirectoryStats stats = decompressDirectory(tree.root + "/in", tree.root + "/out", ".huf", 1);
+    EXPECT_EQUAL(stats.files, size_t(1));
+    EXPECT_EQUAL(tree.read("out/a"), "contents");
+    EXPECT(!tree.has("out/readme.txt"));
+}
+
+STUDENT_TEST("Files that fail are recorded and the rest carry on") {
+    TestTree tree;
+    tree.add("in/good.huf", compressContainer("good"));
+    tree.add("in/bad.huf", "not a container");
+    DirectoryStats stats = decompressDirectory(tree.root + "/in", tree.root + "/out", ".huf", 2);
+    EXPECT_EQUAL(stats.files, size_t(1));
+    EXPECT_EQUAL(stats.failures.size(), size_t(1));
+    EXPECT(stats.failures[0].find("bad.huf") != string::npos);
+    EXPECT_EQUAL(tree.read("out/good"), "good");
+}
+
+STUDENT_TEST("An output tree inside the input tree is skipped however it is written") {
+    for (string outRoot: { "in/packed", "in/./packed/", "in/logs/../packed" }) {
+        TestTree tree;
+        addTestFiles(tree);
+        DirectoryStats first = compressDirectory(tree.root + "/in", tree.root + "/" + outRoot, ".huf", ContainerOptions());
+        EXPECT_EQUAL(first.files, testFiles().size());
+
+        /* A second run must not compress the first run's output. */
+        DirectoryStats second = compressDirectory(tree.root + "/in", tree.root + "/" + outRoot, ".huf", ContainerOptions());
+        EXPECT_EQUAL(second.files, testFiles().size());
+        EXPECT(!tree.has("in/packed/packed"));
+    }
+}
+
+STUDENT_TEST("Symbolic links are not followed") {
+    TestTree tree;
+    tree.add("in/real.txt", "real");
+    tree.add("elsewhere/secret.txt", "secret");
+    fs::create_directory_symlink(tree.root + "/elsewhere", tree.root + "/in/link");
+    fs::create_directory_symlink(tree.root + "/in", tree.root + "/in/loop");
+    DirectoryStats stats = compressDirectory(tree.root + "/in", tree.root + "/out", ".huf", ContainerOptions());
+    EXPECT_EQUAL(stats.files, size_t(1));
+    EXPECT(!tree.has("out/link/secret.txt.huf"));
+}
+
+STUDENT_TEST("A missing input tree is reported") {
+    TestTree tree;
+    EXPECT_ERROR(compressDirectory(tree.root + "/missing", tree.root + "/out", ".huf", ContainerOptions()));
+    tree.add("file", "not a directory");
+    EXPECT_ERROR(decompressDirectory(tree.root + "/file", tree.root + "/out", ".huf", 1));
+}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "container.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Compressing and decompressing whole directory trees, one container per file,
+ * with the output tree mirroring the input.
+ *
+ * Files are started largest first on a work-stealing pool (see scheduler.h),
+ * and each is split into a task per block that idle workers steal, so one
+ * large file is spread over every thread instead of leaving one thread
+ * grinding through it while the rest sit idle. At most kDirectoryMemoryBudget
+ * bytes of input are held at once; a file bigger than that waits until it is
+ * the only one in memory.
+ */
+
+/* Bytes of input files that may be in memory at once, across all workers. */
+const uint64_t kDirectoryMemoryBudget = 256 * 1024 * 1024;
+
+/**
+ * What happened to a directory tree.
+ */
+struct DirectoryStats {
+    size_t files = 0;
+    uint64_t inputBytes = 0;
+    uint64_t outputBytes = 0;
+    std::vector<std::string> failures;   // "path: reason", for files skipped
+};
+
+/**
+ * Compresses every file under inRoot into a container (see container.h) at the
+ * same relative path under outRoot, with extension appended, creating
+ * directories as needed. Uses options.threads workers. A file that cannot be
+ * read or written is recorded in the failures and the rest carry on.
+ * Symbolic links are not followed, and outRoot is skipped if it lies inside
+ * inRoot, however either path is written.
+ */
+DirectoryStats compressDirectory(const std::string& inRoot, const std::string& outRoot,
+                                 const std::string& extension, const ContainerOptions& options);
+
+/**
+ * The reverse of compressDirectory: decompresses every file under inRoot whose
+ * name ends in extension into outRoot, without the extension. Other files are
+ * left alone.
+ */
+DirectoryStats decompressDirectory(const std::string& inRoot, const std::string& outRoot,
+                                   const std::string& extension, int threads);
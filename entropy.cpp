@@ -0,0 +1,153 @@
+#include "entropy.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * Sampling estimator for Huffman compression ratios. The public interface is
+ * provided in entropy.h header file.
+ */
+
+namespace {
+    /* Samples are taken in runs of this many consecutive bytes, which keeps the
+     * reads sequential and catches local structure such as runs and records.
+     */
+    const size_t kSampleRunBytes = 64;
+}
+
+uint64_t sampleHistogram(const char* data, size_t size, size_t sampleBytes, uint64_t counts[256]) {
+    if (size <= sampleBytes || sampleBytes < kSampleRunBytes) {
+        for (size_t i = 0; i < size; i++) {
+            counts[uint8_t(data[i])]++;
+        }
+        return size;
+    }
+
+    uint64_t sampled = 0;
+    size_t runs = sampleBytes / kSampleRunBytes;
+    size_t stride = size / runs;
+    for (size_t run = 0; run < runs; run++) {
+        const char* start = data + run * stride;
+        size_t length = min(kSampleRunBytes, size - run * stride);
+        for (size_t i = 0; i < length; i++) {
+            counts[uint8_t(start[i])]++;
+        }
+        sampled += length;
+    }
+    return sampled;
+}
+
+CompressionEstimate estimateFromCounts(const uint64_t counts[256], uint64_t total) {
+    CompressionEstimate estimate;
+    estimate.sampledBytes = total;
+    if (total == 0) return estimate;
+
+    double entropy = 0;
+    for (int ch = 0; ch < 256; ch++) {
+        if (counts[ch] == 0) continue;
+        double p = double(counts[ch]) / total;
+        entropy -= p * log2(p);
+    }
+    estimate.entropyBits = entropy;
+    estimate.predictedRatio = max(entropy, 1.0) / 8;
+    return estimate;
+}
+
+CompressionEstimate estimateCompression(const char* data, size_t size, size_t sampleBytes) {
+    uint64_t counts[256] = {};
+    uint64_t sampled = sampleHistogram(data, size, sampleBytes, counts);
+    return estimateFromCounts(counts, sampled);
+}
+
+CompressionEstimate estimateCompression(const string& data, size_t sampleBytes) {
+    return estimateCompression(data.data(), data.size(), sampleBytes);
+}
+
+bool worthCompressing(const CompressionEstimate& estimate, double minGain) {
+    return 1 - estimate.predictedRatio >= minGain;
+}
+
+bool looksRandom(const CompressionEstimate& estimate) {
+    return estimate.entropyBits >= kRandomEntropyBits;
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("Entropy of simple distributions") {
+    CompressionEstimate one = estimateCompression(string(1000, 'a'));
+    EXPECT_EQUAL(one.sampledBytes, uint64_t(1000));
+    EXPECT_EQUAL(one.entropyBits, 0.0);
+    EXPECT_EQUAL(one.predictedRatio, 1.0 / 8);
+
+    string allBytes;
+    for (int ch = 0; ch < 256; ch++) {
+        allBytes += char(ch);
+    }
+    CompressionEstimate uniform = estimateCompression(allBytes);
+    EXPECT_EQUAL(uniform.entropyBits, 8.0);
+    EXPECT_EQUAL(uniform.predictedRatio, 1.0);
+
+    CompressionEstimate halves = estimateCompression("abababab");
+    EXPECT_EQUAL(halves.entropyBits, 1.0);
+}
+
+STUDENT_TEST("Empty data predicts nothing") {
+    CompressionEstimate estimate = estimateCompression("");
+    EXPECT_EQUAL(estimate.sampledBytes, uint64_t(0));
+    EXPECT_EQUAL(estimate.predictedRatio, 1.0);
+    EXPECT(!worthCompressing(estimate));
+    EXPECT(!looksRandom(estimate));
+}
+
+STUDENT_TEST("Large inputs are sampled, small ones counted whole") {
+    string data(1 << 20, 'x');
+    EXPECT_EQUAL(estimateCompression(data).sampledBytes, uint64_t(kDefaultSampleBytes));
+    EXPECT_EQUAL(estimateCompression(data, data.size()).sampledBytes, uint64_t(data.size()));
+    EXPECT_EQUAL(estimateCompression(data.substr(0, 100)).sampledBytes, uint64_t(100));
+}
+
+STUDENT_TEST("The sample is spread over the whole input") {
+    /* A sample taken only from the front would see nothing but 'a'. */
+    string data = string(1 << 19, 'a') + string(1 << 19, 'b');
+    CompressionEstimate estimate = estimateCompression(data);
+    EXPECT(estimate.entropyBits > 0.9 && estimate.entropyBits <= 1.0);
+}
+
+STUDENT_TEST("sampleHistogram adds to the counts it is given") {
+    uint64_t counts[256] = {};
+    counts['a'] = 5;
+    EXPECT_EQUAL(sampleHistogram("aab", 3, kDefaultSampleBytes, counts), uint64_t(3));
+    EXPECT_EQUAL(counts['a'], uint64_t(7));
+    EXPECT_EQUAL(counts['b'], uint64_t(1));
+
+    CompressionEstimate estimate = estimateFromCounts(counts, 8);
+    EXPECT_EQUAL(estimate.sampledBytes, uint64_t(8));
+    EXPECT(estimate.entropyBits > 0.5 && estimate.entropyBits < 0.6);
+}
+
+STUDENT_TEST("Random bytes look random and are not worth compressing") {
+    mt19937 random(1);
+    string bytes;
+    for (int i = 0; i < 100000; i++) {
+        bytes += char(random());
+    }
+    CompressionEstimate estimate = estimateCompression(bytes);
+    EXPECT(looksRandom(estimate));
+    EXPECT(!worthCompressing(estimate));
+    EXPECT(worthCompressing(estimate, -1));
+}
+
+STUDENT_TEST("Skewed text is worth compressing") {
+    string text;
+    for (int i = 0; i < 1000; i++) {
+        text += "it was the best of times, it was the worst of times. ";
+    }
+    CompressionEstimate estimate = estimateCompression(text);
+    EXPECT(!looksRandom(estimate));
+    EXPECT(worthCompressing(estimate));
+    EXPECT(!worthCompressing(estimate, 0.9));
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/* Default number of bytes estimateCompression looks at. */
+const size_t kDefaultSampleBytes = 1 << 14;
+
+/* Blocks predicted to shrink by less than this fraction are stored without
+ * being coded.
+ */
+const double kDefaultMinPredictedGain = 0.02;
+
+/* Samples with at least this many bits per byte look like compressed or
+ * encrypted data. The entropy of a sample of uniformly random bytes comes out
+ * a little below 8, by about 0.01 bits for the default sample size.
+ */
+const double kRandomEntropyBits = 7.9;
+
+/**
+ * Type holding a prediction of how well Huffman coding will do on some data,
+ * made from a sample of the data rather than the whole of it.
+ */
+struct CompressionEstimate {
+    uint64_t sampledBytes = 0;
+    double entropyBits    = 0;   // order-0 entropy of the sample, in bits per byte
+    double predictedRatio = 1;   // predicted compressed size over original size
+};
+
+/**
+ * Predicts how well the size bytes at data will compress, looking at no more
+ * than sampleBytes of them, spread evenly over the data.
+ *
+ * The prediction is the order-0 entropy of the sample, the lower bound for any
+ * code that assigns each byte value a fixed code. A Huffman code needs at least
+ * one bit per byte, so the prediction never goes below that either. The cost
+ * of storing the code itself is not included.
+ */
+CompressionEstimate estimateCompression(const char* data, size_t size,
+                                        size_t sampleBytes = kDefaultSampleBytes);
+CompressionEstimate estimateCompression(const std::string& data,
+                                        size_t sampleBytes = kDefaultSampleBytes);
+
+/**
+ * Counts the byte values in a sample of at most sampleBytes of the size bytes
+ * at data, spread evenly over the data, adding them to counts. Returns the
+ * number of bytes sampled.
+ */
+uint64_t sampleHistogram(const char* data, size_t size, size_t sampleBytes, uint64_t counts[256]);
+
+/**
+ * Makes the same prediction as estimateCompression, from a histogram of total
+ * bytes that has already been taken.
+ */
+CompressionEstimate estimateFromCounts(const uint64_t counts[256], uint64_t total);
+
+/**
+ * Returns whether the estimate predicts the data shrinking by at least the given
+ * fraction of its size.
+ */
+bool worthCompressing(const CompressionEstimate& estimate, double minGain = kDefaultMinPredictedGain);
+
+/**
+ * Returns whether the sample behind the estimate looks like random bytes, which
+ * no block method shrinks: its order-0 entropy is at least kRandomEntropyBits
+ * bits per byte. Only the byte counts are looked at, so data whose bytes are
+ * evenly mixed but repeat in long runs or patterns also passes.
+ */
+bool looksRandom(const CompressionEstimate& estimate);
@@ -0,0 +1,260 @@
+#include "fileio.h"
+#include "container.h"
+#include "error.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <utility>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include "testutil.h"
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * Overlapped file reads and writes. The public interface is provided in
+ * fileio.h header file.
+ */
+
+namespace {
+#if defined(_WIN32)
+    const int kBinaryFlag = O_BINARY;
+#else
+    const int kBinaryFlag = 0;
+#endif
+}
+
+File::File(const string& path, int flags) : _path(path) {
+    _fd = open(path.c_str(), flags | kBinaryFlag, 0644);
+    if (_fd < 0) {
+        error("Unable to open " + path + ": " + strerror(errno));
+    }
+}
+
+File::~File() {
+    if (_fd >= 0) ::close(_fd);
+}
+
+int File::fd() const {
+    return _fd;
+}
+
+uint64_t File::size() const {
+    struct stat info;
+    if (fstat(_fd, &info) < 0) {
+        error("Unable to read " + _path + ": " + strerror(errno));
+    }
+    return info.st_size;
+}
+
+void File::close() {
+    int fd = _fd;
+    _fd = -1;
+    if (::close(fd) < 0) {
+        error("Unable to write " + _path + ": " + strerror(errno));
+    }
+}
+
+FileTransfers::FileTransfers() : _nextTag(0), _queue(kFileIoDepth) {}
+
+uint64_t FileTransfers::read(int fd, char* buffer, size_t size, uint64_t offset) {
+    Request request = { fd, buffer, size, offset, 0, false, string() };
+    return start(request);
+}
+
+void FileTransfers::write(int fd, const char* buffer, size_t size, uint64_t offset) {
+    Request request = { fd, const_cast<char*>(buffer), size, offset, 0, true, string() };
+    start(request);
+}
+
+void FileTransfers::write(int fd, string data, uint64_t offset) {
+    Request request = { fd, nullptr, data.size(), offset, 0, true, string() };
+    request.data.swap(data);
+    start(request);
+}
+
+bool FileTransfers::finished(uint64_t tag) const {
+    return _requests.find(tag) == _requests.end();
+}
+
+bool FileTransfers::full() const {
+    return _queue.outstanding() == _queue.depth();
+}
+
+void FileTransfers::submit() {
+    _queue.submit();
+}
+
+void FileTransfers::waitOne() {
+    IoCompletion completion = _queue.wait();
+    Request& request = _requests.at(completion.tag);
+    if (completion.result < 0) {
+        error(string("Unable to ") + (request.write ? "write: " : "read: ")
+              + strerror(int(-completion.result)));
+    }
+    if (completion.result == 0) {
+        error(request.write ? "Unable to write: no space." : "File ended early; was it changed?");
+    }
+    request.done += completion.result;
+    if (request.done < request.size) {
+        issue(request, completion.tag);
+    } else {
+        _requests.erase(completion.tag);
+    }
+}
+
+void FileTransfers::finishAll() {
+    while (!_requests.empty()) waitOne();
+}
+
+uint64_t FileTransfers::start(Request& request) {
+    if (request.size == 0) return UINT64_MAX;
+    while (full()) waitOne();
+    uint64_t tag = _nextTag++;
+    Request& stored = _requests[tag];
+    stored = move(request);
+    if (!stored.data.empty()) {
+        stored.buffer = &stored.data[0];
+    }
+    issue(stored, tag);
+    return tag;
+}
+
+void FileTransfers::issue(const Request& request, uint64_t tag) {
+    if (request.write) {
+        _queue.write(request.fd, request.buffer + request.done, request.size - request.done,
+                     request.offset + request.done, tag);
+    } else {
+        _queue.read(request.fd, request.buffer + request.done, request.size - request.done,
+                    request.offset + request.done, tag);
+    }
+}
+
+void decompressFileOverlapped(const string& inPath, const string& outPath, int threads) {
+    File in(inPath, O_RDONLY);
+    uint64_t size = in.size();
+    if (size > string().max_size()) {
+        error(inPath + " is too large to decompress.");
+    }
+    string data(size, '\0');
+    {
+        FileTransfers transfers;
+        for (uint64_t pos = 0; pos < size; pos += kFileIoChunk) {
+            transfers.read(in.fd(), &data[pos], min<uint64_t>(kFileIoChunk, size - pos), pos);
+            transfers.submit();
+        }
+        transfers.finishAll();
+    }
+    string text = decompressContainer(data, threads);
+    string().swap(data);
+
+    File out(outPath, O_WRONLY | O_CREAT | O_TRUNC);
+    FileTransfers transfers;
+    for (uint64_t pos = 0; pos < text.size(); pos += kFileIoChunk) {
+        transfers.write(out.fd(), text.data() + pos, min<uint64_t>(kFileIoChunk, text.size() - pos), pos);
+        transfers.submit();
+    }
+    transfers.finishAll();
+    out.close();
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+#if !defined(_WIN32)
+
+STUDENT_TEST("File reports files it cannot open") {
+    EXPECT_ERROR(File file("/tmp/fileio-test-missing/file", O_RDONLY));
+    TestPath test;
+    File file(test.path, O_WRONLY | O_TRUNC);
+    EXPECT_EQUAL(file.size(), uint64_t(0));
+    file.close();
+}
+
+STUDENT_TEST("FileTransfers keeps more transfers going than the queue holds") {
+    TestPath test;
+    string data = randomBytes(40 * 4096 + 123, 1);
+    {
+        File out(test.path, O_WRONLY | O_TRUNC);
+        FileTransfers transfers;
+        for (size_t offset = 0; offset < data.size(); offset += 4096) {
+            transfers.write(out.fd(), data.substr(offset, 4096), offset);
+        }
+        transfers.finishAll();
+        out.close();
+    }
+    EXPECT_EQUAL(contentsOf(test.path), data);
+
+    File in(test.path, O_RDONLY);
+    EXPECT_EQUAL(in.size(), uint64_t(data.size()));
+    string back(data.size(), '\0');
+    FileTransfers transfers;
+    vector<uint64_t> tags;
+    for (size_t offset = 0; offset < data.size(); offset += 1000) {
+        tags.push_back(transfers.read(in.fd(), &back[offset], min<size_t>(1000, data.size() - offset), offset));
+    }
+    transfers.finishAll();
+    for (uint64_t tag: tags) {
+        EXPECT(transfers.finished(tag));
+    }
+    EXPECT_EQUAL(back, data);
+}
+
+STUDENT_TEST("Empty transfers finish at once") {
+    TestPath test;
+    File in(test.path, O_RDONLY);
+    FileTransfers transfers;
+    EXPECT(transfers.finished(transfers.read(in.fd(), nullptr, 0, 0)));
+    EXPECT(!transfers.full());
+}
+
+STUDENT_TEST("FileTransfers reports files that end early and writes that fail") {
+    TestPath test;
+    ofstream(test.path, ios::binary) << "short";
+    File in(test.path, O_RDONLY);
+    char buffer[100];
+    FileTransfers reads;
+    reads.read(in.fd(), buffer, sizeof buffer, 0);
+    EXPECT_ERROR(reads.finishAll());
+
+    if (access("/dev/full", W_OK) == 0) {
+        File full("/dev/full", O_WRONLY);
+        FileTransfers writes;
+        writes.write(full.fd(), string(10000, 'x'), 0);
+        EXPECT_ERROR(writes.finishAll());
+    }
+}
+
+STUDENT_TEST("decompressFileOverlapped round-trips a container") {
+    TestPath in, out;
+    string text;
+    for (int i = 0; i < 50000; i++) {
+        text += "line " + to_string(i % 31) + "\n";
+    }
+    ContainerOptions options;
+    options.blockSize = 10000;
+    ofstream(in.path, ios::binary) << compressContainer(text, options);
+    for (int threads: { 1, 4 }) {
+        decompressFileOverlapped(in.path, out.path, threads);
+        EXPECT_EQUAL(contentsOf(out.path), text);
+    }
+}
+
+STUDENT_TEST("decompressFileOverlapped reports missing and damaged input") {
+    TestPath in, out;
+    EXPECT_ERROR(decompressFileOverlapped(in.path + "-missing", out.path));
+    ofstream(in.path, ios::binary) << "not a container";
+    EXPECT_ERROR(decompressFileOverlapped(in.path, out.path));
+}
+
+#endif
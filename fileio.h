@@ -0,0 +1,105 @@
+#pragma once
+
+#include "ioqueue.h"
+#include <cstdint>
+#include <map>
+#include <string>
+
+/**
+ * Reading and writing files on disk with many transfers in flight at once,
+ * through an IoQueue (see ioqueue.h), so the disk works while the caller codes.
+ * The compression pipeline (see pipeline.h) reads and writes blocks this way.
+ *
+ * Decompression reads the container with many reads in flight, decodes it
+ * with threads, and writes the result the same way.
+ */
+
+/* Requests kept in flight at once. */
+const unsigned kFileIoDepth = 16;
+
+/* Size of each read and write when decompressing. */
+const size_t kFileIoChunk = 1 << 20;
+
+/**
+ * Type that owns a file descriptor and closes it when done. Reports an error
+ * if the file cannot be opened with the given open flags.
+ */
+class File {
+public:
+    File(const std::string& path, int flags);
+    ~File();
+
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    int fd() const;
+    uint64_t size() const;
+
+    /* Closes the file, reporting an error if the last writes failed. */
+    void close();
+
+private:
+    std::string _path;
+    int _fd;
+};
+
+/**
+ * Type that keeps reads and writes going through an IoQueue of kFileIoDepth
+ * requests, waiting for a free slot when the queue is full and resuming short
+ * transfers until every byte has moved. Failed transfers are reported as
+ * errors. Writes own their data until they finish. One thread at a time.
+ */
+class FileTransfers {
+public:
+    FileTransfers();
+
+    /* Starts reading into buffer, which must stay put until the read has
+     * finished; returns a tag for finished().
+     */
+    uint64_t read(int fd, char* buffer, size_t size, uint64_t offset);
+
+    /* Starts writing from a buffer that the caller keeps until finishAll, or
+     * from data that is kept here until written.
+     */
+    void write(int fd, const char* buffer, size_t size, uint64_t offset);
+    void write(int fd, std::string data, uint64_t offset);
+
+    bool finished(uint64_t tag) const;
+    bool full() const;
+
+    /* Lets the kernel start on everything queued. */
+    void submit();
+
+    /* Waits for one transfer to complete, or part of one. */
+    void waitOne();
+
+    void finishAll();
+
+private:
+    struct Request {
+        int fd;
+        char* buffer;
+        size_t size;
+        uint64_t offset;
+        size_t done;
+        bool write;
+        std::string data;   // owned bytes to write, if any
+    };
+
+    uint64_t start(Request& request);
+    void issue(const Request& request, uint64_t tag);
+
+    std::map<uint64_t, Request> _requests;   // outstanding, by tag
+    uint64_t _nextTag;
+
+    /* Declared last so it is destroyed first, waiting for the kernel to
+     * finish with the buffers above.
+     */
+    IoQueue _queue;
+};
+
+/**
+ * Decompresses the container at inPath into outPath, replacing it. Reports an
+ * error if the file cannot be read or written or is not a valid container.
+ */
+void decompressFileOverlapped(const std::string& inPath, const std::string& outPath, int threads = 1);
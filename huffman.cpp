@@ -17,6 +17,7 @@
 #include "bits.h"
 #include "treenode.h"
 #include "huffman.h"
+#include "codebooks.h"
 #include "map.h"
 #include "vector.h"
 #include "priorityqueue.h"
@@ -94,7 +95,11 @@ EncodingTreeNode* unflattenTreeHelper(Queue<Bit>& treeShape, Queue<char>& treeLe
     }
     else
     {
-        output = new EncodingTreeNode(unflattenTreeHelper(treeShape, treeLeaves), unflattenTreeHelper(treeShape, treeLeaves));
+        // Build the subtrees in separate statements; the order in which function
+        // arguments are evaluated is unspecified, and the zero child must come first.
+        EncodingTreeNode* zero = unflattenTreeHelper(treeShape, treeLeaves);
+        EncodingTreeNode* one = unflattenTreeHelper(treeShape, treeLeaves);
+        output = new EncodingTreeNode(zero, one);
     }
     return output;
 }
@@ -118,7 +123,9 @@ EncodingTreeNode* unflattenTreeHelper(Queue<Bit>& treeShape, Queue<char>& treeLe
  */
 EncodingTreeNode* unflattenTree(Queue<Bit>& treeShape, Queue<char>& treeLeaves) {
     treeShape.dequeue();
-    EncodingTreeNode* output = new EncodingTreeNode(unflattenTreeHelper(treeShape, treeLeaves), unflattenTreeHelper(treeShape, treeLeaves));
+    EncodingTreeNode* zero = unflattenTreeHelper(treeShape, treeLeaves);
+    EncodingTreeNode* one = unflattenTreeHelper(treeShape, treeLeaves);
+    EncodingTreeNode* output = new EncodingTreeNode(zero, one);
     return output;
 }
 
@@ -141,12 +148,19 @@ EncodingTreeNode* unflattenTree(Queue<Bit>& treeShape, Queue<char>& treeLeaves)
  *
  * The implementation modifies the `data` parameter (specifically the queues within it)
  * during processing, but the reconstructed encoding tree remains unchanged after the function returns.
+ *
+ * If the data was encoded with a static codebook, there is no tree to unflatten and the
+ * message is decoded with the codebook's compiled decoding tables instead.
 
  *
  * @param data The encoded data, including the flattened encoding tree and the compressed message bits.
  * @return A string containing the decompressed original message text.
  */
 string decompress(EncodedData& data) {
+    if (data.codebookId != 0)
+    {
+        return decodeWithCodebook(data.codebookId, data.messageBits);
+    }
     EncodingTreeNode* root = unflattenTree(data.treeShape, data.treeLeaves);
     string output = decodeText(root, data.messageBits);
     deallocateTree(root);
@@ -195,6 +209,44 @@ EncodingTreeNode* buildHuffmanTree(string text) {
     return pq.dequeue();
 }
 
+/**
+ * Constructs an optimal Huffman encoding tree from a histogram of byte values, where
+ * counts[b] is the number of times byte b occurs. This is the same algorithm as
+ * `buildHuffmanTree`, for callers that have already counted the characters of their text.
+ *
+ * Reports an error if fewer than two byte values have a nonzero count.
+ *
+ * @param counts The number of occurrences of each of the 256 byte values.
+ * @return A pointer to the root of the constructed Huffman encoding tree.
+ */
+EncodingTreeNode* buildHuffmanTreeFromCounts(const uint64_t counts[256]) {
+    PriorityQueue<EncodingTreeNode*> pq;
+    for (int c = 0; c < 256; c++)
+    {
+        if (counts[c] != 0)
+        {
+            pq.enqueue(new EncodingTreeNode(char(c)), counts[c]);
+        }
+    }
+    if (pq.size() < 2)
+    {
+        while (!pq.isEmpty())
+        {
+            deallocateTree(pq.dequeue());
+        }
+        error("Text must contain at least two distinct characters.");
+    }
+
+    while (pq.size() > 1)
+    {
+        double sum = pq.peekPriority();
+        EncodingTreeNode* zero = pq.dequeue();
+        sum += pq.peekPriority();
+        pq.enqueue(new EncodingTreeNode(zero, pq.dequeue()), sum);
+    }
+    return pq.dequeue();
+}
+
 /**
  * Recursively traverses the given encoding tree and builds a map that associates each character
  * with its corresponding Huffman encoding (represented as a binary string).
@@ -384,3 +436,24 @@ bool areEqual(EncodingTreeNode* a, EncodingTreeNode* b) {
     }
     return false;
 }
+
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("unflattenTree rebuilds the tree that was flattened, zero child first") {
+    EncodingTreeNode* tree = createExampleTree();
+    Queue<Bit> treeShape;
+    Queue<char> treeLeaves;
+    flattenTree(tree, treeShape, treeLeaves);
+    EncodingTreeNode* rebuilt = unflattenTree(treeShape, treeLeaves);
+    EXPECT(areEqual(tree, rebuilt));
+    deallocateTree(tree);
+    deallocateTree(rebuilt);
+}
+
+STUDENT_TEST("compress and decompress round-trip messages with and without a tree") {
+    for (const string& text: { string("TRESS"), string(3000, 'a') + string(2000, 'b') + "cde" }) {
+        EncodedData data = compress(text);
+        EXPECT_EQUAL(decompress(data), text);
+    }
+}
@@ -3,6 +3,7 @@
 #include "bits.h"
 #include "treenode.h"
 #include "queue.h"
+#include <cstdint>
 #include <string>
 
 
@@ -24,3 +25,8 @@ std::string decompress(EncodedData& data);
 EncodingTreeNode* createExampleTree();
 void deallocateTree(EncodingTreeNode* t);
 bool areEqual(EncodingTreeNode* a, EncodingTreeNode* b);
+
+
+// Additional routines beyond the required prototypes
+
+EncodingTreeNode* buildHuffmanTreeFromCounts(const uint64_t counts[256]);
@@ -0,0 +1,392 @@
+#include "interleaved.h"
+#include "bitstream.h"
+#include "codetable.h"
+#include "error.h"
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * Interleaved coding of blocks, and the choice between the AVX2 and scalar
+ * decoders. The public interface is provided in interleaved.h header file.
+ *
+ * The payload holds the code lengths as writeCodeLengths writes them, padded
+ * to a whole byte; the sizes in bytes of every stream but the last (4 bytes
+ * each, little-endian); and then the streams, one after another, each padded
+ * to a whole byte. Stream k codes bytes k * n to (k + 1) * n - 1 of the block,
+ * where n is the block size divided by kInterleavedStreams and rounded up, so
+ * the last streams may be shorter, or empty.
+ */
+
+namespace {
+    const size_t kTableSize = size_t(1) << kInterleavedMaxCodeLength;
+
+    /* Bytes in a stream size. */
+    const size_t kSizeBytes = 4;
+
+    /* Where one stream's bits lie in the payload, and where its bytes go. */
+    struct Stream {
+        size_t start;       // first payload byte
+        size_t size;        // payload bytes
+        size_t first;       // first output byte
+        size_t count;       // output bytes
+    };
+
+    /**
+     * Builds the decoding table for the given code lengths: every index whose
+     * low bits are a code holds that code's symbol << 8 | length. Indexes
+     * matching no code hold 0, which the decoders report as an invalid code.
+     */
+    vector<uint32_t> buildTable(const vector<uint8_t>& lengths) {
+        SymbolCode code = canonicalSymbolCode(lengths);
+        vector<uint32_t> table(kTableSize, 0);
+        for (int sym = 0; sym < int(lengths.size()); sym++) {
+            int len = lengths[sym];
+            if (len == 0) continue;
+            if (len > kInterleavedMaxCodeLength) {
+                error("Interleaved block has a code that is too long.");
+            }
+            for (uint32_t index = code.bits[sym]; index < kTableSize; index += 1U << len) {
+                table[index] = (uint32_t(sym) << 8) | len;
+            }
+        }
+        return table;
+    }
+
+    /**
+     * Decodes the bytes of a stream from the done-th on, starting at the
+     * given bit of the payload, one table lookup per byte.
+     */
+    void decodeStream(const uint32_t* table, const char* payload, const Stream& stream,
+                      uint64_t bit, size_t done, char* out) {
+        if (bit / 8 < stream.start || bit / 8 - stream.start > stream.size) {
+            error("Unexpected end of block when reading bits.");
+        }
+        size_t skipBytes = bit / 8 - stream.start;
+        BitStreamReader reader(payload + stream.start + skipBytes, stream.size - skipBytes);
+        reader.peek(bit % 8);
+        reader.skip(bit % 8);
+        for (size_t i = done; i < stream.count; i++) {
+            uint32_t entry = table[reader.peek(kInterleavedMaxCodeLength)];
+            if ((entry & 0xFF) == 0) {
+                error("Invalid Huffman code in block.");
+            }
+            reader.skip(entry & 0xFF);
+            out[stream.first + i] = char(entry >> 8);
+        }
+        reader.checkNotOverrun();
+    }
+
+    /**
+     * A decoder that takes every stream the same number of bytes forward at
+     * once, from the bits given in positions, for as long as it safely can.
+     * It updates positions and returns the number of bytes decoded from each
+     * stream, at most count.
+     */
+    typedef size_t (*LockstepFunction)(const uint32_t* table, const char* payload, size_t payloadSize,
+                                       const Stream* streams, size_t count, uint32_t* positions,
+                                       char* out);
+
+    /* Bytes each lane decodes between stores; each lane's bytes are packed into
+     * one 32-bit word. */
+    const int kGroupBytes = 4;
+
+    /* Bits beyond a lane's position that a group may read: the codes of the
+     * first two bytes, and the 32 bits gathered for the last two.
+     */
+    const uint32_t kGroupLookaheadBits = 2 * kInterleavedMaxCodeLength + 32;
+
+    /* Bit positions are held in signed 32-bit lanes. */
+    const size_t kMaxLockstepPayload = size_t(1) << 28;
+
+    size_t noLockstep(const uint32_t*, const char*, size_t, const Stream*, size_t, uint32_t*, char*) {
+        return 0;
+    }
+
+#if defined(__x86_64__)
+    __attribute__((target("avx2")))
+    size_t avx2Lockstep(const uint32_t* table, const char* payload, size_t payloadSize,
+                        const Stream* streams, size_t count, uint32_t* positions, char* out) {
+        static_assert(kInterleavedStreams == 8, "one stream per 32-bit lane");
+        if (payloadSize * 8 < kGroupLookaheadBits || payloadSize > kMaxLockstepPayload) return 0;
+
+        /* No gather in a group reads past the payload while every lane starts
+         * the group at or below this bit.
+         */
+        const __m256i limit = _mm256_set1_epi32(int32_t(payloadSize * 8 - kGroupLookaheadBits));
+        const __m256i lowBits = _mm256_set1_epi32(7);
+        const __m256i indexMask = _mm256_set1_epi32(int32_t(kTableSize - 1));
+        const __m256i lengthMask = _mm256_set1_epi32(0xFF);
+        const __m256i zero = _mm256_setzero_si256();
+        const int* bytes = reinterpret_cast<const int*>(payload);
+        const int* entries = reinterpret_cast<const int*>(table);
+
+        __m256i pos = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(positions));
+        __m256i invalid = zero;
+        size_t done = 0;
+        while (done + kGroupBytes <= count &&
+               _mm256_movemask_epi8(_mm256_cmpgt_epi32(pos, limit)) == 0) {
+            __m256i packed = zero;
+            for (int i = 0; i < kGroupBytes; i += 2) {
+                /* The next bits of every stream, lowest first: at least 25 of
+                 * them, enough for two codes.
+                 */
+                __m256i bits = _mm256_i32gather_epi32(bytes, _mm256_srli_epi32(pos, 3), 1);
+                bits = _mm256_srlv_epi32(bits, _mm256_and_si256(pos, lowBits));
+                for (int j = i; j < i + 2; j++) {
+                    __m256i entry = _mm256_i32gather_epi32(entries, _mm256_and_si256(bits, indexMask), 4);
+                    __m256i length = _mm256_and_si256(entry, lengthMask);
+                    invalid = _mm256_or_si256(invalid, _mm256_cmpeq_epi32(length, zero));
+                    bits = _mm256_srlv_epi32(bits, length);
+                    pos = _mm256_add_epi32(pos, length);
+                    __m256i symbol = _mm256_srli_epi32(entry, 8);
+                    packed = _mm256_or_si256(packed, _mm256_sll_epi32(symbol, _mm_cvtsi32_si128(8 * j)));
+                }
+            }
+
+            /* AVX2 has no scatter, so each lane's four bytes are stored in turn. */
+            alignas(32) uint32_t words[kInterleavedStreams];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(words), packed);
+            for (int k = 0; k < kInterleavedStreams; k++) {
+                memcpy(out + streams[k].first + done, &words[k], kGroupBytes);   // assumes little-endian
+            }
+            done += kGroupBytes;
+        }
+        if (!_mm256_testz_si256(invalid, invalid)) {
+            error("Invalid Huffman code in block.");
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(positions), pos);
+        return done;
+    }
+
+    bool lockstepAvailable() {
+        return __builtin_cpu_supports("avx2");
+    }
+
+    LockstepFunction chosenLockstep() {
+        static const LockstepFunction chosen = lockstepAvailable() ? avx2Lockstep : noLockstep;
+        return chosen;
+    }
+#else
+    bool lockstepAvailable() {
+        return false;
+    }
+
+    LockstepFunction chosenLockstep() {
+        return noLockstep;
+    }
+#endif
+
+    uint32_t readSize(const char* data) {
+        uint32_t value = 0;
+        for (size_t i = 0; i < kSizeBytes; i++) {
+            value |= uint32_t(uint8_t(data[i])) << (8 * i);
+        }
+        return value;
+    }
+}
+
+void encodeInterleaved(const char* text, size_t size, const vector<uint8_t>& lengths, string& out) {
+    SymbolCode code = canonicalSymbolCode(lengths);
+    BitStreamWriter header(out);
+    writeCodeLengths(header, lengths);
+    header.flush();
+
+    size_t sizesAt = out.size();
+    out.append(kSizeBytes * (kInterleavedStreams - 1), '\0');
+    size_t perStream = (size + kInterleavedStreams - 1) / kInterleavedStreams;
+    for (int k = 0; k < kInterleavedStreams; k++) {
+        size_t start = out.size();
+        size_t first = min(k * perStream, size);
+        size_t last = min(first + perStream, size);
+        BitStreamWriter writer(out);
+        for (size_t i = first; i < last; i++) {
+            uint8_t byte = text[i];
+            writer.put(code.bits[byte], code.length[byte]);
+        }
+        writer.flush();
+
+        if (k < kInterleavedStreams - 1) {
+            uint64_t streamBytes = out.size() - start;
+            if (streamBytes > UINT32_MAX) {
+                error("Block is too large for interleaved coding.");
+            }
+            for (size_t i = 0; i < kSizeBytes; i++) {
+                out[sizesAt + kSizeBytes * k + i] = char(streamBytes >> (8 * i));
+            }
+        }
+    }
+}
+
+void decodeInterleaved(const char* payload, size_t payloadSize, char* out, size_t size) {
+    BitStreamReader header(payload, payloadSize);
+    vector<uint32_t> table = buildTable(readCodeLengths(header, 256));
+    header.checkNotOverrun();
+
+    /* Find every stream, checking that they fit in the payload. */
+    size_t pos = (header.position() + 7) / 8;
+    if (payloadSize - pos < kSizeBytes * (kInterleavedStreams - 1)) {
+        error("Unexpected end of block.");
+    }
+    Stream streams[kInterleavedStreams];
+    size_t next = pos + kSizeBytes * (kInterleavedStreams - 1);
+    size_t perStream = (size + kInterleavedStreams - 1) / kInterleavedStreams;
+    for (int k = 0; k < kInterleavedStreams; k++) {
+        Stream& stream = streams[k];
+        stream.start = next;
+        if (k < kInterleavedStreams - 1) {
+            stream.size = readSize(payload + pos + kSizeBytes * k);
+            if (stream.size > payloadSize - next) {
+                error("Interleaved stream extends past the end of its block.");
+            }
+        } else {
+            stream.size = payloadSize - next;
+        }
+        stream.first = min(k * perStream, size);
+        stream.count = min(stream.first + perStream, size) - stream.first;
+        next += stream.size;
+    }
+
+    /* The last stream is the shortest, so every stream has that many bytes to
+     * decode in lockstep; whatever the vector decoder leaves is finished a
+     * stream at a time.
+     */
+    uint32_t positions[kInterleavedStreams];
+    for (int k = 0; k < kInterleavedStreams; k++) {
+        positions[k] = uint32_t(streams[k].start * 8);
+    }
+    size_t done = chosenLockstep()(table.data(), payload, payloadSize, streams,
+                                   streams[kInterleavedStreams - 1].count, positions, out);
+    for (int k = 0; k < kInterleavedStreams; k++) {
+        uint64_t bit = done == 0 ? uint64_t(streams[k].start) * 8 : positions[k];
+        decodeStream(table.data(), payload, streams[k], bit, done, out);
+    }
+}
+
+bool interleavedAccelerated() {
+    return lockstepAvailable();
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+namespace {
+    /* Letters drawn at random, about as often as in English. */
+    string weightedLetters(size_t size, unsigned seed) {
+        const string letters = "eeeeeeeetttttaaaaooooiiinnnsshhrrdlcumwfgypbvk  \n";
+        mt19937 random(seed);
+        string text;
+        while (text.size() < size) {
+            text += letters[random() % letters.size()];
+        }
+        return text;
+    }
+
+    /* Code lengths that give every byte of text a code, as the container
+     * would build them. */
+    vector<uint8_t> lengthsFor(const string& text) {
+        vector<uint64_t> counts(256, 0);
+        counts['e']++;
+        for (char ch: text) {
+            counts[uint8_t(ch)]++;
+        }
+        return codeLengthsFromCounts(counts, kInterleavedMaxCodeLength);
+    }
+
+    string encoded(const string& text) {
+        string payload;
+        encodeInterleaved(text.data(), text.size(), lengthsFor(text), payload);
+        return payload;
+    }
+
+    string decoded(const string& payload, size_t size) {
+        string text(size, '\0');
+        decodeInterleaved(payload.data(), payload.size(), &text[0], size);
+        return text;
+    }
+}
+
+STUDENT_TEST("Interleaved blocks of every size up to a few groups per stream round-trip") {
+    string text = weightedLetters(300, 1);
+    for (size_t size = 0; size <= text.size(); size++) {
+        string block = text.substr(0, size);
+        EXPECT_EQUAL(decoded(encoded(block), size), block);
+    }
+}
+
+STUDENT_TEST("Large interleaved blocks round-trip, whichever decoder is in use") {
+    /* The vector decoder stops a little before the end of the payload, and
+     * stops at a multiple of four bytes, so the scalar decoder finishes a
+     * different amount of every block. */
+    for (size_t size: { 1000, 4099, 65536, 100003 }) {
+        string text = weightedLetters(size, unsigned(size));
+        EXPECT_EQUAL(decoded(encoded(text), size), text);
+    }
+}
+
+STUDENT_TEST("Interleaved blocks with codes of the longest allowed length round-trip") {
+    /* Fibonacci counts give the deepest possible tree, so the length limit
+     * is reached. */
+    vector<uint64_t> counts(256, 0);
+    uint64_t a = 1, b = 1;
+    for (int ch = 0; ch < 30; ch++) {
+        counts['A' + ch] = a;
+        uint64_t next = a + b;
+        a = b;
+        b = next;
+    }
+    vector<uint8_t> lengths = codeLengthsFromCounts(counts, kInterleavedMaxCodeLength);
+    EXPECT_EQUAL(int(*max_element(lengths.begin(), lengths.end())), kInterleavedMaxCodeLength);
+
+    mt19937 random(2);
+    string text;
+    for (int i = 0; i < 20000; i++) {
+        text += char('A' + random() % 30);
+    }
+    string payload;
+    encodeInterleaved(text.data(), text.size(), lengths, payload);
+    EXPECT_EQUAL(decoded(payload, text.size()), text);
+}
+
+STUDENT_TEST("Codes longer than the table are refused") {
+    vector<uint8_t> lengths(256, 0);
+    lengths['a'] = 1;
+    lengths['b'] = kInterleavedMaxCodeLength + 1;
+    string payload;
+    encodeInterleaved("ab", 2, lengths, payload);
+    EXPECT_ERROR(decoded(payload, 2));
+}
+
+STUDENT_TEST("Truncated interleaved blocks are reported") {
+    string text = weightedLetters(500, 3);
+    string payload = encoded(text);
+    for (size_t size = 0; size < payload.size(); size++) {
+        EXPECT_ERROR(decoded(payload.substr(0, size), text.size()));
+    }
+}
+
+STUDENT_TEST("Damaged interleaved blocks never write past the block") {
+    for (size_t size: { 100, 5000 }) {
+        string text = weightedLetters(size, 4);
+        string payload = encoded(text);
+        for (size_t i = 0; i < payload.size(); i += max(size_t(1), payload.size() / 500)) {
+            string damaged = payload;
+            damaged[i] ^= 0x21;
+            string out(size + 64, '#');
+            try {
+                decodeInterleaved(damaged.data(), damaged.size(), &out[0], size);
+            } catch (ErrorException&) {
+                /* Reporting the damage is just as good. */
+            }
+            EXPECT_EQUAL(out.substr(size), string(64, '#'));
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Interleaved Huffman coding, used by the container for its Interleaved block
+ * method. The block is cut into kInterleavedStreams equal pieces and each piece
+ * is coded as its own bit stream with one shared code, so the streams can be
+ * decoded side by side. Decoding one stream is a chain of dependent table
+ * lookups; eight independent chains keep the processor busy while each lookup
+ * waits on memory.
+ *
+ * On x86-64 processors with AVX2, the eight stream positions are held in the
+ * lanes of one vector register: each step gathers the next bits of all eight
+ * streams, looks up eight table entries with a second gather, and advances
+ * every position at once. Elsewhere the streams are decoded one at a time.
+ * The choice is made once, at run time, and both give the same bytes.
+ *
+ * So that every code resolves with a single lookup, codes are limited to
+ * kInterleavedMaxCodeLength bits, which costs very little on real data.
+ */
+
+const int kInterleavedStreams = 8;
+const int kInterleavedMaxCodeLength = 11;
+
+/* Largest block coded this way, so that the vector decoder can hold bit
+ * positions in 32-bit lanes.
+ */
+const size_t kInterleavedMaxBlockSize = size_t(1) << 27;
+
+/* Payload bytes beyond the code lengths and coded bits: the stream sizes, and
+ * at most the padding of each stream to a whole byte.
+ */
+const int kInterleavedOverheadBytes = 4 * (kInterleavedStreams - 1) + kInterleavedStreams;
+
+/**
+ * Codes size bytes of text with the given code lengths, which must be at most
+ * kInterleavedMaxCodeLength bits and give every byte of text a code, appending
+ * the payload to out.
+ */
+void encodeInterleaved(const char* text, size_t size, const std::vector<uint8_t>& lengths,
+                       std::string& out);
+
+/**
+ * Decodes a payload written by encodeInterleaved into exactly size bytes at
+ * out. Reports an error if the payload is malformed.
+ */
+void decodeInterleaved(const char* payload, size_t payloadSize, char* out, size_t size);
+
+/**
+ * Returns whether decodeInterleaved uses AVX2 rather than scalar code.
+ */
+bool interleavedAccelerated();
@@ -0,0 +1,338 @@
+#include "ioqueue.h"
+#include "error.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * io_uring and its fallback. The public interface is provided in ioqueue.h
+ * header file.
+ */
+
+namespace {
+    const int kReadOp = 0;
+    const int kWriteOp = 1;
+
+    /* The fallback: one blocking transfer, retried if interrupted. */
+    int64_t transfer(int opcode, int fd, char* buffer, size_t size, uint64_t offset) {
+        while (true) {
+#if defined(_WIN32)
+            if (_lseeki64(fd, offset, SEEK_SET) < 0) return -errno;
+            int64_t done = opcode == kReadOp ? _read(fd, buffer, unsigned(size))
+                                             : _write(fd, buffer, unsigned(size));
+#else
+            int64_t done = opcode == kReadOp ? pread(fd, buffer, size, offset)
+                                             : pwrite(fd, buffer, size, offset);
+#endif
+            if (done >= 0) return done;
+            if (errno != EINTR) return -errno;
+        }
+    }
+}
+
+#if defined(__linux__)
+
+/**
+ * The three shared memory areas of an io_uring: the submission ring of indexes
+ * into the submission entries, the entries themselves, and the completion
+ * ring. Heads and tails are shared with the kernel, so they are read and
+ * written with acquire and release ordering.
+ */
+struct IoQueue::Ring {
+    int fd = -1;
+    void* sqMemory = MAP_FAILED;
+    size_t sqBytes = 0;
+    void* cqMemory = MAP_FAILED;
+    size_t cqBytes = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqeBytes = 0;
+
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    io_uring_cqe* cqes;
+
+    ~Ring() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqeBytes);
+        if (cqMemory != MAP_FAILED && cqMemory != sqMemory) munmap(cqMemory, cqBytes);
+        if (sqMemory != MAP_FAILED) munmap(sqMemory, sqBytes);
+        if (fd >= 0) close(fd);
+    }
+
+    /* Returns false, leaving the ring unusable, if io_uring is unavailable. */
+    bool open(unsigned entries) {
+        io_uring_params params;
+        memset(&params, 0, sizeof params);
+        fd = int(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) return false;
+
+        /* Plain reads and writes arrived in the same kernel (5.6) as this
+         * feature; earlier rings would refuse them.
+         */
+        if (!(params.features & IORING_FEAT_RW_CUR_POS)) return false;
+
+        sqBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            sqBytes = cqBytes = max(sqBytes, cqBytes);
+        }
+        sqMemory = mmap(nullptr, sqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_SQ_RING);
+        if (sqMemory == MAP_FAILED) return false;
+        cqMemory = single ? sqMemory
+                          : mmap(nullptr, cqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                 fd, IORING_OFF_CQ_RING);
+        if (cqMemory == MAP_FAILED) return false;
+        sqeBytes = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqeBytes, PROT_READ | PROT_WRITE,
+                                               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) return false;
+
+        char* sq = static_cast<char*>(sqMemory);
+        char* cq = static_cast<char*>(cqMemory);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    void push(int opcode, int fd, char* buffer, size_t size, uint64_t offset, uint64_t tag) {
+        unsigned tail = *sqTail;   // only this side moves the tail
+        unsigned index = tail & *sqMask;
+        io_uring_sqe& sqe = sqes[index];
+        memset(&sqe, 0, sizeof sqe);
+        sqe.opcode = opcode == kReadOp ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer);
+        sqe.len = unsigned(size);
+        sqe.off = offset;
+        sqe.user_data = tag;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    bool pop(IoCompletion& completion) {
+        unsigned head = *cqHead;   // only this side moves the head
+        if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) return false;
+        const io_uring_cqe& cqe = cqes[head & *cqMask];
+        completion.tag = cqe.user_data;
+        completion.result = cqe.res;
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /* Submits count entries, and waits for a completion if wait is set.
+     * Returns how many entries the kernel took.
+     */
+    unsigned enter(unsigned count, bool wait) {
+        while (true) {
+            long taken = syscall(__NR_io_uring_enter, fd, count, wait ? 1 : 0,
+                                 wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (taken >= 0) return unsigned(taken);
+            if (errno != EINTR) {
+                error("io_uring submission failed: " + string(strerror(errno)));
+            }
+        }
+    }
+};
+
+IoQueue::IoQueue(unsigned depth)
+    : _ring(new Ring), _depth(depth), _outstanding(0), _unsubmitted(0) {
+    if (depth == 0) {
+        delete _ring;
+        error("I/O queue depth must be positive.");
+    }
+    if (!_ring->open(depth)) {
+        delete _ring;
+        _ring = nullptr;
+    }
+}
+
+#else
+
+struct IoQueue::Ring {};
+
+IoQueue::IoQueue(unsigned depth)
+    : _ring(nullptr), _depth(depth), _outstanding(0), _unsubmitted(0) {
+    if (depth == 0) {
+        error("I/O queue depth must be positive.");
+    }
+}
+
+#endif
+
+IoQueue::~IoQueue() {
+    /* The kernel may still write into buffers of outstanding reads. */
+    while (_outstanding > 0) {
+        wait();
+    }
+    delete _ring;
+}
+
+bool IoQueue::usesIoUring() const {
+    return _ring != nullptr;
+}
+
+unsigned IoQueue::outstanding() const {
+    return _outstanding;
+}
+
+unsigned IoQueue::depth() const {
+    return _depth;
+}
+
+void IoQueue::read(int fd, char* buffer, size_t size, uint64_t offset, uint64_t tag) {
+    queue(kReadOp, fd, buffer, size, offset, tag);
+}
+
+void IoQueue::write(int fd, const char* buffer, size_t size, uint64_t offset, uint64_t tag) {
+    queue(kWriteOp, fd, const_cast<char*>(buffer), size, offset, tag);
+}
+
+void IoQueue::queue(int opcode, int fd, char* buffer, size_t size, uint64_t offset, uint64_t tag) {
+    if (_outstanding == _depth) {
+        error("Too many I/O requests outstanding.");
+    }
+    _outstanding++;
+#if defined(__linux__)
+    if (_ring) {
+        _ring->push(opcode, fd, buffer, size, offset, tag);
+        _unsubmitted++;
+        return;
+    }
+#endif
+    IoCompletion completion = { tag, transfer(opcode, fd, buffer, size, offset) };
+    _finished.push_back(completion);
+}
+
+void IoQueue::submit() {
+#if defined(__linux__)
+    if (_ring && _unsubmitted > 0) {
+        _unsubmitted -= _ring->enter(_unsubmitted, false);
+    }
+#endif
+}
+
+IoCompletion IoQueue::wait() {
+    if (_outstanding == 0) {
+        error("Waiting for I/O with none outstanding.");
+    }
+    IoCompletion completion;
+#if defined(__linux__)
+    if (_ring) {
+        while (!_ring->pop(completion)) {
+            _unsubmitted -= _ring->enter(_unsubmitted, true);
+        }
+        _outstanding--;
+        return completion;
+    }
+#endif
+    completion = _finished.front();
+    _finished.pop_front();
+    _outstanding--;
+    return completion;
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+#if !defined(_WIN32)
+
+namespace {
+    /* A temporary file open for reading and writing, removed when done. */
+    struct TestFile {
+        string path;
+        int fd;
+
+        TestFile() {
+            char pattern[] = "/tmp/ioqueue-test-XXXXXX";
+            fd = mkstemp(pattern);
+            path = pattern;
+        }
+
+        ~TestFile() {
+            close(fd);
+            unlink(path.c_str());
+        }
+    };
+}
+
+STUDENT_TEST("IoQueue writes and reads back at the offsets given") {
+    TestFile file;
+    IoQueue queue(4);
+    string first = "first block ";
+    string second = "second block";
+    queue.write(file.fd, second.data(), second.size(), first.size(), 2);
+    queue.write(file.fd, first.data(), first.size(), 0, 1);
+    EXPECT_EQUAL(queue.outstanding(), 2U);
+    uint64_t tags = 0;
+    for (int i = 0; i < 2; i++) {
+        IoCompletion done = queue.wait();
+        tags |= done.tag;
+        EXPECT_EQUAL(done.result, int64_t(done.tag == 1 ? first.size() : second.size()));
+    }
+    EXPECT_EQUAL(tags, uint64_t(3));
+    EXPECT_EQUAL(queue.outstanding(), 0U);
+
+    string contents(first.size() + second.size(), '\0');
+    queue.read(file.fd, &contents[0], contents.size(), 0, 7);
+    queue.submit();
+    IoCompletion done = queue.wait();
+    EXPECT_EQUAL(done.tag, uint64_t(7));
+    EXPECT_EQUAL(done.result, int64_t(contents.size()));
+    EXPECT_EQUAL(contents, first + second);
+}
+
+STUDENT_TEST("IoQueue reports reads past the end and failed transfers as results") {
+    TestFile file;
+    IoQueue queue(2);
+    char buffer[16];
+    queue.read(file.fd, buffer, sizeof buffer, 0, 1);
+    EXPECT_EQUAL(queue.wait().result, int64_t(0));
+
+    int readOnly = open(file.path.c_str(), O_RDONLY);
+    queue.write(readOnly, "text", 4, 0, 2);
+    IoCompletion done = queue.wait();
+    EXPECT_EQUAL(done.tag, uint64_t(2));
+    EXPECT_EQUAL(done.result, -int64_t(EBADF));
+    close(readOnly);
+}
+
+STUDENT_TEST("IoQueue reports misuse") {
+    EXPECT_ERROR(IoQueue queue(0));
+
+    TestFile file;
+    IoQueue queue(1);
+    EXPECT_EQUAL(queue.depth(), 1U);
+    EXPECT_ERROR(queue.wait());
+    queue.write(file.fd, "a", 1, 0, 1);
+    EXPECT_ERROR(queue.write(file.fd, "b", 1, 1, 2));
+    EXPECT_EQUAL(queue.wait().result, int64_t(1));
+}
+
+#endif
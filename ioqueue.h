@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+/**
+ * A queue of file reads and writes that run while the caller does other work.
+ *
+ * On Linux 5.6 and later the queue is an io_uring, set up with the raw system
+ * calls so no extra library is needed: requests are handed to the kernel in one call and
+ * complete in the background. Where io_uring is missing or not permitted (old
+ * kernels, some containers, other systems) the same interface is served by
+ * plain pread and pwrite, each done as it is queued.
+ *
+ *     IoQueue queue(8);
+ *     queue.read(fd, buffer, size, offset, tag);
+ *     queue.submit();
+ *     ... code something else ...
+ *     IoCompletion done = queue.wait();
+ */
+
+/**
+ * A finished request: the tag it was queued with, and the number of bytes
+ * transferred, or minus the error number if it failed.
+ */
+struct IoCompletion {
+    uint64_t tag;
+    int64_t result;
+};
+
+class IoQueue {
+public:
+    /* Allows up to depth requests outstanding at once. */
+    explicit IoQueue(unsigned depth);
+    ~IoQueue();
+
+    IoQueue(const IoQueue&) = delete;
+    IoQueue& operator=(const IoQueue&) = delete;
+
+    /* Whether requests go through io_uring rather than pread and pwrite. */
+    bool usesIoUring() const;
+
+    /* Number of requests queued whose completion has not been collected. */
+    unsigned outstanding() const;
+    unsigned depth() const;
+
+    /* Queue a transfer of size bytes at offset in the file. The buffer must
+     * stay put until its completion is collected. Reports an error if depth
+     * requests are already outstanding.
+     */
+    void read(int fd, char* buffer, size_t size, uint64_t offset, uint64_t tag);
+    void write(int fd, const char* buffer, size_t size, uint64_t offset, uint64_t tag);
+
+    /* Hands queued requests to the kernel without waiting for any. */
+    void submit();
+
+    /* Submits anything queued and returns the next completion, waiting for
+     * one if none has finished. Reports an error if nothing is outstanding.
+     */
+    IoCompletion wait();
+
+private:
+    struct Ring;
+
+    void queue(int opcode, int fd, char* buffer, size_t size, uint64_t offset, uint64_t tag);
+
+    Ring* _ring;           // null when using the fallback
+    unsigned _depth;
+    unsigned _outstanding;
+    unsigned _unsubmitted;
+    std::deque<IoCompletion> _finished;   // fallback completions
+};
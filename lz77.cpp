@@ -0,0 +1,350 @@
+#include "lz77.h"
+#include "bitstream.h"
+#include "codetable.h"
+#include "error.h"
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * Hash-chain LZ77 parsing and its entropy coding. The public interface is
+ * provided in lz77.h header file.
+ *
+ * Match lengths (minus kLzMinMatch) and distances (minus one) are coded as
+ * buckets (see toBucket in codetable.h). Literals and length buckets share one
+ * code, so a single lookup tells the decoder which one comes next.
+ */
+
+namespace {
+    /* Buckets needed for values up to kLzMaxMatch and kLzMaxDistance. */
+    const int kLengthBuckets = 24;
+    const int kDistanceBuckets = 36;
+    const int kLiteralLengthSymbols = 256 + kLengthBuckets;
+
+    /* Hash chains are indexed by the hash of the next kLzMinMatch bytes. */
+    const int kHashBits = 16;
+
+    /* Positions are remembered for twice the match distance, so a chain never
+     * reaches an entry that has been overwritten by a newer position.
+     */
+    const size_t kChainWindow = 2 * kLzMaxDistance;
+
+    struct LevelSettings {
+        int  chainLimit;   // most candidates to examine for each match
+        int  niceLength;   // stop searching once a match is this long
+        bool lazy;         // check whether a match one byte later is longer
+    };
+
+    const LevelSettings kLevels[kLzMaxLevel + 1] = {
+        {    0,    0, false },
+        {    4,   16, false },
+        {    8,   32, false },
+        {   16,   64, false },
+        {   16,   64, true  },
+        {   32,  128, true  },
+        {   64,  256, true  },
+        {  128,  512, true  },
+        {  512, 1024, true  },
+        { 4096, kLzMaxMatch, true },
+    };
+
+    /* A literal (distance 0, value is the byte) or a match. */
+    struct Token {
+        uint32_t value;
+        uint32_t distance;
+    };
+
+    class MatchFinder {
+    public:
+        MatchFinder(const uint8_t* text, size_t size)
+            : _text(text), _size(size), _head(size_t(1) << kHashBits, -1),
+              _prev(min(size, kChainWindow), -1) {}
+
+        /* Adds every position before end to the hash chains. */
+        void insertUpTo(size_t end) {
+            for (; _inserted < end && _inserted + kLzMinMatch <= _size; _inserted++) {
+                int32_t& head = _head[hash(_inserted)];
+                _prev[_inserted % kChainWindow] = head;
+                head = int32_t(_inserted);
+            }
+            _inserted = max(_inserted, end);
+        }
+
+        /**
+         * Returns the length of the longest match for the bytes at pos among
+         * earlier positions, storing its distance. Lengths below kLzMinMatch
+         * mean there is no usable match.
+         */
+        int longestMatch(size_t pos, const LevelSettings& settings, uint32_t& distance) {
+            if (pos + kLzMinMatch > _size) return 0;
+
+            int maxLength = int(min<size_t>(kLzMaxMatch, _size - pos));
+            int best = kLzMinMatch - 1;
+            int32_t candidate = _head[hash(pos)];
+            for (int chain = settings.chainLimit; chain > 0 && candidate >= 0; chain--) {
+                if (pos - candidate > size_t(kLzMaxDistance)) break;
+
+                if (_text[candidate + best] == _text[pos + best]) {
+                    int length = matchLength(candidate, pos, maxLength);
+                    if (length > best) {
+                        best = length;
+                        distance = uint32_t(pos - candidate);
+                        if (length >= settings.niceLength || length == maxLength) break;
+                    }
+                }
+
+                int32_t next = _prev[candidate % kChainWindow];
+                if (next >= candidate) break;
+                candidate = next;
+            }
+            return best;
+        }
+
+    private:
+        uint32_t hash(size_t pos) const {
+            uint32_t word;
+            memcpy(&word, _text + pos, sizeof word);
+            return (word * 2654435761U) >> (32 - kHashBits);
+        }
+
+        int matchLength(size_t from, size_t pos, int maxLength) const {
+            int length = 0;
+            while (length + 8 <= maxLength) {
+                uint64_t a, b;
+                memcpy(&a, _text + from + length, sizeof a);
+                memcpy(&b, _text + pos + length, sizeof b);
+                if (a != b) {
+                    return length + __builtin_ctzll(a ^ b) / 8;   // assumes little-endian
+                }
+                length += 8;
+            }
+            while (length < maxLength && _text[from + length] == _text[pos + length]) {
+                length++;
+            }
+            return length;
+        }
+
+        const uint8_t* _text;
+        size_t _size;
+        size_t _inserted = 0;
+        vector<int32_t> _head;
+        vector<int32_t> _prev;
+    };
+
+    /**
+     * Parses the text into literals and matches.
+     */
+    vector<Token> parse(const uint8_t* text, size_t size, const LevelSettings& settings) {
+        vector<Token> tokens;
+        tokens.reserve(size / 4);
+        MatchFinder finder(text, size);
+
+        size_t pos = 0;
+        while (pos < size) {
+            finder.insertUpTo(pos);
+            uint32_t distance = 0;
+            int length = finder.longestMatch(pos, settings, distance);
+
+            /* If the next position has a longer match, emit this byte as a
+             * literal and take that match instead.
+             */
+            while (settings.lazy && length >= kLzMinMatch && length < settings.niceLength) {
+                finder.insertUpTo(pos + 1);
+                uint32_t nextDistance = 0;
+                int nextLength = finder.longestMatch(pos + 1, settings, nextDistance);
+                if (nextLength <= length) break;
+
+                tokens.push_back({ text[pos], 0 });
+                pos++;
+                length = nextLength;
+                distance = nextDistance;
+            }
+
+            if (length >= kLzMinMatch) {
+                tokens.push_back({ uint32_t(length), distance });
+                pos += length;
+            } else {
+                tokens.push_back({ text[pos], 0 });
+                pos++;
+            }
+        }
+        return tokens;
+    }
+}
+
+void encodeLz77(const char* text, size_t size, int level, string& out) {
+    if (level < kLzMinLevel || level > kLzMaxLevel) {
+        error("LZ77 level must be between " + to_string(kLzMinLevel) + " and " +
+              to_string(kLzMaxLevel) + ".");
+    }
+    vector<Token> tokens = parse(reinterpret_cast<const uint8_t*>(text), size, kLevels[level]);
+
+    vector<uint64_t> literalCounts(kLiteralLengthSymbols, 0);
+    vector<uint64_t> distanceCounts(kDistanceBuckets, 0);
+    int bucket, extraBits;
+    uint32_t extra;
+    for (const Token& token: tokens) {
+        if (token.distance == 0) {
+            literalCounts[token.value]++;
+        } else {
+            toBucket(token.value - kLzMinMatch, bucket, extraBits, extra);
+            literalCounts[256 + bucket]++;
+            toBucket(token.distance - 1, bucket, extraBits, extra);
+            distanceCounts[bucket]++;
+        }
+    }
+
+    vector<uint8_t> literalLengths = codeLengthsFromCounts(literalCounts, kMaxBlockCodeLength);
+    vector<uint8_t> distanceLengths = codeLengthsFromCounts(distanceCounts, kMaxBlockCodeLength);
+    SymbolCode literalCode = canonicalSymbolCode(literalLengths);
+    SymbolCode distanceCode = canonicalSymbolCode(distanceLengths);
+
+    BitStreamWriter writer(out);
+    writeCodeLengths(writer, literalLengths);
+    writeCodeLengths(writer, distanceLengths);
+    for (const Token& token: tokens) {
+        if (token.distance == 0) {
+            writer.put(literalCode.bits[token.value], literalCode.length[token.value]);
+            continue;
+        }
+        toBucket(token.value - kLzMinMatch, bucket, extraBits, extra);
+        writer.put(literalCode.bits[256 + bucket], literalCode.length[256 + bucket]);
+        writer.put(extra, extraBits);
+        toBucket(token.distance - 1, bucket, extraBits, extra);
+        writer.put(distanceCode.bits[bucket], distanceCode.length[bucket]);
+        writer.put(extra, extraBits);
+    }
+    writer.flush();
+}
+
+void decodeLz77(const char* payload, size_t payloadSize, char* out, size_t size) {
+    BitStreamReader reader(payload, payloadSize);
+    TableDecoder literals(readCodeLengths(reader, kLiteralLengthSymbols));
+    TableDecoder distances(readCodeLengths(reader, kDistanceBuckets));
+
+    size_t pos = 0;
+    while (pos < size) {
+        int symbol = literals.decode(reader);
+        if (symbol < 256) {
+            out[pos++] = char(symbol);
+            continue;
+        }
+
+        size_t length = kLzMinMatch + fromBucket(symbol - 256, reader);
+        size_t distance = 1 + fromBucket(distances.decode(reader), reader);
+        if (distance > pos || length > size - pos) {
+            error("Invalid match in LZ77 block.");
+        }
+
+        /* Copy in pieces no longer than the distance, so that each piece's
+         * source has already been written when the match overlaps itself.
+         */
+        char* dest = out + pos;
+        if (distance == 1) {
+            memset(dest, dest[-1], length);
+        } else {
+            for (size_t done = 0; done < length; ) {
+                size_t piece = min(distance, length - done);
+                memcpy(dest + done, dest + done - distance, piece);
+                done += piece;
+            }
+        }
+        pos += length;
+    }
+    reader.checkNotOverrun();
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+namespace {
+    string encodedLz77(const string& text, int level = kLzDefaultLevel) {
+        string payload;
+        encodeLz77(text.data(), text.size(), level, payload);
+        return payload;
+    }
+
+    string decodedLz77(const string& payload, size_t size) {
+        string text(size, '\0');
+        decodeLz77(payload.data(), payload.size(), &text[0], size);
+        return text;
+    }
+
+    string randomText(size_t size, unsigned seed) {
+        mt19937 random(seed);
+        string text;
+        while (text.size() < size) {
+            text += char('a' + random() % 26);
+        }
+        return text;
+    }
+}
+
+STUDENT_TEST("LZ77 round-trips at every level") {
+    string phrases;
+    for (int i = 0; i < 200; i++) {
+        phrases += "It was the best of times, it was the worst of times. " + to_string(i * i);
+    }
+    vector<string> inputs = {
+        "", "a", "abcd", "abcabcabcabc", string(100000, 'z'), randomText(5000, 1), phrases
+    };
+    for (int level = kLzMinLevel; level <= kLzMaxLevel; level++) {
+        for (const string& text: inputs) {
+            EXPECT_EQUAL(decodedLz77(encodedLz77(text, level), text.size()), text);
+        }
+    }
+}
+
+STUDENT_TEST("LZ77 finds matches as long and as far back as allowed") {
+    string runs(10 * kLzMaxMatch, 'z');
+    EXPECT(encodedLz77(runs).size() < 100);
+
+    /* The second copy is exactly kLzMaxDistance bytes after the first. */
+    string first = randomText(2000, 2);
+    string text = first + randomText(kLzMaxDistance - first.size(), 3) + first;
+    string payload = encodedLz77(text, kLzMaxLevel);
+    EXPECT_EQUAL(decodedLz77(payload, text.size()), text);
+    EXPECT(payload.size() < encodedLz77(text.substr(0, kLzMaxDistance), kLzMaxLevel).size() + 100);
+}
+
+STUDENT_TEST("Higher LZ77 levels never do much worse") {
+    string text;
+    for (int i = 0; i < 2000; i++) {
+        text += randomText(8, i % 97) + " ";
+    }
+    EXPECT(encodedLz77(text, kLzMaxLevel).size() <= encodedLz77(text, kLzMinLevel).size());
+}
+
+STUDENT_TEST("LZ77 levels outside the range are reported") {
+    EXPECT_ERROR(encodedLz77("text", kLzMinLevel - 1));
+    EXPECT_ERROR(encodedLz77("text", kLzMaxLevel + 1));
+}
+
+STUDENT_TEST("Truncated LZ77 payloads are reported") {
+    string text = randomText(2000, 4) + randomText(2000, 4);
+    string payload = encodedLz77(text);
+    for (size_t size = 0; size < payload.size(); size++) {
+        EXPECT_ERROR(decodedLz77(payload.substr(0, size), text.size()));
+    }
+}
+
+STUDENT_TEST("Damaged LZ77 payloads never write past the block") {
+    string text = randomText(1000, 5) + randomText(1000, 5) + string(500, 'q');
+    string payload = encodedLz77(text);
+    const size_t guard = 64;
+    for (size_t i = 0; i < payload.size(); i++) {
+        string damaged = payload;
+        damaged[i] ^= 0x24;
+        string out(text.size() + guard, '#');
+        try {
+            decodeLz77(damaged.data(), damaged.size(), &out[0], text.size());
+        } catch (ErrorException&) {
+            /* Reporting the damage is expected. */
+        }
+        EXPECT_EQUAL(out.substr(text.size()), string(guard, '#'));
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * LZ77 coding in the style of Deflate, used by the container for its Lz77 block
+ * method. Each block is parsed into literal bytes and matches (copies of up to
+ * kLzMaxMatch bytes from up to kLzMaxDistance bytes back, found with hash
+ * chains), and the literals, match lengths and match distances are then coded
+ * with canonical Huffman codes.
+ *
+ * Higher levels search the hash chains harder and look one byte ahead before
+ * taking a match, trading speed for smaller output.
+ */
+
+const int kLzMinLevel = 1;
+const int kLzMaxLevel = 9;
+const int kLzDefaultLevel = 6;
+
+const int kLzMinMatch = 4;
+const int kLzMaxMatch = 1 << 12;
+const int kLzMaxDistance = 1 << 18;
+
+/**
+ * Parses and codes size bytes of text at the given level, appending the payload
+ * to out.
+ */
+void encodeLz77(const char* text, size_t size, int level, std::string& out);
+
+/**
+ * Decodes a payload written by encodeLz77 into exactly size bytes at out.
+ * Reports an error if the payload is malformed.
+ */
+void decodeLz77(const char* payload, size_t payloadSize, char* out, size_t size);
@@ -1,8 +1,21 @@
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <set>
+#include <sstream>
+#include "adaptive.h"
+#include "archive.h"
 #include "bits.h"
 #include "console.h"
+#include "container.h"
+#include "daemon.h"
+#include "directory.h"
+#include "entropy.h"
+#include "fileio.h"
 #include "filelib.h"
 #include "huffman.h"
+#include "lz77.h"
+#include "pipeline.h"
 #include "simpio.h"
 #include "strlib.h"
 #include "SimpleTest.h"
@@ -17,6 +30,7 @@ int main() {
      * respond 0 when asked for which tests, and this falls through
      * to the code below.
      */
+    runSimpleTests(SELECTED_TESTS);
     huffmanConsoleProgram();
 
     cout << "All done, exiting" << endl;
@@ -40,7 +54,13 @@ string menu() {
     cout << endl;
     cout << "Your options are:" << endl;
     cout << "C) compress file" << endl;
+    cout << "S) compress file in one pass (adaptive, for streams)" << endl;
     cout << "D) decompress file" << endl;
+    cout << "A) archive several files" << endl;
+    cout << "X) extract from archive" << endl;
+    cout << "T) compress directory tree" << endl;
+    cout << "E) decompress directory tree" << endl;
+    cout << "V) run compression service" << endl;
     cout << "Q) quit" << endl;
 
     cout << endl;
@@ -49,6 +69,12 @@ string menu() {
 
 const string kCompressedExtension = ".huf";
 const string kDecompressedExtension = "unhuf.";
+const string kArchiveExtension = ".hufa";
+const string kDefaultSocketPath = "/tmp/huffman.sock";
+
+/* Bytes read to recognize a compressed file, and to estimate compression. */
+const size_t kMagicBytes = 4;
+const size_t kEstimatePrefixBytes = 1 << 20;
 
 /*
  * Prompts for names of files to use for compress/decompress.
@@ -79,6 +105,57 @@ bool getInputAndOutputFiles(string& inFilename, string& outFilename, bool compre
 }
 
 
+/* Compression levels offered by the console program; see promptForOptions. */
+const int kMaxCompressionLevel = kLzMaxLevel;
+const int kDefaultCompressionLevel = 5;
+
+/*
+ * Asks how hard to compress, from 0 (fastest) to kMaxCompressionLevel.
+ */
+int promptForLevel() {
+    while (true) {
+        string line = trim(getLine("Compression level (0-" + integerToString(kMaxCompressionLevel)
+                                   + ", Enter for " + integerToString(kDefaultCompressionLevel) + "): "));
+        if (line == "") {
+            return kDefaultCompressionLevel;
+        }
+        if (stringIsInteger(line)) {
+            int level = stringToInteger(line);
+            if (level >= 0 && level <= kMaxCompressionLevel) {
+                return level;
+            }
+        }
+        cout << "Please enter a level from the range shown." << endl;
+    }
+}
+
+/*
+ * Container options used by the console program, with checksums and an index,
+ * on every hardware thread. Each block method costs another pass over every
+ * block, so the slower ones are tried only at higher levels:
+ *
+ *   0      Huffman or codebook coding, and tANS
+ *   1-9    also LZ77 at the same level, and run-length coding
+ *   4-9    also the 16-bit symbol method
+ *   6-9    also order-1 context coding
+ *   8-9    also Burrows-Wheeler
+ */
+ContainerOptions promptForOptions() {
+    int level = promptForLevel();
+    ContainerOptions options;
+    options.ans = true;
+    options.lzLevel = level;
+    options.rle = level >= 1;
+    options.wide = level >= 4;
+    options.contexts = level >= 6;
+    options.bwt = level >= 8;
+    options.interleaved = true;
+    options.checksums = true;
+    options.index = true;
+    options.threads = 0;
+    return options;
+}
+
 string readEntireBinaryFile(string filename) {
     ifstream in(filename, std::ios::binary);
     string str;
@@ -87,6 +164,17 @@ string readEntireBinaryFile(string filename) {
     return str;
 }
 
+/*
+ * Reads at most size bytes from the start of the file.
+ */
+string readBinaryFilePrefix(string filename, size_t size) {
+    ifstream in(filename, std::ios::binary);
+    string str(size, '\0');
+    in.read(&str[0], size);
+    str.resize(in.gcount());
+    return str;
+}
+
 void writeEntireBinaryFile(string filename, string data) {
     ofstream out(filename, std::ios::binary);
     out.write(data.c_str(), data.size());
@@ -94,9 +182,13 @@ void writeEntireBinaryFile(string filename, string data) {
 
 /*
  * Compress a file.
- * Prompts for input/output file names and opens streams on those files.
- * Then calls your compress function and displays information about size of
- * compressed output.
+ * Prompts for input/output file names and a compression level, after checking
+ * a sample from the start of the input for data that looks incompressible.
+ * Then writes the file out as a block container (see container.h), which codes
+ * each block with whichever of the block methods enabled at that level (see
+ * promptForOptions) is smallest, storing it as is if none shrinks it, and
+ * displays the size of the compressed output. The file goes through the
+ * pipeline in pipeline.h, which reads, codes and writes blocks at once.
  */
 void compressFile() {
     string inFilename, outFilename;
@@ -106,11 +198,15 @@ void compressFile() {
     }
     cout << "Reading " << fileSize(inFilename) << " input bytes." << endl;
     try {
-        string text = readEntireBinaryFile(inFilename);
+        /* The estimate needs only a sample, so only the start is read here. */
+        CompressionEstimate estimate = estimateCompression(readBinaryFilePrefix(inFilename, kEstimatePrefixBytes));
+        if (looksRandom(estimate)) {
+            cout << "Input looks incompressible (" << estimate.entropyBits
+                 << " bits per byte); blocks that look the same are stored as is." << endl;
+        }
+        ContainerOptions options = promptForOptions();
         cout << "Compressing ..." << endl;
-        EncodedData data = compress(text);
-        ofstream out(outFilename, ios::binary);
-        writeData(data, out);
+        compressFilePipelined(inFilename, outFilename, options);
     } catch (ErrorException& e) {
         cout << "Ooops! " << e.getMessage() << endl;
     }
@@ -122,11 +218,199 @@ void compressFile() {
     }
 }
 
+/*
+ * Compress a file in a single pass.
+ * Prompts for input/output file names, then codes the input with adaptive
+ * Huffman coding as it is read, without reading it into memory first.
+ */
+void streamCompressFile() {
+    string inFilename, outFilename;
+
+    if (!getInputAndOutputFiles(inFilename, outFilename, true)) {
+        return;
+    }
+    cout << "Compressing in one pass ..." << endl;
+    try {
+        ifstream in(inFilename, std::ios::binary);
+        ofstream out(outFilename, std::ios::binary);
+        compressAdaptive(in, out);
+    } catch (ErrorException& e) {
+        cout << "Ooops! " << e.getMessage() << endl;
+    }
+
+    if (fileExists(outFilename)) {
+        cout << "Wrote " << fileSize(outFilename) << " compressed bytes." << endl;
+    } else {
+        cout << "Compressed output file was not found; perhaps there was an error." << endl;
+    }
+}
+
+/*
+ * Archive several files.
+ * Prompts for the files to add and the name of the archive, then compresses
+ * each file into one archive (see archive.h), several files at a time.
+ */
+void archiveFiles() {
+    vector<string> paths;
+    while (true) {
+        string path = trim(getLine("File to add (Enter when done): "));
+        if (path == "") break;
+        if (!fileExists(path)) {
+            cout << "No file found with that name." << endl;
+        } else if (find(paths.begin(), paths.end(), path) != paths.end()) {
+            cout << "That file is already in the archive." << endl;
+        } else {
+            paths.push_back(path);
+        }
+    }
+    if (paths.empty()) {
+        return;
+    }
+    string outFilename = trim(getLine("Archive file name (Enter for archive" + kArchiveExtension + "): "));
+    if (outFilename == "") {
+        outFilename = "archive" + kArchiveExtension;
+    }
+    if (find(paths.begin(), paths.end(), outFilename) != paths.end()) {
+        cout << "The archive cannot be one of its own files.  Canceling operation." << endl;
+        return;
+    }
+    if (fileExists(outFilename) && !getYesOrNo(outFilename + " already exists. Overwrite? (y/n) ")) {
+        return;
+    }
+    try {
+        ContainerOptions options = promptForOptions();
+        cout << "Compressing " << paths.size() << " files ..." << endl;
+        ofstream out(outFilename, std::ios::binary);
+        writeArchive(out, paths, paths, options);
+    } catch (ErrorException& e) {
+        cout << "Ooops! " << e.getMessage() << endl;
+    }
+
+    if (fileExists(outFilename)) {
+        cout << "Wrote " << fileSize(outFilename) << " compressed bytes." << endl;
+    } else {
+        cout << "Archive file was not found; perhaps there was an error." << endl;
+    }
+}
+
+/*
+ * Extract from an archive.
+ * Prompts for the archive and the entry to extract, or all of them, and writes
+ * each entry next to the archive, named as decompressFile would name it. Two
+ * entries that would get the same name cancel the extraction.
+ */
+void extractArchive() {
+    string inFilename = promptUserForFilename("Archive file name: ", "No file found with that name. Try again.");
+    try {
+        ifstream in(inFilename, std::ios::binary);
+        ArchiveReader archive(in);
+        cout << "Archive holds " << archive.entries().size() << " files." << endl;
+        vector<const ArchiveEntry*> chosen;
+        string name = trim(getLine("File to extract (Enter for all): "));
+        if (name == "") {
+            for (const ArchiveEntry& entry: archive.entries()) {
+                chosen.push_back(&entry);
+            }
+        } else if (const ArchiveEntry* entry = archive.find(name)) {
+            chosen.push_back(entry);
+        } else {
+            cout << "No file named " << name << " in the archive." << endl;
+            return;
+        }
+
+        /* Entries are written by their last name component only, so entries
+         * from different directories could land on the same file.
+         */
+        string head = getHead(inFilename);
+        string directory = !head.empty() ? head + getDirectoryPathSeparator() : "";
+        vector<string> outNames;
+        set<string> seen;
+        for (const ArchiveEntry* entry: chosen) {
+            string outName = directory + kDecompressedExtension + getTail(entry->name);
+            if (!seen.insert(outName).second) {
+                cout << "More than one file would be extracted to " << outName
+                     << "; extract them one at a time.  Canceling operation." << endl;
+                return;
+            }
+            outNames.push_back(outName);
+        }
+        cout << "Extracting ..." << endl;
+        archive.extractEach(chosen, 0, [&](size_t i, const string& contents) {
+            writeEntireBinaryFile(outNames[i], contents);
+        });
+        cout << "Extracted " << chosen.size() << " files." << endl;
+    } catch (ErrorException& e) {
+        cout << "Ooops! " << e.getMessage() << endl;
+    }
+}
+
+/*
+ * Compress or decompress a directory tree.
+ * Prompts for the input and output directories, then converts every file in
+ * the tree on all hardware threads (see directory.h) and reports any files
+ * that could not be converted.
+ */
+void convertDirectory(bool compressing) {
+    string inRoot = trim(getLine("Input directory: "));
+    if (!isDirectory(inRoot)) {
+        cout << "No directory found with that name." << endl;
+        return;
+    }
+    string defaultRoot = inRoot + (compressing ? kCompressedExtension : kCompressedExtension + ".out");
+    string outRoot = trim(getLine("Output directory (Enter for " + defaultRoot + "): "));
+    if (outRoot == "") {
+        outRoot = defaultRoot;
+    }
+    if (outRoot == inRoot) {
+        cout << "The output directory must differ from the input directory.  Canceling operation." << endl;
+        return;
+    }
+    try {
+        DirectoryStats stats;
+        if (compressing) {
+            ContainerOptions options = promptForOptions();
+            cout << "Compressing ..." << endl;
+            stats = compressDirectory(inRoot, outRoot, kCompressedExtension, options);
+        } else {
+            cout << "Decompressing ..." << endl;
+            stats = decompressDirectory(inRoot, outRoot, kCompressedExtension, 0);
+        }
+        cout << "Converted " << stats.files << " files, " << stats.inputBytes
+             << " bytes in, " << stats.outputBytes << " bytes out." << endl;
+        for (const string& failure: stats.failures) {
+            cout << "Skipped " << failure << endl;
+        }
+    } catch (ErrorException& e) {
+        cout << "Ooops! " << e.getMessage() << endl;
+    }
+}
+
+/*
+ * Run the compression service.
+ * Prompts for a socket path, then serves compress and decompress requests from
+ * other programs (see daemon.h) until one of them asks the service to stop.
+ */
+void runService() {
+    string socketPath = trim(getLine("Socket path (Enter for " + kDefaultSocketPath + "): "));
+    if (socketPath == "") {
+        socketPath = kDefaultSocketPath;
+    }
+    try {
+        ContainerOptions options = promptForOptions();
+        CompressionDaemon daemon(socketPath, options);
+        cout << "Serving on " << socketPath << "; send a 'Q' request to stop." << endl;
+        daemon.run();
+        cout << "Service stopped." << endl;
+    } catch (ErrorException& e) {
+        cout << "Ooops! " << e.getMessage() << endl;
+    }
+}
+
 /*
  * Decompress a file.
  * Prompts for input/output file names and opens streams on those files.
- * Then calls your decompress function and displays information about size of
- * decompressed output.
+ * Then decompresses a block container, an adaptive stream, or a file written by writeData,
+ * and displays information about size of decompressed output.
  */
 void decompressFile() {
     string inFilename, outFilename;
@@ -136,11 +420,27 @@ void decompressFile() {
     }
     cout << "Reading " << fileSize(inFilename) << " input bytes." << endl;
     try {
-        ifstream input(inFilename, ios::binary);
-        EncodedData data = readData(input);
         cout << "Decompressing ..." << endl;
-        string text = decompress(data);
-        writeEntireBinaryFile(outFilename, text);
+        if (isContainer(readBinaryFilePrefix(inFilename, kMagicBytes))) {
+            decompressFileOverlapped(inFilename, outFilename, 0);
+        } else {
+            string compressed = readEntireBinaryFile(inFilename);
+            string text;
+            if (isArchive(compressed)) {
+                error("That file is an archive; extract from it with X.");
+            } else if (isAdaptiveStream(compressed)) {
+                istringstream input(compressed);
+                ostringstream output;
+                decompressAdaptive(input, output);
+                text = output.str();
+            } else {
+                /* Files written by writeData before containers existed. */
+                istringstream input(compressed);
+                EncodedData data = readData(input);
+                text = decompress(data);
+            }
+            writeEntireBinaryFile(outFilename, text);
+        }
     } catch (ErrorException& e) {
         cout << "Ooops! " << e.getMessage() << endl;
     }
@@ -160,8 +460,20 @@ void huffmanConsoleProgram() {
             break;
         } else if (choice == "C") {
             compressFile();
+        } else if (choice == "S") {
+            streamCompressFile();
         } else if (choice == "D") {
             decompressFile();
+        } else if (choice == "A") {
+            archiveFiles();
+        } else if (choice == "X") {
+            extractArchive();
+        } else if (choice == "T") {
+            convertDirectory(true);
+        } else if (choice == "E") {
+            convertDirectory(false);
+        } else if (choice == "V") {
+            runService();
         }
     }
 }
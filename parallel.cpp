@@ -0,0 +1,87 @@
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "error.h"
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * Thread helpers. The public interface is provided in parallel.h header file.
+ */
+
+size_t workerCount(int threads, size_t count) {
+    size_t workers = threads > 0 ? threads : thread::hardware_concurrency();
+    return max<size_t>(1, min(workers, count));
+}
+
+void parallelFor(size_t count, int threads, const function<void(size_t)>& task) {
+    size_t workers = workerCount(threads, count);
+    if (workers == 1) {
+        for (size_t i = 0; i < count; i++) task(i);
+        return;
+    }
+
+    atomic<size_t> next(0);
+    mutex lock;
+    exception_ptr failure;
+    auto work = [&]() {
+        try {
+            for (size_t i = next++; i < count; i = next++) task(i);
+        } catch (...) {
+            lock_guard<mutex> guard(lock);
+            if (!failure) failure = current_exception();
+            next = count;
+        }
+    };
+
+    vector<thread> pool;
+    for (size_t t = 1; t < workers; t++) pool.emplace_back(work);
+    work();
+    for (thread& worker: pool) worker.join();
+    if (failure) rethrow_exception(failure);
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("workerCount stays between one and the number of pieces") {
+    EXPECT_EQUAL(workerCount(4, 100), size_t(4));
+    EXPECT_EQUAL(workerCount(4, 2), size_t(2));
+    EXPECT_EQUAL(workerCount(4, 0), size_t(1));
+    EXPECT_EQUAL(workerCount(1, 100), size_t(1));
+    EXPECT(workerCount(0, 1000) >= 1);
+    EXPECT(workerCount(0, 1000) <= max<size_t>(1, thread::hardware_concurrency()));
+}
+
+STUDENT_TEST("parallelFor calls the task once for every index") {
+    for (int threads: { 0, 1, 3, 8 }) {
+        for (size_t count: { size_t(0), size_t(1), size_t(5), size_t(1000) }) {
+            vector<atomic<int>> calls(count);
+            parallelFor(count, threads, [&](size_t i) {
+                calls[i]++;
+            });
+            for (size_t i = 0; i < count; i++) {
+                EXPECT_EQUAL(calls[i].load(), 1);
+            }
+        }
+    }
+}
+
+STUDENT_TEST("parallelFor rethrows an error once every thread has finished") {
+    for (int threads: { 1, 4 }) {
+        atomic<int> running(0);
+        atomic<int> finished(0);
+        EXPECT_ERROR(parallelFor(100, threads, [&](size_t i) {
+            running++;
+            if (i == 10) error("Task failed.");
+            finished++;
+            running--;
+        }));
+        EXPECT_EQUAL(running.load(), 1);
+        EXPECT(finished.load() < 100);
+    }
+}
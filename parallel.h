@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+/**
+ * Spreading independent pieces of work, such as container blocks or archive
+ * entries, over several threads.
+ */
+
+/**
+ * Returns how many threads to use for count pieces of work when asked for
+ * threads, where zero means one per hardware thread. Never more threads than
+ * pieces, and always at least one.
+ */
+size_t workerCount(int threads, size_t count);
+
+/**
+ * Calls task(i) for every index i below count, spread over workerCount(threads,
+ * count) threads, one of which is the calling thread. Each thread takes the
+ * next unclaimed index, so a slow piece does not hold up the others. If any
+ * task reports an error, the first one is rethrown once every thread has
+ * finished.
+ */
+void parallelFor(size_t count, int threads, const std::function<void(size_t)>& task);
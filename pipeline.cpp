@@ -0,0 +1,337 @@
+#include "pipeline.h"
+#include "boundedqueue.h"
+#include "error.h"
+#include "fileio.h"
+#include "parallel.h"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+#include "testutil.h"
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * The three-stage file compressor. The public interface is provided in
+ * pipeline.h header file.
+ */
+
+namespace {
+    /**
+     * A block on its way through the pipeline, raw or coded.
+     */
+    struct Piece {
+        size_t index;
+        string data;
+    };
+
+    /**
+     * Type that paces a stage waiting on another: a few quick retries, then
+     * yielding, then short sleeps, so a stage that is kept waiting for long
+     * does not take a core from the ones doing the work.
+     */
+    class Backoff {
+    public:
+        void pause() {
+            if (_tries < kSpins) {
+                _tries++;
+            } else if (_tries < kSpins + kYields) {
+                _tries++;
+                this_thread::yield();
+            } else {
+                this_thread::sleep_for(chrono::microseconds(50));
+            }
+        }
+
+        void reset() {
+            _tries = 0;
+        }
+
+    private:
+        static const int kSpins = 64;
+        static const int kYields = 64;
+        int _tries = 0;
+    };
+
+    /**
+     * What the stages share: the two queues, how far the writer has got, and
+     * the first error, which makes every stage give up.
+     */
+    struct Pipeline {
+        Pipeline() : raw(kPipelineWindow), coded(kPipelineWindow), taken(0), written(0), failed(false) {}
+
+        void fail() {
+            lock_guard<mutex> guard(lock);
+            if (!failure) failure = current_exception();
+            failed = true;
+        }
+
+        /* Pushes piece, waiting while the queue is full. Returns false if
+         * another stage failed first.
+         */
+        bool push(BoundedQueue<Piece>& queue, Piece& piece) {
+            Backoff backoff;
+            while (!queue.tryPush(piece)) {
+                if (failed) return false;
+                backoff.pause();
+            }
+            return true;
+        }
+
+        BoundedQueue<Piece> raw;
+        BoundedQueue<Piece> coded;
+        atomic<size_t> taken;      // raw blocks claimed by coders
+        atomic<size_t> written;    // blocks written, in order
+        atomic<bool> failed;
+        mutex lock;
+        exception_ptr failure;
+    };
+
+    /**
+     * Reads the blocks in order, keeping reads of the upcoming ones in flight
+     * up to the window, and passes each on to the coders once it has arrived.
+     */
+    void readBlocks(Pipeline& pipeline, const File& in, uint64_t size, size_t numBlocks,
+                    size_t blockSize) {
+        /* Blocks being read stay put in the deque until they arrive, and the
+         * transfers are declared after it so they finish with them first.
+         */
+        deque<Piece> reading;
+        deque<uint64_t> tags;
+        FileTransfers transfers;
+        Backoff backoff;
+        size_t next = 0;
+        while (next < numBlocks || !reading.empty()) {
+            while (next < numBlocks && next < pipeline.written + kPipelineWindow && !transfers.full()) {
+                uint64_t offset = uint64_t(next) * blockSize;
+                reading.push_back({ next, string(min<uint64_t>(blockSize, size - offset), '\0') });
+                tags.push_back(transfers.read(in.fd(), &reading.back().data[0], reading.back().data.size(), offset));
+                next++;
+            }
+            transfers.submit();
+
+            if (!reading.empty() && transfers.finished(tags.front())) {
+                backoff.reset();
+                if (!pipeline.push(pipeline.raw, reading.front())) return;
+                reading.pop_front();
+                tags.pop_front();
+            } else if (!reading.empty()) {
+                transfers.waitOne();
+            } else {
+                /* The window is full: wait for the writer to catch up. */
+                if (pipeline.failed) return;
+                backoff.pause();
+            }
+        }
+    }
+
+    void codeBlocks(Pipeline& pipeline, size_t numBlocks, const ContainerOptions& options) {
+        Backoff backoff;
+        Piece piece;
+        while (pipeline.taken < numBlocks && !pipeline.failed) {
+            if (!pipeline.raw.tryPop(piece)) {
+                backoff.pause();
+                continue;
+            }
+            backoff.reset();
+            pipeline.taken++;
+            string coded;
+            encodeBlock(piece.data.data(), piece.data.size(), options, coded);
+            piece.data.swap(coded);
+            if (!pipeline.push(pipeline.coded, piece)) return;
+        }
+    }
+}
+
+void compressFilePipelined(const string& inPath, const string& outPath, const ContainerOptions& options) {
+    checkContainerOptions(options);
+    File in(inPath, O_RDONLY);
+    File out(outPath, O_WRONLY | O_CREAT | O_TRUNC);
+    uint64_t size = in.size();
+    size_t numBlocks = (size + options.blockSize - 1) / options.blockSize;
+
+    Pipeline pipeline;
+    auto guarded = [&pipeline](function<void()> stage) {
+        return [&pipeline, stage]() {
+            try {
+                stage();
+            } catch (...) {
+                pipeline.fail();
+            }
+        };
+    };
+    vector<thread> threads;
+    threads.emplace_back(guarded([&]() { readBlocks(pipeline, in, size, numBlocks, options.blockSize); }));
+    size_t coders = workerCount(options.threads, numBlocks);
+    for (size_t i = 0; i < coders; i++) {
+        threads.emplace_back(guarded([&]() { codeBlocks(pipeline, numBlocks, options); }));
+    }
+
+    /* This thread is the writer: blocks arrive in any order and leave in
+     * order. The reader's window bounds how many can be waiting.
+     */
+    guarded([&]() {
+        FileTransfers transfers;
+        string header = containerHeader(options);
+        uint64_t outPos = header.size();
+        transfers.write(out.fd(), header, 0);
+        vector<uint64_t> rawSizes, blockBytes;
+        map<size_t, string> waiting;
+        Backoff backoff;
+        Piece piece;
+        size_t next = 0;
+        while (next < numBlocks && !pipeline.failed) {
+            if (!pipeline.coded.tryPop(piece)) {
+                backoff.pause();
+                continue;
+            }
+            backoff.reset();
+            waiting[piece.index].swap(piece.data);
+            for (auto it = waiting.begin(); it != waiting.end() && it->first == next; it = waiting.erase(it)) {
+                rawSizes.push_back(min<uint64_t>(options.blockSize, size - uint64_t(next) * options.blockSize));
+                blockBytes.push_back(it->second.size());
+                uint64_t blockPos = outPos;
+                outPos += it->second.size();
+                transfers.write(out.fd(), move(it->second), blockPos);
+                transfers.submit();
+                pipeline.written = ++next;
+            }
+        }
+        if (next == numBlocks) {
+            transfers.write(out.fd(), containerTrailer(options, rawSizes, blockBytes), outPos);
+            transfers.finishAll();
+            out.close();
+        }
+    })();
+
+    for (thread& stage: threads) {
+        stage.join();
+    }
+    if (pipeline.failure) {
+        rethrow_exception(pipeline.failure);
+    }
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+#if !defined(_WIN32)
+
+namespace {
+    string mixedData(size_t size, unsigned seed) {
+        mt19937 random(seed);
+        string data;
+        while (data.size() < size) {
+            if (random() % 2) {
+                data += "a line of text " + to_string(random() % 100) + "\n";
+            } else {
+                data += char(random());
+            }
+        }
+        return data.substr(0, size);
+    }
+}
+
+STUDENT_TEST("BoundedQueue holds its capacity rounded up to a power of two, in order") {
+    BoundedQueue<int> queue(3);
+    for (int lap = 0; lap < 10; lap++) {
+        for (int i = 0; i < 4; i++) {
+            int value = lap * 10 + i;
+            EXPECT(queue.tryPush(value));
+        }
+        int extra = -1;
+        EXPECT(!queue.tryPush(extra));
+        for (int i = 0; i < 4; i++) {
+            int value = -1;
+            EXPECT(queue.tryPop(value));
+            EXPECT_EQUAL(value, lap * 10 + i);
+        }
+        int none;
+        EXPECT(!queue.tryPop(none));
+    }
+}
+
+STUDENT_TEST("BoundedQueue passes every value once between many threads") {
+    const int kThreads = 4;
+    const int kValues = 20000;
+    BoundedQueue<int> queue(16);
+    atomic<long long> sum(0);
+    atomic<int> popped(0);
+    vector<thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&, t]() {
+            for (int i = 1; i <= kValues; i++) {
+                int value = t * kValues + i;
+                while (!queue.tryPush(value)) this_thread::yield();
+            }
+        });
+        threads.emplace_back([&]() {
+            while (popped < kThreads * kValues) {
+                int value;
+                if (queue.tryPop(value)) {
+                    sum += value;
+                    popped++;
+                } else {
+                    this_thread::yield();
+                }
+            }
+        });
+    }
+    for (thread& worker: threads) {
+        worker.join();
+    }
+    long long total = (long long) kThreads * kValues;
+    EXPECT_EQUAL(popped.load(), kThreads * kValues);
+    EXPECT_EQUAL(sum.load(), total * (total + 1) / 2);
+}
+
+STUDENT_TEST("The pipeline writes the same container as compressContainer") {
+    TestPath in, out;
+    string data = mixedData(60000, 1);
+    ofstream(in.path, ios::binary) << data;
+    for (size_t blockSize: { size_t(7), size_t(4096), size_t(25000), kDefaultBlockSize }) {
+        for (int threads: { 1, 3 }) {
+            ContainerOptions options;
+            options.blockSize = blockSize;
+            options.threads = threads;
+            options.index = blockSize == 4096;
+            compressFilePipelined(in.path, out.path, options);
+            EXPECT_EQUAL(contentsOf(out.path), compressContainer(data, options));
+        }
+    }
+}
+
+STUDENT_TEST("The pipeline compresses empty files") {
+    TestPath in, out;
+    compressFilePipelined(in.path, out.path, ContainerOptions());
+    EXPECT_EQUAL(decompressContainer(contentsOf(out.path)), "");
+}
+
+STUDENT_TEST("The pipeline reports files it cannot read or write") {
+    TestPath in, out;
+    ofstream(in.path, ios::binary) << mixedData(100000, 2);
+    ContainerOptions options;
+    options.blockSize = 4096;
+    EXPECT_ERROR(compressFilePipelined(in.path + "-missing", out.path, options));
+    EXPECT_ERROR(compressFilePipelined(in.path, out.path + "-missing/file", options));
+    if (access("/dev/full", W_OK) == 0) {
+        EXPECT_ERROR(compressFilePipelined(in.path, "/dev/full", options));
+    }
+    options.blockSize = 0;
+    EXPECT_ERROR(compressFilePipelined(in.path, out.path, options));
+}
+
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "container.h"
+#include <string>
+
+/**
+ * Compressing a file with reading, coding and writing running at once, so the
+ * time taken approaches the slowest of the three rather than their sum.
+ *
+ * A reader thread reads blocks in order into a queue; options.threads coder
+ * threads take blocks from it, code them, and pass them to a second queue; and
+ * the calling thread puts the coded blocks back in order and writes them. The
+ * reader and the writer each keep several transfers in flight through an
+ * IoQueue (see fileio.h), so neither waits on the disk for every block. The
+ * queues are lock-free (see boundedqueue.h). The reader stays at most
+ * kPipelineWindow blocks ahead of the writer, so a slow disk or slow coders
+ * hold the other stages back instead of filling memory.
+ */
+
+/* Blocks read but not yet written, at most. */
+const size_t kPipelineWindow = 32;
+
+/**
+ * Compresses the file at inPath into a container at outPath, replacing it.
+ * The output is the same as compressContainer's. Reports an error if either
+ * file cannot be read or written.
+ */
+void compressFilePipelined(const std::string& inPath, const std::string& outPath,
+                           const ContainerOptions& options);
@@ -0,0 +1,189 @@
+#include "rle.h"
+#include "bitstream.h"
+#include "codetable.h"
+#include "error.h"
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * Run-length coding of blocks. The public interface is provided in rle.h header
+ * file.
+ *
+ * Symbols 0-255 are literal bytes. Symbol 256 + b is a run of repeats of the
+ * byte before it, where b is the bucket (see toBucket in codetable.h) of the
+ * number of repeats minus kRleMinRepeat.
+ */
+
+namespace {
+    /* Buckets needed for repeat counts up to kRleMaxRepeat. */
+    const int kRepeatBuckets = 40;
+    const int kRleSymbols = 256 + kRepeatBuckets;
+
+    /* A literal byte (repeats 0) or a run of repeats of the previous byte. */
+    struct Token {
+        uint8_t  byte;
+        uint32_t repeats;
+    };
+}
+
+bool encodeRle(const char* text, size_t size, string& out) {
+    vector<Token> tokens;
+    bool anyRuns = false;
+    for (size_t pos = 0; pos < size; ) {
+        uint8_t byte = text[pos];
+        tokens.push_back({ byte, 0 });
+
+        size_t end = pos + 1;
+        while (end < size && uint8_t(text[end]) == byte && end - pos <= size_t(kRleMaxRepeat)) {
+            end++;
+        }
+        size_t repeats = end - pos - 1;
+        if (repeats >= size_t(kRleMinRepeat)) {
+            tokens.push_back({ byte, uint32_t(repeats) });
+            anyRuns = true;
+            pos = end;
+        } else {
+            pos++;
+        }
+    }
+    if (!anyRuns) return false;
+
+    vector<uint64_t> counts(kRleSymbols, 0);
+    int bucket, extraBits;
+    uint32_t extra;
+    for (const Token& token: tokens) {
+        if (token.repeats == 0) {
+            counts[token.byte]++;
+        } else {
+            toBucket(token.repeats - kRleMinRepeat, bucket, extraBits, extra);
+            counts[256 + bucket]++;
+        }
+    }
+
+    vector<uint8_t> lengths = codeLengthsFromCounts(counts, kMaxBlockCodeLength);
+    SymbolCode code = canonicalSymbolCode(lengths);
+    BitStreamWriter writer(out);
+    writeCodeLengths(writer, lengths);
+    for (const Token& token: tokens) {
+        if (token.repeats == 0) {
+            writer.put(code.bits[token.byte], code.length[token.byte]);
+        } else {
+            toBucket(token.repeats - kRleMinRepeat, bucket, extraBits, extra);
+            writer.put(code.bits[256 + bucket], code.length[256 + bucket]);
+            writer.put(extra, extraBits);
+        }
+    }
+    writer.flush();
+    return true;
+}
+
+void decodeRle(const char* payload, size_t payloadSize, char* out, size_t size) {
+    BitStreamReader reader(payload, payloadSize);
+    TableDecoder decoder(readCodeLengths(reader, kRleSymbols));
+
+    size_t pos = 0;
+    while (pos < size) {
+        int symbol = decoder.decode(reader);
+        if (symbol < 256) {
+            out[pos++] = char(symbol);
+            continue;
+        }
+
+        size_t repeats = kRleMinRepeat + fromBucket(symbol - 256, reader);
+        if (pos == 0 || repeats > size - pos) {
+            error("Invalid run in RLE block.");
+        }
+        memset(out + pos, out[pos - 1], repeats);
+        pos += repeats;
+    }
+    reader.checkNotOverrun();
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+namespace {
+    string decodedRle(const string& payload, size_t size) {
+        string text(size, '\0');
+        decodeRle(payload.data(), payload.size(), &text[0], size);
+        return text;
+    }
+
+    /* Letters with runs of every length up to maxRun mixed in. */
+    string textWithRuns(int maxRun, unsigned seed) {
+        mt19937 random(seed);
+        string text;
+        for (int run = 1; run <= maxRun; run++) {
+            text += char('a' + random() % 26);
+            text += string(run, char(random()));
+        }
+        return text;
+    }
+}
+
+STUDENT_TEST("RLE round-trips runs of every length") {
+    vector<string> inputs = {
+        string(kRleMinRepeat + 1, 'a'), string(1000, '\0'), textWithRuns(300, 1),
+        string(kRleMaxRepeat + 1, 'x'), string(3 * kRleMaxRepeat + 7, 'y') + "end"
+    };
+    for (const string& text: inputs) {
+        string payload;
+        EXPECT(encodeRle(text.data(), text.size(), payload));
+        EXPECT_EQUAL(decodedRle(payload, text.size()), text);
+    }
+}
+
+STUDENT_TEST("A long run codes in a few bytes") {
+    string zeros(kRleMaxRepeat, '\0');
+    string payload;
+    EXPECT(encodeRle(zeros.data(), zeros.size(), payload));
+    EXPECT(payload.size() < 64);
+}
+
+STUDENT_TEST("RLE declines text without runs") {
+    string payload = "untouched";
+    EXPECT(!encodeRle("", 0, payload));
+    EXPECT(!encodeRle("abcdefg", 7, payload));
+    EXPECT(!encodeRle("aabbaabb", 8, payload));
+    EXPECT_EQUAL(payload, "untouched");
+}
+
+STUDENT_TEST("Truncated RLE payloads are reported") {
+    string text = textWithRuns(100, 2);
+    string payload;
+    encodeRle(text.data(), text.size(), payload);
+    for (size_t size = 0; size < payload.size(); size++) {
+        EXPECT_ERROR(decodedRle(payload.substr(0, size), text.size()));
+    }
+}
+
+STUDENT_TEST("RLE runs past the end of the block are reported") {
+    /* The text ends in a run, which cannot fit in one byte less. */
+    string text = textWithRuns(100, 3);
+    string payload;
+    encodeRle(text.data(), text.size(), payload);
+    EXPECT_ERROR(decodedRle(payload, text.size() - 1));
+}
+
+STUDENT_TEST("Damaged RLE payloads never write past the block") {
+    string text = textWithRuns(100, 4);
+    string payload;
+    encodeRle(text.data(), text.size(), payload);
+    const size_t guard = 64;
+    for (size_t i = 0; i < payload.size(); i++) {
+        string damaged = payload;
+        damaged[i] ^= 0x24;
+        string out(text.size() + guard, '#');
+        try {
+            decodeRle(damaged.data(), damaged.size(), &out[0], text.size());
+        } catch (ErrorException&) {
+            /* Reporting the damage is expected. */
+        }
+        EXPECT_EQUAL(out.substr(text.size()), string(guard, '#'));
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Run-length coding ahead of Huffman coding, used by the container for its Rle
+ * block method. Each byte that starts a run is coded as itself, and the rest of
+ * the run as one extra symbol giving the number of repeats, so a long run of
+ * zeros in a sparse file costs a couple of codes rather than a bit per byte,
+ * and decodes with a single memset.
+ *
+ * Runs of fewer than kRleMinRepeat repeats are left as literal bytes, and runs
+ * longer than kRleMaxRepeat are split.
+ */
+
+const int kRleMinRepeat = 3;
+const int kRleMaxRepeat = 1 << 20;
+
+/**
+ * Codes size bytes of text, appending the payload to out. Returns false, writing
+ * nothing, if the text has no runs to code.
+ */
+bool encodeRle(const char* text, size_t size, std::string& out);
+
+/**
+ * Decodes a payload written by encodeRle into exactly size bytes at out.
+ * Reports an error if the payload is malformed.
+ */
+void decodeRle(const char* payload, size_t payloadSize, char* out, size_t size);
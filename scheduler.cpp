@@ -0,0 +1,274 @@
+#include "scheduler.h"
+#include "parallel.h"
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include "error.h"
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * The work-stealing pool. The public interface is provided in scheduler.h
+ * header file.
+ */
+
+namespace {
+    /* The pool and worker the current thread belongs to, if any. */
+    thread_local const WorkStealingPool* currentPool = nullptr;
+    thread_local size_t currentWorker = 0;
+
+    /* xorshift64, for picking which worker to steal from first. */
+    uint64_t nextRandom(uint64_t& state) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+}
+
+WorkStealingPool::WorkStealingPool(int threads)
+    : _queued(0), _unfinished(0), _sleepers(0), _stopping(false) {
+    size_t count = workerCount(threads, SIZE_MAX);
+    for (size_t i = 0; i < count; i++) {
+        _workers.emplace_back(new Worker);
+    }
+    for (size_t i = 0; i < count; i++) {
+        _threads.emplace_back(&WorkStealingPool::work, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        unique_lock<mutex> guard(_sleepLock);
+        _idle.wait(guard, [&]() { return _unfinished == 0; });
+        _stopping = true;
+    }
+    _wake.notify_all();
+    for (thread& worker: _threads) {
+        worker.join();
+    }
+}
+
+size_t WorkStealingPool::workers() const {
+    return _workers.size();
+}
+
+void WorkStealingPool::submit(function<void()> task) {
+    _unfinished++;
+    Worker& target = currentPool == this ? *_workers[currentWorker] : _shared;
+    {
+        lock_guard<mutex> guard(target.lock);
+        target.tasks.push_back(move(task));
+    }
+    _queued++;
+
+    /* A worker that found nothing either sees _queued above, or is counted
+     * in _sleepers here and is woken.
+     */
+    if (_sleepers > 0) {
+        lock_guard<mutex> guard(_sleepLock);
+        _wake.notify_one();
+    }
+}
+
+void WorkStealingPool::wait() {
+    unique_lock<mutex> guard(_sleepLock);
+    _idle.wait(guard, [&]() { return _unfinished == 0; });
+    if (_failure) {
+        exception_ptr failure = _failure;
+        _failure = nullptr;
+        rethrow_exception(failure);
+    }
+}
+
+bool WorkStealingPool::takeTask(size_t index, uint64_t& random, function<void()>& task) {
+    /* Own deque first, newest task first. */
+    Worker& own = *_workers[index];
+    {
+        lock_guard<mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = move(own.tasks.back());
+            own.tasks.pop_back();
+            _queued--;
+            return true;
+        }
+    }
+    {
+        lock_guard<mutex> guard(_shared.lock);
+        if (!_shared.tasks.empty()) {
+            task = move(_shared.tasks.front());
+            _shared.tasks.pop_front();
+            _queued--;
+            return true;
+        }
+    }
+
+    /* Steal the oldest task of the first worker found with any. */
+    size_t count = _workers.size();
+    size_t start = nextRandom(random) % count;
+    for (size_t i = 0; i < count; i++) {
+        Worker& victim = *_workers[(start + i) % count];
+        if (&victim == &own) continue;
+        lock_guard<mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = move(victim.tasks.front());
+            victim.tasks.pop_front();
+            _queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::finishTask() {
+    if (--_unfinished == 0) {
+        lock_guard<mutex> guard(_sleepLock);
+        _idle.notify_all();
+    }
+}
+
+void WorkStealingPool::work(size_t index) {
+    currentPool = this;
+    currentWorker = index;
+    uint64_t random = 0x9E3779B97F4A7C15ULL * (index + 1);
+    function<void()> task;
+    while (true) {
+        if (takeTask(index, random, task)) {
+            try {
+                task();
+            } catch (...) {
+                lock_guard<mutex> guard(_sleepLock);
+                if (!_failure) _failure = current_exception();
+            }
+            task = nullptr;
+            finishTask();
+            continue;
+        }
+
+        unique_lock<mutex> guard(_sleepLock);
+        _sleepers++;
+        _wake.wait(guard, [&]() { return _queued > 0 || _stopping; });
+        _sleepers--;
+        if (_stopping && _queued == 0) return;
+    }
+}
+
+MemoryBudget::MemoryBudget(uint64_t bytes) : _available(bytes), _total(bytes) {}
+
+uint64_t MemoryBudget::acquire(uint64_t bytes) {
+    bytes = min(bytes, _total);
+    unique_lock<mutex> guard(_lock);
+    _freed.wait(guard, [&]() { return _available >= bytes; });
+    _available -= bytes;
+    return bytes;
+}
+
+void MemoryBudget::release(uint64_t bytes) {
+    {
+        lock_guard<mutex> guard(_lock);
+        _available += bytes;
+    }
+    _freed.notify_all();
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+STUDENT_TEST("Every task and every task it submits runs once") {
+    for (int threads: { 1, 4 }) {
+        WorkStealingPool pool(threads);
+        EXPECT_EQUAL(pool.workers(), size_t(threads));
+        vector<atomic<int>> runs(10 * 100);
+        for (int job = 0; job < 10; job++) {
+            pool.submit([&, job]() {
+                for (int piece = 0; piece < 100; piece++) {
+                    pool.submit([&, job, piece]() {
+                        runs[job * 100 + piece]++;
+                    });
+                }
+            });
+        }
+        pool.wait();
+        for (atomic<int>& count: runs) {
+            EXPECT_EQUAL(count.load(), 1);
+        }
+    }
+}
+
+STUDENT_TEST("Idle workers steal the pieces of a large job") {
+    WorkStealingPool pool(4);
+    mutex lock;
+    set<thread::id> ran;
+    pool.submit([&]() {
+        for (int piece = 0; piece < 200; piece++) {
+            pool.submit([&]() {
+                this_thread::sleep_for(chrono::microseconds(200));
+                lock_guard<mutex> guard(lock);
+                ran.insert(this_thread::get_id());
+            });
+        }
+    });
+    pool.wait();
+    EXPECT(ran.size() > 1);
+}
+
+STUDENT_TEST("wait rethrows the first error, and the pool carries on") {
+    WorkStealingPool pool(3);
+    atomic<int> finished(0);
+    for (int i = 0; i < 50; i++) {
+        pool.submit([&, i]() {
+            if (i % 10 == 3) error("Task failed.");
+            finished++;
+        });
+    }
+    EXPECT_ERROR(pool.wait());
+    EXPECT_EQUAL(finished.load(), 45);
+
+    pool.submit([&]() { finished++; });
+    EXPECT_NO_ERROR(pool.wait());
+    EXPECT_EQUAL(finished.load(), 46);
+}
+
+STUDENT_TEST("The pool finishes every task before it is destroyed") {
+    atomic<int> finished(0);
+    {
+        WorkStealingPool pool(2);
+        for (int i = 0; i < 100; i++) {
+            pool.submit([&]() { finished++; });
+        }
+    }
+    EXPECT_EQUAL(finished.load(), 100);
+}
+
+STUDENT_TEST("MemoryBudget blocks until enough bytes are given back") {
+    MemoryBudget budget(100);
+    EXPECT_EQUAL(budget.acquire(60), uint64_t(60));
+    EXPECT_EQUAL(budget.acquire(40), uint64_t(40));
+
+    atomic<bool> granted(false);
+    thread waiter([&]() {
+        budget.release(budget.acquire(30));
+        granted = true;
+    });
+    this_thread::sleep_for(chrono::milliseconds(20));
+    EXPECT(!granted);
+    budget.release(40);
+    waiter.join();
+    EXPECT(granted);
+    budget.release(60);
+}
+
+STUDENT_TEST("MemoryBudget grants a request bigger than the budget once nothing is held") {
+    MemoryBudget budget(100);
+    uint64_t held = budget.acquire(10);
+    atomic<uint64_t> taken(0);
+    thread waiter([&]() {
+        taken = budget.acquire(1000);
+    });
+    this_thread::sleep_for(chrono::milliseconds(20));
+    EXPECT_EQUAL(taken.load(), uint64_t(0));
+    budget.release(held);
+    waiter.join();
+    EXPECT_EQUAL(taken.load(), uint64_t(100));
+    budget.release(taken);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A work-stealing thread pool, for batches of jobs whose sizes differ wildly.
+ *
+ * Every worker has its own deque of tasks. Tasks submitted by a task go on the
+ * bottom of its worker's deque, where that worker takes them back newest
+ * first, while its data is still in cache; an idle worker steals the oldest
+ * task from the top of some other worker's deque. So a job that splits itself
+ * into many small tasks, such as a large file split into blocks, is soon
+ * spread over every worker, and no worker sits idle while another has a
+ * backlog. Tasks submitted from outside the pool go on a shared queue.
+ *
+ * Each deque has its own lock, which is held only to push or pop one task;
+ * the owner and thieves work at opposite ends, so they rarely wait for it.
+ *
+ *     WorkStealingPool pool(0);
+ *     for (const string& path: paths) {
+ *         pool.submit([&pool, path]() {
+ *             for (each block) pool.submit(...);   // stealable
+ *         });
+ *     }
+ *     pool.wait();
+ */
+class WorkStealingPool {
+public:
+    /* Zero means one worker per hardware thread. */
+    explicit WorkStealingPool(int threads = 0);
+
+    /* Waits for every task, then stops the workers. */
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    /* Queues a task, on this worker's deque if called from one of the pool's
+     * tasks and on the shared queue otherwise.
+     */
+    void submit(std::function<void()> task);
+
+    /* Waits until every task submitted so far, and every task they submitted,
+     * has run. If any threw, rethrows the first and forgets the rest. Not for
+     * use from the pool's own tasks.
+     */
+    void wait();
+
+    size_t workers() const;
+
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void work(size_t index);
+    bool takeTask(size_t index, uint64_t& random, std::function<void()>& task);
+    void finishTask();
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    Worker _shared;                        // tasks from outside the pool
+    std::vector<std::thread> _threads;
+
+    std::atomic<size_t> _queued;           // tasks waiting in any deque
+    std::atomic<size_t> _unfinished;       // tasks submitted and not yet run
+    std::atomic<size_t> _sleepers;
+    std::atomic<bool> _stopping;
+
+    std::mutex _sleepLock;
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    std::exception_ptr _failure;
+};
+
+/**
+ * Type that hands out bytes from a fixed budget, blocking until enough have
+ * been given back. A request bigger than the whole budget is granted once
+ * nothing else is held. Used to bound how much of a batch is in memory at once,
+ * by acquiring before submitting a job to a pool rather than inside it, so the
+ * pool's workers never block.
+ */
+class MemoryBudget {
+public:
+    explicit MemoryBudget(uint64_t bytes);
+
+    /* Returns the number of bytes actually taken, to pass to release. */
+    uint64_t acquire(uint64_t bytes);
+    void release(uint64_t bytes);
+
+private:
+    std::mutex _lock;
+    std::condition_variable _freed;
+    uint64_t _available;
+    uint64_t _total;
+};
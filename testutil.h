@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+/**
+ * Fixtures shared by the test cases of several modules. Only the test cases
+ * include this header.
+ */
+
+/* size bytes drawn at random from the given seed, which no method can shrink. */
+inline std::string randomBytes(size_t size, unsigned seed) {
+    std::mt19937 random(seed);
+    std::string bytes;
+    while (bytes.size() < size) {
+        bytes += char(random());
+    }
+    return bytes;
+}
+
+/* The whole contents of the file at path, or nothing if it cannot be read. */
+inline std::string contentsOf(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+#if !defined(_WIN32)
+
+/* A temporary file path, removed when done. */
+struct TestPath {
+    std::string path;
+
+    TestPath() {
+        char pattern[] = "/tmp/huffman-test-XXXXXX";
+        ::close(mkstemp(pattern));
+        path = pattern;
+    }
+
+    ~TestPath() {
+        unlink(path.c_str());
+    }
+
+    TestPath(const TestPath&) = delete;
+    TestPath& operator=(const TestPath&) = delete;
+};
+
+#endif
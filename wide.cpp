@@ -0,0 +1,282 @@
+#include "wide.h"
+#include "bitstream.h"
+#include "codetable.h"
+#include "error.h"
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include "testutil.h"
+#include "SimpleTest.h"
+using namespace std;
+
+/**
+ * Wide-alphabet coding of blocks. The public interface is provided in wide.h
+ * header file.
+ *
+ * The payload holds the number of symbols that occur less one (16 bits); the
+ * last byte if the block has an odd size (8 bits); for each symbol that occurs,
+ * in increasing order, the gap since the previous one as a bucket (5 bits, see
+ * toBucket in codetable.h) and its extra bits, and its code length less one (5
+ * bits); and then the coded symbols.
+ */
+
+namespace {
+    const int kCountBits = 16;
+    const int kBucketBits = 5;
+    const int kLengthBits = 5;
+
+    /* Codes up to this long are resolved by the first lookup. */
+    const int kPrimaryBits = 12;
+
+    /* Low byte of a table entry with this bit set marks a second-level table. */
+    const uint32_t kSubtableFlag = 0x80;
+
+    /**
+     * Type that decodes a canonical code over a wide alphabet with at most two
+     * table lookups. Codes too long for the primary table share a second-level
+     * table per primary entry, indexed by the bits after the first
+     * kPrimaryBits.
+     */
+    class WideTableDecoder {
+    public:
+        explicit WideTableDecoder(const vector<uint8_t>& lengths);
+
+        int decode(BitStreamReader& reader) const {
+            uint32_t entry = _table[reader.peek(_primaryBits)];
+            if (entry & kSubtableFlag) {
+                reader.skip(_primaryBits);
+                entry = _table[(entry >> 8) + reader.peek(entry & 0x7F)];
+            }
+            reader.skip(entry & 0xFF);
+            return entry >> 8;
+        }
+
+    private:
+        int _primaryBits;
+        vector<uint32_t> _table;   // symbol << 8 | length, or offset << 8 | flag | bits
+    };
+
+    WideTableDecoder::WideTableDecoder(const vector<uint8_t>& lengths) {
+        SymbolCode code = canonicalSymbolCode(lengths);
+        int maxLength = 1;
+        for (uint8_t len: lengths) {
+            maxLength = max(maxLength, int(len));
+        }
+        _primaryBits = min(maxLength, kPrimaryBits);
+        uint32_t primarySize = 1U << _primaryBits;
+        uint32_t primaryMask = primarySize - 1;
+        _table.assign(primarySize, 0);
+
+        /* Size each second-level table for the longest code it holds. */
+        vector<uint8_t> subBits(primarySize, 0);
+        for (size_t sym = 0; sym < lengths.size(); sym++) {
+            int len = lengths[sym];
+            if (len > _primaryBits) {
+                uint8_t& bits = subBits[code.bits[sym] & primaryMask];
+                bits = max<uint8_t>(bits, len - _primaryBits);
+            }
+        }
+        for (uint32_t prefix = 0; prefix < primarySize; prefix++) {
+            if (subBits[prefix] == 0) continue;
+            _table[prefix] = uint32_t(_table.size()) << 8 | kSubtableFlag | subBits[prefix];
+            _table.resize(_table.size() + (size_t(1) << subBits[prefix]), 0);
+        }
+
+        for (size_t sym = 0; sym < lengths.size(); sym++) {
+            int len = lengths[sym];
+            if (len == 0) continue;
+            uint32_t bits = code.bits[sym];
+            if (len <= _primaryBits) {
+                for (uint32_t index = bits; index < primarySize; index += 1U << len) {
+                    _table[index] = uint32_t(sym) << 8 | len;
+                }
+            } else {
+                uint32_t subtable = _table[bits & primaryMask];
+                uint32_t start = subtable >> 8;
+                uint32_t size = 1U << (subtable & 0x7F);
+                int rest = len - _primaryBits;
+                for (uint32_t index = bits >> _primaryBits; index < size; index += 1U << rest) {
+                    _table[start + index] = uint32_t(sym) << 8 | rest;
+                }
+            }
+        }
+    }
+}
+
+bool encodeWide(const char* text, size_t size, uint64_t maxBytes, string& out) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(text);
+    size_t pairs = size / 2;
+    vector<uint64_t> counts(kWideSymbols, 0);
+    for (size_t i = 0; i < pairs; i++) {
+        counts[bytes[2 * i] | bytes[2 * i + 1] << 8]++;
+    }
+    vector<uint8_t> lengths = codeLengthsFromCounts(counts, kMaxWideCodeLength);
+
+    /* Work out the size before coding anything. */
+    uint64_t bits = kCountBits + (size % 2) * 8;
+    int present = 0;
+    int previous = -1;
+    int bucket, extraBits;
+    uint32_t extra;
+    for (int sym = 0; sym < kWideSymbols; sym++) {
+        if (lengths[sym] == 0) continue;
+        toBucket(sym - previous - 1, bucket, extraBits, extra);
+        bits += kBucketBits + extraBits + kLengthBits + counts[sym] * lengths[sym];
+        present++;
+        previous = sym;
+    }
+    if (present == 0 || (bits + 7) / 8 >= maxBytes) return false;
+
+    BitStreamWriter writer(out);
+    writer.put(present - 1, kCountBits);
+    if (size % 2) {
+        writer.put(bytes[size - 1], 8);
+    }
+    previous = -1;
+    for (int sym = 0; sym < kWideSymbols; sym++) {
+        if (lengths[sym] == 0) continue;
+        toBucket(sym - previous - 1, bucket, extraBits, extra);
+        writer.put(bucket, kBucketBits);
+        writer.put(extra, extraBits);
+        writer.put(lengths[sym] - 1, kLengthBits);
+        previous = sym;
+    }
+
+    SymbolCode code = canonicalSymbolCode(lengths);
+    for (size_t i = 0; i < pairs; i++) {
+        int sym = bytes[2 * i] | bytes[2 * i + 1] << 8;
+        writer.put(code.bits[sym], code.length[sym]);
+    }
+    writer.flush();
+    return true;
+}
+
+void decodeWide(const char* payload, size_t payloadSize, char* out, size_t size) {
+    BitStreamReader reader(payload, payloadSize);
+    int present = int(reader.get(kCountBits)) + 1;
+    if (size % 2) {
+        out[size - 1] = char(reader.get(8));
+    }
+
+    vector<uint8_t> lengths(kWideSymbols, 0);
+    int sym = -1;
+    for (int i = 0; i < present; i++) {
+        int bucket = reader.get(kBucketBits);
+        sym += 1 + fromBucket(bucket, reader);
+        if (sym >= kWideSymbols) {
+            error("Invalid symbol in wide block header.");
+        }
+        lengths[sym] = reader.get(kLengthBits) + 1;
+        if (lengths[sym] > kMaxWideCodeLength) {
+            error("Invalid code length in wide block header.");
+        }
+    }
+    reader.checkNotOverrun();
+    WideTableDecoder decoder(lengths);
+
+    size_t pairs = size / 2;
+    for (size_t i = 0; i < pairs; i++) {
+        int symbol = decoder.decode(reader);
+        out[2 * i] = char(symbol);
+        out[2 * i + 1] = char(symbol >> 8);
+    }
+    reader.checkNotOverrun();
+}
+
+
+/* * * * * * Test Cases * * * * * */
+
+namespace {
+    string encodedWide(const string& text) {
+        string payload;
+        EXPECT(encodeWide(text.data(), text.size(), UINT64_MAX, payload));
+        return payload;
+    }
+
+    string decodedWide(const string& payload, size_t size) {
+        string text(size, '\0');
+        decodeWide(payload.data(), payload.size(), &text[0], size);
+        return text;
+    }
+
+    /* A noisy sine wave as 16-bit little-endian samples. */
+    string samples(size_t count, unsigned seed) {
+        mt19937 random(seed);
+        string bytes;
+        for (size_t i = 0; i < count; i++) {
+            int sample = int(3000 * sin(i / 20.0)) + int(random() % 64);
+            bytes += char(sample & 0xFF);
+            bytes += char((sample >> 8) & 0xFF);
+        }
+        return bytes;
+    }
+}
+
+STUDENT_TEST("Wide coding round-trips even and odd sized blocks") {
+    vector<string> inputs = {
+        "ab", "abc", string(1001, 'q'), samples(10000, 1), samples(10000, 2) + "!",
+        randomBytes(300000, 3)
+    };
+    for (const string& text: inputs) {
+        EXPECT_EQUAL(decodedWide(encodedWide(text), text.size()), text);
+    }
+}
+
+STUDENT_TEST("Wide coding declines blocks without a whole pair") {
+    string payload;
+    EXPECT(!encodeWide("", 0, UINT64_MAX, payload));
+    EXPECT(!encodeWide("a", 1, UINT64_MAX, payload));
+    EXPECT_EQUAL(payload, "");
+}
+
+STUDENT_TEST("Wide codes stay within the longest code length") {
+    /* Pairs counted in Fibonacci numbers would get codes of up to 25 bits
+     * without the limit. */
+    string text;
+    uint64_t count = 1, next = 1;
+    for (int symbol = 0; symbol < 26; symbol++) {
+        for (uint64_t i = 0; i < count; i++) {
+            text += char(symbol);
+            text += char(symbol * 7);
+        }
+        uint64_t sum = count + next;
+        count = next;
+        next = sum;
+    }
+    EXPECT_EQUAL(decodedWide(encodedWide(text), text.size()), text);
+}
+
+STUDENT_TEST("Wide coding declines blocks that would not fit in maxBytes") {
+    string text = samples(5000, 4);
+    size_t needed = encodedWide(text).size();
+    string payload = "untouched";
+    EXPECT(!encodeWide(text.data(), text.size(), needed, payload));
+    EXPECT_EQUAL(payload, "untouched");
+    EXPECT(encodeWide(text.data(), text.size(), needed + 1, payload));
+}
+
+STUDENT_TEST("Truncated wide payloads are reported") {
+    string text = samples(300, 5) + "!";
+    string payload = encodedWide(text);
+    for (size_t size = 0; size < payload.size(); size++) {
+        EXPECT_ERROR(decodedWide(payload.substr(0, size), text.size()));
+    }
+}
+
+STUDENT_TEST("Damaged wide payloads never write past the block") {
+    string text = samples(300, 6) + "!";
+    string payload = encodedWide(text);
+    const size_t guard = 64;
+    for (size_t i = 0; i < payload.size(); i++) {
+        string damaged = payload;
+        damaged[i] ^= 0x24;
+        string out(text.size() + guard, '#');
+        try {
+            decodeWide(damaged.data(), damaged.size(), &out[0], text.size());
+        } catch (ErrorException&) {
+            /* Reporting the damage is expected. */
+        }
+        EXPECT_EQUAL(out.substr(text.size()), string(guard, '#'));
+    }
+}
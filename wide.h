@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Wide-alphabet Huffman coding, used by the container for its Wide block
+ * method. Each pair of bytes is coded as one symbol out of 65536: a 16-bit
+ * little-endian sample, or two adjacent characters of text. Samples that the
+ * byte alphabet sees as two poorly predicted halves, or character pairs that
+ * it codes one at a time, get a single code sized for the pair.
+ *
+ * A code for up to 65536 symbols needs codes longer than the byte methods
+ * allow, and writing a length for every symbol would cost more than most
+ * blocks save, so this method has its own header, listing only the symbols
+ * that occur, and its own two-level decoding table.
+ *
+ * A block with an odd number of bytes carries its last byte in the header.
+ */
+
+const int kWideSymbols = 1 << 16;
+const int kMaxWideCodeLength = 20;
+
+/**
+ * Codes size bytes of text, appending the payload to out, if it takes fewer
+ * than maxBytes bytes. Returns whether the payload was written. The size is
+ * worked out from the histogram before anything is coded.
+ */
+bool encodeWide(const char* text, size_t size, uint64_t maxBytes, std::string& out);
+
+/**
+ * Decodes a payload written by encodeWide into exactly size bytes at out.
+ * Reports an error if the payload is malformed.
+ */
+void decodeWide(const char* payload, size_t payloadSize, char* out, size_t size);